@@ -69,12 +69,12 @@ BOOL MatchNoCase(LPCSTR str1,LPCSTR str2)
 	return str2[0] == 0;
 }
 
-// Advances the input string pointer if match
-BOOL MatchNoCaseAdvance(LPCSTR* str1,LPCSTR str2)
+// Advances the input string pointer if match, the input string ends at end
+BOOL MatchNoCaseAdvance(LPCSTR* str1,LPCSTR end,LPCSTR str2)
 {
 	LPCSTR str = *str1;
 
-	while(str[0] && str2[0])
+	while(str < end && str2[0])
 	{
 		if(tolower(str[0]) != tolower(str2[0]))
 			return FALSE;
@@ -98,13 +98,14 @@ BOOL InitializeAssembler(LPASSEMBLER assembler)
 {
 	memset(assembler,0,sizeof(ASSEMBLER));
 
-	return TRUE;
+	return InitializeAtomTable(&assembler->Atoms);
 }
 
 VOID UninitializeAssembler(LPASSEMBLER assembler)
 {
 	FreeInstructions(&assembler->Instructions);
 	FreeLabels(&assembler->Labels);
+	UninitializeAtomTable(&assembler->Atoms);
 }
 
 ULONG ReadLabelDefinition(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
@@ -115,7 +116,7 @@ ULONG ReadLabelDefinition(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	InitializeToken(&parameter);
 
 	// Label definition
-	if(PeekTokenType(lexer,TOKEN_IDENTIFIER,TOKEN_NONE,&parameter) || !EqualNoCase(parameter.Value.Buffer,"equ"))
+	if(PeekTokenType(lexer,TOKEN_IDENTIFIER,TOKEN_NONE,&parameter) || parameter.TypeEx != ASMKEYWORD_EQU)
 	{
 		UninitializeToken(&parameter);
 		return 0;
@@ -145,14 +146,14 @@ ULONG ReadLabelDefinition(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	UninitializeToken(&parameter);
 
 	// Check if alias already exists
-	if(GetLabel(assembler->Labels,token->Value.Buffer))
+	if(GetLabel(assembler,token->Atom))
 	{
-		AssemblerError(lexer,token,"label with the name '%s' already defined",token->Value.Buffer);
+		AssemblerError(lexer,token,"label with the name '%s' already defined",GetAtomName(&assembler->Atoms,token->Atom));
 		return -1;
 	}
 
 	// Add the label
-	AddLabel(&assembler->Labels,token->Value.Buffer,address);
+	AddLabel(assembler,token->Atom,address);
 
 	return 2;	// Don't advance the current location
 }
@@ -164,14 +165,14 @@ ULONG ReadLabel(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return 0;
 
 	// Check if already defined
-	if(GetLabel(assembler->Labels,token->Value.Buffer))
+	if(GetLabel(assembler,token->Atom))
 	{
 		AssemblerError(lexer,token,"label with the same name already exists");
 		return -1;
 	}
 
 	// Add the label
-	AddLabel(&assembler->Labels,token->Value.Buffer,assembler->Location);
+	AddLabel(assembler,token->Atom,assembler->Location);
 
 	return 2;	// Don't advance the current location
 }
@@ -181,7 +182,7 @@ ULONG ReadDefine(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	TOKEN parameter;
 
 	// Define word/halfword/byte
-	if(!EqualNoCase(token->Value.Buffer,"dw") && !EqualNoCase(token->Value.Buffer,"dh") && !EqualNoCase(token->Value.Buffer,"db"))
+	if(token->TypeEx != ASMKEYWORD_DW && token->TypeEx != ASMKEYWORD_DH && token->TypeEx != ASMKEYWORD_DB)
 		return 0;
 
 	while(1)
@@ -206,14 +207,14 @@ ULONG ReadDefine(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 				return -1;
 			}
 
-			if(EqualNoCase(token->Value.Buffer,"dw"))
+			if(token->TypeEx == ASMKEYWORD_DW)
 			{
 				// Generate instruction
-				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_32,assembler->Location,NULL,NULL,NULL,data,0,0,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_32,assembler->Location,NULL,NULL,NULL,data,0,0,0,0,0);
 
 				assembler->Location += 4;
 			}
-			else if(EqualNoCase(token->Value.Buffer,"dh"))
+			else if(token->TypeEx == ASMKEYWORD_DH)
 			{
 				if(data != (data & 0xFFFF))
 					AssemblerWarning(lexer,&parameter,"number too large");
@@ -221,11 +222,11 @@ ULONG ReadDefine(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 				data &= 0xFFFF;
 
 				// Generate instruction
-				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_16,assembler->Location,NULL,NULL,NULL,data,0,0,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_16,assembler->Location,NULL,NULL,NULL,data,0,0,0,0,0);
 
 				assembler->Location += 2;
 			}
-			else if(EqualNoCase(token->Value.Buffer,"db"))
+			else if(token->TypeEx == ASMKEYWORD_DB)
 			{
 				if(data != (data & 0xFF))
 					AssemblerWarning(lexer,&parameter,"number too large");
@@ -233,7 +234,7 @@ ULONG ReadDefine(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 				data &= 0xFF;
 
 				// Generate instruction
-				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_8,assembler->Location,NULL,NULL,NULL,data,0,0,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_8,assembler->Location,NULL,NULL,NULL,data,0,0,0,0,0);
 
 				assembler->Location += 1;
 			}
@@ -243,16 +244,16 @@ ULONG ReadDefine(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		{
 			LPCSTR buffer;
 			// Convert to data
-			for(buffer = parameter.Value.Buffer; buffer[0]; ++buffer)
+			for(buffer = parameter.Value; buffer < parameter.Value + parameter.Length; ++buffer)
 			{
-				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_8,assembler->Location,NULL,NULL,NULL,buffer[0],0,0,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_8,assembler->Location,NULL,NULL,NULL,buffer[0],0,0,0,0,0);
 
 				assembler->Location += 1;
 			}
 		}
 		else if(parameter.Type == TOKEN_LITERAL)
 		{
-			AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_8,assembler->Location,NULL,NULL,NULL,parameter.Value.Buffer[0],0,0,NULL,NULL,NULL);
+			AddInstruction(&assembler->Instructions,INSTRUCTION_DATA,INSTRUCTION_DATA_8,assembler->Location,NULL,NULL,NULL,parameter.Length ? parameter.Value[0] : 0,0,0,0,0,0);
 
 			assembler->Location += 1;
 		}
@@ -275,37 +276,36 @@ ULONG ReadDefine(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	return 2;	// We manualy advance the current position
 }
 
-LPCONDITION GetCondition(LPCSTR name)
+// The name ends at end
+LPCONDITION GetCondition(LPCSTR name,LPCSTR end)
 {
 	ULONG i;
 
 	for(i = 0; ARMCONDITIONS[i].Name; ++i)
-		if(EqualNoCase(name,ARMCONDITIONS[i].Name))
+	{
+		LPCSTR str = name;
+
+		if(MatchNoCaseAdvance(&str,end,ARMCONDITIONS[i].Name) && str == end)
 			return &ARMCONDITIONS[i];
+	}
 
 	return NULL;
 }
 
-LPREGISTER GetRegister(LPCSTR name)
+LPREGISTER GetRegister(LPTOKEN token)
 {
-	ULONG i;
-
-	for(i = 0; ARMREGISTERS[i].Name; ++i)
-		if(EqualNoCase(name,ARMREGISTERS[i].Name))
-			return &ARMREGISTERS[i];
+	if(token->Type != TOKEN_IDENTIFIER || (token->TypeEx & ASMKEYWORD_KIND_MASK) != ASMKEYWORD_REGISTER)
+		return NULL;
 
-	return NULL;
+	return &ARMREGISTERS[token->TypeEx & ASMKEYWORD_INDEX_MASK];
 }
 
-BYTE GetShift(LPCSTR name)
+BYTE GetShift(LPTOKEN token)
 {
-	ULONG i;
-
-	for(i = 0; ARMSHIFTS[i].Name; ++i)
-		if(EqualNoCase(name,ARMSHIFTS[i].Name))
-			return ARMSHIFTS[i].Type;
+	if(token->Type != TOKEN_IDENTIFIER || (token->TypeEx & ASMKEYWORD_KIND_MASK) != ASMKEYWORD_SHIFT)
+		return 0;
 
-	return 0;
+	return ARMSHIFTS[token->TypeEx & ASMKEYWORD_INDEX_MASK].Type;
 }
 
 ULONG ReadOptionalShift(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token,LPSHIFTER shift)
@@ -324,7 +324,7 @@ ULONG ReadOptionalShift(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token,LPSHIF
 		return -1;
 	}
 
-	shift->Type = GetShift(parameter.Value.Buffer);
+	shift->Type = GetShift(&parameter);
 	if(!shift->Type)
 	{
 		AssemblerError(lexer,&parameter,"invalid shift type");
@@ -385,7 +385,7 @@ ULONG ReadOperand(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token,LPOPERAND op
 	{
 		LPREGISTER registr;
 
-		registr = GetRegister(parameter.Value.Buffer);
+		registr = GetRegister(&parameter);
 		if(!registr)
 		{
 			AssemblerError(lexer,&parameter,"invalid register");
@@ -406,7 +406,7 @@ ULONG ReadOperand(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token,LPOPERAND op
 				return -1;
 			}
 
-			operand->Type = GetShift(parameter.Value.Buffer);
+			operand->Type = GetShift(&parameter);
 			if(!operand->Type)
 			{
 				AssemblerError(lexer,&parameter,"invalid shift");
@@ -440,7 +440,7 @@ ULONG ReadOperand(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token,LPOPERAND op
 			{
 				LPREGISTER registr;
 
-				registr = GetRegister(parameter.Value.Buffer);
+				registr = GetRegister(&parameter);
 				if(!registr)
 				{
 					AssemblerError(lexer,&parameter,"invalid register");
@@ -472,16 +472,17 @@ ULONG ReadOperand(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token,LPOPERAND op
 
 ULONG ReadInstructionBranch(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 {
-	LPCSTR instruction = token->Value.Buffer;
+	LPCSTR instruction = token->Value;
+	LPCSTR end = token->Value + token->Length;
 	ULONG typeex = 0;
 	TOKEN address;
 	LPCONDITION condition;
 
 	// Branch and link
-	if(!MatchNoCaseAdvance(&instruction,"bl"))
+	if(!MatchNoCaseAdvance(&instruction,end,"bl"))
 	{
 		// Branch
-		if(!MatchNoCaseAdvance(&instruction,"b"))
+		if(!MatchNoCaseAdvance(&instruction,end,"b"))
 			return 0;
 	}
 	else
@@ -490,10 +491,10 @@ ULONG ReadInstructionBranch(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	}
 
 	// Get condition code
-	condition = GetCondition(instruction);
+	condition = GetCondition(instruction,end);
 
 	// Check if invalid condition code specified
-	if(!condition && instruction[0])
+	if(!condition && instruction != end)
 	{
 		AssemblerError(lexer,token,"invalid instruction");
 		return -1;
@@ -513,7 +514,7 @@ ULONG ReadInstructionBranch(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	if(address.Type == TOKEN_IDENTIFIER)
 	{
 		// Generate instruction
-		AddInstruction(&assembler->Instructions,INSTRUCTION_BRANCH,typeex,assembler->Location,condition,NULL,NULL,0,0,0,address.Value.Buffer,NULL,NULL);
+		AddInstruction(&assembler->Instructions,INSTRUCTION_BRANCH,typeex,assembler->Location,condition,NULL,NULL,0,0,0,address.Atom,0,0);
 	}
 	else // Number
 	{
@@ -528,7 +529,7 @@ ULONG ReadInstructionBranch(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		}
 
 		// Generate instruction
-		AddInstruction(&assembler->Instructions,INSTRUCTION_BRANCH,typeex,assembler->Location,condition,NULL,NULL,value,0,0,NULL,NULL,NULL);
+		AddInstruction(&assembler->Instructions,INSTRUCTION_BRANCH,typeex,assembler->Location,condition,NULL,NULL,value,0,0,0,0,0);
 	}
 
 	UninitializeToken(&address);
@@ -538,7 +539,8 @@ ULONG ReadInstructionBranch(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 
 ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 {
-	LPCSTR instruction = token->Value.Buffer;
+	LPCSTR instruction = token->Value;
+	LPCSTR end = token->Value + token->Length;
 	ULONG type;
 	ULONG typeex = 0;
 	LPCONDITION condition;
@@ -546,10 +548,10 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 	TOKEN parameter;
 
 	// Load
-	if(!MatchNoCaseAdvance(&instruction,"ldr"))
+	if(!MatchNoCaseAdvance(&instruction,end,"ldr"))
 	{
 		// Store
-		if(!MatchNoCaseAdvance(&instruction,"str"))
+		if(!MatchNoCaseAdvance(&instruction,end,"str"))
 			return 0;
 
 		type = INSTRUCTION_STORE;
@@ -560,26 +562,26 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 	}
 
 	// Check if operand size specified
-	if(MatchNoCaseAdvance(&instruction,"d"))
+	if(MatchNoCaseAdvance(&instruction,end,"d"))
 		typeex |= INSTRUCTION_LOAD_DOUBLEWORD;
-	else if(MatchNoCaseAdvance(&instruction,"sh"))
+	else if(MatchNoCaseAdvance(&instruction,end,"sh"))
 		typeex |= INSTRUCTION_LOAD_SIGNED_HALFWORD;
-	else if(MatchNoCaseAdvance(&instruction,"sb"))
+	else if(MatchNoCaseAdvance(&instruction,end,"sb"))
 		typeex |= INSTRUCTION_LOAD_SIGNED_BYTE;
-	else if(MatchNoCaseAdvance(&instruction,"h"))
+	else if(MatchNoCaseAdvance(&instruction,end,"h"))
 		typeex |= INSTRUCTION_LOAD_HALFWORD;
-	else if(MatchNoCaseAdvance(&instruction,"b"))
+	else if(MatchNoCaseAdvance(&instruction,end,"b"))
 		typeex |= INSTRUCTION_LOAD_BYTE;
 
 	// TODO This should only be allowed in certan combinations of the previous flag
-	if(MatchNoCaseAdvance(&instruction,"t"))
+	if(MatchNoCaseAdvance(&instruction,end,"t"))
 		typeex |= INSTRUCTION_LOAD_TRANSLATE;
 
 	// Get condition code
-	condition = GetCondition(instruction);
+	condition = GetCondition(instruction,end);
 
 	// Check if invalid condition code specified
-	if(!condition && instruction[0])
+	if(!condition && instruction != end)
 	{
 		AssemblerError(lexer,token,"invalid instruction");
 		return -1;
@@ -595,7 +597,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 	}
 
 	// Check if parameter is register
-	source = GetRegister(parameter.Value.Buffer);
+	source = GetRegister(&parameter);
 	if(!source)
 	{
 		AssemblerError(lexer,&parameter,"invalid source register");
@@ -636,7 +638,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 			return -1;
 		}
 
-		destination = GetRegister(parameter.Value.Buffer);
+		destination = GetRegister(&parameter);
 		if(!destination)
 		{
 			AssemblerError(lexer,&parameter,"invalid destination register");
@@ -677,7 +679,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 						return -1;
 					}
 					
-					AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_IMMEDIATE|INSTRUCTION_LOAD_POSTINDEX,assembler->Location,condition,NULL,NULL,source->Code,destination->Code,address,NULL,NULL,NULL);
+					AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_IMMEDIATE|INSTRUCTION_LOAD_POSTINDEX,assembler->Location,condition,NULL,NULL,source->Code,destination->Code,address,0,0,0);
 				}
 				else if(parameter.Type == TOKEN_IDENTIFIER || (parameter.Type == TOKEN_PUNCTUATION && (parameter.TypeEx == PUNCTUATION_ADD || parameter.TypeEx == PUNCTUATION_SUB)))
 				{
@@ -695,7 +697,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 						}
 					}
 
-					offset = GetRegister(parameter.Value.Buffer);
+					offset = GetRegister(&parameter);
 					if(!offset)
 					{
 						AssemblerError(lexer,&parameter,"invalid register");
@@ -717,7 +719,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 						}
 					}
 
-					AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_POSTINDEX,assembler->Location,condition,shift.Type ? &shift : NULL,NULL,source->Code,destination->Code,offset->Code,NULL,NULL,NULL);
+					AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_POSTINDEX,assembler->Location,condition,shift.Type ? &shift : NULL,NULL,source->Code,destination->Code,offset->Code,0,0,0);
 				}
 				else
 				{
@@ -731,7 +733,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 				if(!SkipTokenType(lexer,TOKEN_PUNCTUATION,PUNCTUATION_LOGIC_NOT))
 					typeex |= INSTRUCTION_LOAD_MODIFY;
 
-				AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_POSTINDEX,assembler->Location,condition,NULL,NULL,source->Code,destination->Code,0,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_POSTINDEX,assembler->Location,condition,NULL,NULL,source->Code,destination->Code,0,0,0,0);
 			}
 		}
 		else if(parameter.Type == TOKEN_PUNCTUATION && parameter.TypeEx == PUNCTUATION_COMMA)
@@ -766,7 +768,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 				if(!SkipTokenType(lexer,TOKEN_PUNCTUATION,PUNCTUATION_LOGIC_NOT))
 					typeex |= INSTRUCTION_LOAD_MODIFY;
 				
-				AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_IMMEDIATE,assembler->Location,condition,NULL,NULL,source->Code,destination->Code,address,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,type,typeex|INSTRUCTION_LOAD_IMMEDIATE,assembler->Location,condition,NULL,NULL,source->Code,destination->Code,address,0,0,0);
 			}
 			else if(parameter.Type == TOKEN_IDENTIFIER || (parameter.Type == TOKEN_PUNCTUATION && (parameter.TypeEx == PUNCTUATION_ADD || parameter.TypeEx == PUNCTUATION_SUB)))
 			{
@@ -784,7 +786,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 					}
 				}
 
-				offset = GetRegister(parameter.Value.Buffer);
+				offset = GetRegister(&parameter);
 				if(!offset)
 				{
 					AssemblerError(lexer,&parameter,"invalid register");
@@ -814,7 +816,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 					return -1;
 				}
 
-				AddInstruction(&assembler->Instructions,type,typeex,assembler->Location,condition,shift.Type ? &shift : NULL,NULL,source->Code,destination->Code,offset->Code,NULL,NULL,NULL);
+				AddInstruction(&assembler->Instructions,type,typeex,assembler->Location,condition,shift.Type ? &shift : NULL,NULL,source->Code,destination->Code,offset->Code,0,0,0);
 			}
 			else
 			{
@@ -834,7 +836,7 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 	else if(parameter.Type == TOKEN_IDENTIFIER)
 	{
 		// Label
-		AddInstruction(&assembler->Instructions,type,0,assembler->Location,condition,NULL,NULL,source->Code,0,0,NULL,parameter.Value.Buffer,NULL);
+		AddInstruction(&assembler->Instructions,type,0,assembler->Location,condition,NULL,NULL,source->Code,0,0,0,parameter.Atom,0);
 	}
 	else
 	{
@@ -850,7 +852,8 @@ ULONG ReadInstructionLoadStore(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token
 
 ULONG ReadInstructionMove(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 {
-	LPCSTR instruction = token->Value.Buffer;
+	LPCSTR instruction = token->Value;
+	LPCSTR end = token->Value + token->Length;
 	ULONG typeex = 0;
 	LPCONDITION condition;
 	LPREGISTER destination;
@@ -858,10 +861,10 @@ ULONG ReadInstructionMove(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	TOKEN parameter;
 
 	// Load
-	if(!MatchNoCaseAdvance(&instruction,"mov"))
+	if(!MatchNoCaseAdvance(&instruction,end,"mov"))
 	{
 		// Store
-		if(!MatchNoCaseAdvance(&instruction,"mvn"))
+		if(!MatchNoCaseAdvance(&instruction,end,"mvn"))
 			return 0;
 	}
 	else
@@ -870,14 +873,14 @@ ULONG ReadInstructionMove(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	}
 
 	// Check if operand size specified
-	if(MatchNoCaseAdvance(&instruction,"s"))
+	if(MatchNoCaseAdvance(&instruction,end,"s"))
 		typeex |= INSTRUCTION_MOVE_STATUS;
 
 	// Get condition code
-	condition = GetCondition(instruction);
+	condition = GetCondition(instruction,end);
 
 	// Check if invalid condition code specified
-	if(!condition && instruction[0])
+	if(!condition && instruction != end)
 	{
 		AssemblerError(lexer,token,"invalid instruction");
 		return -1;
@@ -891,7 +894,7 @@ ULONG ReadInstructionMove(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	destination = GetRegister(parameter.Value.Buffer);
+	destination = GetRegister(&parameter);
 	if(!destination)
 	{
 		AssemblerError(lexer,&parameter,"invalid destination register");
@@ -912,7 +915,7 @@ ULONG ReadInstructionMove(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	AddInstruction(&assembler->Instructions,INSTRUCTION_MOVE,typeex,assembler->Location,condition,NULL,&operand,destination->Code,0,0,NULL,NULL,NULL);
+	AddInstruction(&assembler->Instructions,INSTRUCTION_MOVE,typeex,assembler->Location,condition,NULL,&operand,destination->Code,0,0,0,0,0);
 
 	UninitializeToken(&parameter);
 
@@ -921,7 +924,8 @@ ULONG ReadInstructionMove(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 
 ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 {
-	LPCSTR instruction = token->Value.Buffer;
+	LPCSTR instruction = token->Value;
+	LPCSTR end = token->Value + token->Length;
 	ULONG type;
 	ULONG typeex = 0;
 	LPCONDITION condition;
@@ -931,14 +935,14 @@ ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	TOKEN parameter;
 
 	// Load
-	if(!MatchNoCaseAdvance(&instruction,"add"))
+	if(!MatchNoCaseAdvance(&instruction,end,"add"))
 	{
 		// Store
-		if(!MatchNoCaseAdvance(&instruction,"adc"))
+		if(!MatchNoCaseAdvance(&instruction,end,"adc"))
 		{
-			if(!MatchNoCaseAdvance(&instruction,"sub"))
+			if(!MatchNoCaseAdvance(&instruction,end,"sub"))
 			{
-				if(!MatchNoCaseAdvance(&instruction,"sub"))
+				if(!MatchNoCaseAdvance(&instruction,end,"sub"))
 					return 0;
 
 				type = INSTRUCTION_SUB;
@@ -961,14 +965,14 @@ ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	}
 
 	// Check if operand size specified
-	if(MatchNoCaseAdvance(&instruction,"s"))
+	if(MatchNoCaseAdvance(&instruction,end,"s"))
 		typeex |= INSTRUCTION_ADD_STATUS;
 
 	// Get condition code
-	condition = GetCondition(instruction);
+	condition = GetCondition(instruction,end);
 
 	// Check if invalid condition code specified
-	if(!condition && instruction[0])
+	if(!condition && instruction != end)
 	{
 		AssemblerError(lexer,token,"invalid instruction");
 		return -1;
@@ -982,7 +986,7 @@ ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	destination = GetRegister(parameter.Value.Buffer);
+	destination = GetRegister(&parameter);
 	if(!destination)
 	{
 		AssemblerError(lexer,&parameter,"invalid register");
@@ -1005,7 +1009,7 @@ ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	source = GetRegister(parameter.Value.Buffer);
+	source = GetRegister(&parameter);
 	if(!source)
 	{
 		AssemblerError(lexer,&parameter,"invalid register");
@@ -1026,7 +1030,7 @@ ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	AddInstruction(&assembler->Instructions,type,typeex,assembler->Location,condition,NULL,&operand,destination->Code,source->Code,0,NULL,NULL,NULL);
+	AddInstruction(&assembler->Instructions,type,typeex,assembler->Location,condition,NULL,&operand,destination->Code,source->Code,0,0,0,0);
 
 	UninitializeToken(&parameter);
 
@@ -1035,7 +1039,8 @@ ULONG ReadInstructionAddSub(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 
 ULONG ReadInstructionTest(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 {
-	LPCSTR instruction = token->Value.Buffer;
+	LPCSTR instruction = token->Value;
+	LPCSTR end = token->Value + token->Length;
 	ULONG typeex = 0;
 	LPCONDITION condition;
 	LPREGISTER destination;
@@ -1043,20 +1048,20 @@ ULONG ReadInstructionTest(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 	TOKEN parameter;
 
 	// Load
-	if(!MatchNoCaseAdvance(&instruction,"tst"))
+	if(!MatchNoCaseAdvance(&instruction,end,"tst"))
 	{
 		// Store
-		if(!MatchNoCaseAdvance(&instruction,"teq"))
+		if(!MatchNoCaseAdvance(&instruction,end,"teq"))
 			return 0;
 
 		typeex |= INSTRUCTION_TEST_EQ;
 	}
 
 	// Get condition code
-	condition = GetCondition(instruction);
+	condition = GetCondition(instruction,end);
 
 	// Check if invalid condition code specified
-	if(!condition && instruction[0])
+	if(!condition && instruction != end)
 	{
 		AssemblerError(lexer,token,"invalid instruction");
 		return -1;
@@ -1070,7 +1075,7 @@ ULONG ReadInstructionTest(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	destination = GetRegister(parameter.Value.Buffer);
+	destination = GetRegister(&parameter);
 	if(!destination)
 	{
 		AssemblerError(lexer,&parameter,"invalid destination register");
@@ -1092,7 +1097,7 @@ ULONG ReadInstructionTest(LPASSEMBLER assembler,LPLEXER lexer,LPTOKEN token)
 		return -1;
 	}
 
-	AddInstruction(&assembler->Instructions,INSTRUCTION_TEST,typeex,assembler->Location,condition,NULL,&operand,destination->Code,0,0,NULL,NULL,NULL);
+	AddInstruction(&assembler->Instructions,INSTRUCTION_TEST,typeex,assembler->Location,condition,NULL,&operand,destination->Code,0,0,0,0,0);
 
 	UninitializeToken(&parameter);
 
@@ -1118,7 +1123,8 @@ BOOL AssembleFile(LPASSEMBLER assembler,LPCSTR path)
 	ULONG error;
 	LEXER lexer;
 
-	InitializeLexer(&lexer,CPPPUNCTUATIONS,ASMCOMMENT,ASMMULTILINECOMMENTBEGIN,ASMMULTILINECOMMENTEND);
+	InitializeLexerProfile(&lexer,LEXER_PROFILE_ASM,ARMKEYWORDS,TRUE);
+	SetAtomTable(&lexer,&assembler->Atoms);
 
 	if(!LoadFile(&lexer,path))
 	{
@@ -1165,7 +1171,7 @@ BOOL AssembleFile(LPASSEMBLER assembler,LPCSTR path)
 		if(!READFUNCTIONS[i])
 		{
 			// Unknown
-			AssemblerError(&lexer,&token,"unknown instruction '%s'",token.Value.Buffer);
+			AssemblerError(&lexer,&token,"unknown instruction '%.*s'",token.Length,token.Value);
 			UninitializeToken(&token);
 			UninitializeLexer(&lexer);
 			return FALSE;
@@ -1182,14 +1188,16 @@ BOOL AssembleFile(LPASSEMBLER assembler,LPCSTR path)
 VOID AssemblerWarning(LPLEXER lexer,LPTOKEN token,LPCSTR format,...)
 {
 	CHAR buffer[2048];
+	ULONG line;
+	ULONG column;
     
     va_list args;
     va_start(args,format);
 	_vsnprintf(buffer,sizeof(buffer),format,args);
     va_end(args);
 
-	if(lexer && token)
-		printf("%s(%d): warning: %s.\n",lexer->FileName,token->LineNumber,buffer);
+	if(lexer && token && GetLocationLine(lexer,token->Location,&line,&column))
+		printf("%s(%u,%u): warning: %s.\n",lexer->FileName,line,column,buffer);
 	else if(token)
 		printf("%s: warning: %s.\n",lexer->FileName,buffer);
 	else
@@ -1199,46 +1207,43 @@ VOID AssemblerWarning(LPLEXER lexer,LPTOKEN token,LPCSTR format,...)
 VOID AssemblerError(LPLEXER lexer,LPTOKEN token,LPCSTR format,...)
 {
 	CHAR buffer[2048];
+	ULONG line;
+	ULONG column;
     
     va_list args;
     va_start(args,format);
 	_vsnprintf(buffer,sizeof(buffer),format,args);
     va_end(args);
 
-	if(lexer && token)
-		printf("%s(%d): error: %s.\n",lexer->FileName,token->LineNumber,buffer);
+	if(lexer && token && GetLocationLine(lexer,token->Location,&line,&column))
+		printf("%s(%u,%u): error: %s.\n",lexer->FileName,line,column,buffer);
 	else if(lexer)
 		printf("%s: error: %s.\n",lexer->FileName,buffer);
 	else
 		printf("error: %s.\n",lexer->FileName,buffer);
 }
 
-BOOL AddLabel(LPLABEL* head,LPCSTR name,ULONG address)
+BOOL AddLabel(LPASSEMBLER assembler,ULONG name,ULONG address)
 {
 	LPLABEL label = (LPLABEL)malloc(sizeof(LABEL));
 	if(!label)
 		return FALSE;	// Should assert
 
-	label->Name = _strdup(name);
+	label->Name = name;
 	label->Address = address;
-	label->Next = *head;
+	label->Next = assembler->Labels;
 
-	*head = label;
+	assembler->Labels = label;
+
+	// Labels are case insensitive
+	SetAtomData(&assembler->Atoms,GetAtomNoCase(&assembler->Atoms,name),label);
 
 	return TRUE;
 }
 
-LPLABEL GetLabel(LPLABEL head,LPCSTR name)
+LPLABEL GetLabel(LPASSEMBLER assembler,ULONG name)
 {
-	while(head)
-	{
-		if(EqualNoCase(head->Name,name))
-			return head;
-
-		head = head->Next;
-	}
-
-	return NULL;	// Not found
+	return (LPLABEL)GetAtomData(&assembler->Atoms,GetAtomNoCase(&assembler->Atoms,name));
 }
 
 VOID FreeLabels(LPLABEL* head)
@@ -1247,14 +1252,13 @@ VOID FreeLabels(LPLABEL* head)
 	{
 		LPLABEL next = (*head)->Next;
 
-		free((*head)->Name);
 		free(*head);
 
 		*head = next;
 	}
 }
 
-BOOL AddInstruction(LPINSTRUCTION* head,ULONG type,ULONG typeex,ULONG location,LPCONDITION condition,LPSHIFTER shift,LPOPERAND operand,ULONG parameter0,ULONG parameter1,ULONG parameter2,LPCSTR label0,LPCSTR label1,LPCSTR label2)
+BOOL AddInstruction(LPINSTRUCTION* head,ULONG type,ULONG typeex,ULONG location,LPCONDITION condition,LPSHIFTER shift,LPOPERAND operand,ULONG parameter0,ULONG parameter1,ULONG parameter2,ULONG label0,ULONG label1,ULONG label2)
 {
 	LPINSTRUCTION instruction = (LPINSTRUCTION)malloc(sizeof(INSTRUCTION));
 	if(!instruction)
@@ -1269,9 +1273,9 @@ BOOL AddInstruction(LPINSTRUCTION* head,ULONG type,ULONG typeex,ULONG location,L
 	instruction->Parameters[0] = parameter0;
 	instruction->Parameters[1] = parameter1;
 	instruction->Parameters[2] = parameter2;
-	instruction->Labels[0] = _strdup(label0);
-	instruction->Labels[1] = _strdup(label1);
-	instruction->Labels[2] = _strdup(label2);
+	instruction->Labels[0] = label0;
+	instruction->Labels[1] = label1;
+	instruction->Labels[2] = label2;
 
 	if(shift)
 		memcpy(&instruction->Shift,shift,sizeof(SHIFTER));
@@ -1292,9 +1296,6 @@ VOID FreeInstructions(LPINSTRUCTION* head)
 	{
 		LPINSTRUCTION next = (*head)->Next;
 
-		free((*head)->Labels[0]);
-		free((*head)->Labels[1]);
-		free((*head)->Labels[2]);
 		free(*head);
 
 		*head = next;
@@ -1303,32 +1304,34 @@ VOID FreeInstructions(LPINSTRUCTION* head)
 
 BOOL TokenToUnsignedLong(LPTOKEN token,PULONG value)
 {
-	if(token->Type != TOKEN_NUMBER)
+	// The lexer already decoded the value
+	if(token->Type != TOKEN_NUMBER || (token->TypeEx & NUMBER_TYPE_MASK) == NUMBER_FLOAT)
 		return FALSE;
 
-	switch(token->TypeEx & NUMBER_TYPE_MASK)	// Ignore sign
-	{
-	case NUMBER_INTEGER: *value = strtoul(token->Value.Buffer,NULL,10); return TRUE;
-	case NUMBER_HEX: *value = strtoul(token->Value.Buffer,NULL,16); return TRUE;
-	case NUMBER_OCTAL: *value = strtoul(token->Value.Buffer,NULL,8); return TRUE;
-	}
+	// Too large values saturate like strtoul, negative ones wrap around
+	if(token->Integer > 0xFFFFFFFF)
+		*value = 0xFFFFFFFF;
+	else if(token->TypeEx & NUMBER_SIGN_MASK)
+		*value = 0 - (ULONG)token->Integer;
+	else
+		*value = (ULONG)token->Integer;
 
-	return FALSE;
+	return TRUE;
 }
 
 BOOL TokenToLong(LPTOKEN token,PULONG value)
 {
-	if(token->Type != TOKEN_NUMBER)
+	// The lexer already decoded the value
+	if(token->Type != TOKEN_NUMBER || (token->TypeEx & NUMBER_TYPE_MASK) == NUMBER_FLOAT)
 		return FALSE;
 
-	switch(token->TypeEx & NUMBER_TYPE_MASK)	// Ignore sign
-	{
-	case NUMBER_INTEGER: *value = strtol(token->Value.Buffer,NULL,10); return TRUE;
-	case NUMBER_HEX: *value = strtol(token->Value.Buffer,NULL,16); return TRUE;
-	case NUMBER_OCTAL: *value = strtol(token->Value.Buffer,NULL,8); return TRUE;
-	}
+	// Too large values saturate like strtol
+	if(token->TypeEx & NUMBER_SIGN_MASK)
+		*value = token->Integer > 0x80000000 ? 0x80000000 : 0 - (ULONG)token->Integer;
+	else
+		*value = token->Integer > 0x7FFFFFFF ? 0x7FFFFFFF : (ULONG)token->Integer;
 
-	return FALSE;
+	return TRUE;
 }
 
 BOOL AssembleBinary(LPASSEMBLER assembler,LPCSTR path)
@@ -1492,10 +1495,10 @@ BOOL AssembleLabels(LPASSEMBLER assembler)
 	{
 		if(instruction->Labels[0])
 		{
-			LPLABEL label = GetLabel(assembler->Labels,instruction->Labels[0]);
+			LPLABEL label = GetLabel(assembler,instruction->Labels[0]);
 			if(!label)
 			{
-				AssemblerError(NULL,NULL,"failed to translate label %s",instruction->Labels[0]);
+				AssemblerError(NULL,NULL,"failed to translate label %s",GetAtomName(&assembler->Atoms,instruction->Labels[0]));
 				return FALSE;
 			}
 
@@ -1504,10 +1507,10 @@ BOOL AssembleLabels(LPASSEMBLER assembler)
 
 		if(instruction->Labels[1])
 		{
-			LPLABEL label = GetLabel(assembler->Labels,instruction->Labels[1]);
+			LPLABEL label = GetLabel(assembler,instruction->Labels[1]);
 			if(!label)
 			{
-				AssemblerError(NULL,NULL,"failed to translate label %s",instruction->Labels[1]);
+				AssemblerError(NULL,NULL,"failed to translate label %s",GetAtomName(&assembler->Atoms,instruction->Labels[1]));
 				return FALSE;
 			}
 
@@ -1516,10 +1519,10 @@ BOOL AssembleLabels(LPASSEMBLER assembler)
 
 		if(instruction->Labels[2])
 		{
-			LPLABEL label = GetLabel(assembler->Labels,instruction->Labels[2]);
+			LPLABEL label = GetLabel(assembler,instruction->Labels[2]);
 			if(!label)
 			{
-				AssemblerError(NULL,NULL,"failed to translate label %s",instruction->Labels[2]);
+				AssemblerError(NULL,NULL,"failed to translate label %s",GetAtomName(&assembler->Atoms,instruction->Labels[2]));
 				return FALSE;
 			}
 
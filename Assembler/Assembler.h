@@ -61,10 +61,6 @@
 // Test ex types
 #define INSTRUCTION_TEST_EQ			1
 
-#define ASMCOMMENT ";"
-#define ASMMULTILINECOMMENTBEGIN "<;"
-#define ASMMULTILINECOMMENTEND ";>"
-
 // Condition codes
 typedef struct
 {
@@ -156,6 +152,52 @@ static SHIFT ARMSHIFTS[] =
 	{NULL,0},
 };
 
+// Assembler keyword kinds, the low byte indexes the register or shift list
+#define ASMKEYWORD_KIND_MASK	0xFF00
+#define ASMKEYWORD_INDEX_MASK	0x00FF
+#define ASMKEYWORD_REGISTER		0x0100
+#define ASMKEYWORD_SHIFT		0x0200
+#define ASMKEYWORD_DIRECTIVE	0x0300
+
+#define ASMKEYWORD_EQU	(ASMKEYWORD_DIRECTIVE | 1)
+#define ASMKEYWORD_DW	(ASMKEYWORD_DIRECTIVE | 2)
+#define ASMKEYWORD_DH	(ASMKEYWORD_DIRECTIVE | 3)
+#define ASMKEYWORD_DB	(ASMKEYWORD_DIRECTIVE | 4)
+
+// Keywords the lexer tags, case insensitive
+static KEYWORD ARMKEYWORDS[] =
+{
+	{"R0",ASMKEYWORD_REGISTER | 0},
+	{"R1",ASMKEYWORD_REGISTER | 1},
+	{"R2",ASMKEYWORD_REGISTER | 2},
+	{"R3",ASMKEYWORD_REGISTER | 3},
+	{"R4",ASMKEYWORD_REGISTER | 4},
+	{"R5",ASMKEYWORD_REGISTER | 5},
+	{"R6",ASMKEYWORD_REGISTER | 6},
+	{"R7",ASMKEYWORD_REGISTER | 7},
+	{"R8",ASMKEYWORD_REGISTER | 8},
+	{"R9",ASMKEYWORD_REGISTER | 9},
+	{"R10",ASMKEYWORD_REGISTER | 10},
+	{"R11",ASMKEYWORD_REGISTER | 11},
+	{"R12",ASMKEYWORD_REGISTER | 12},
+	{"R13",ASMKEYWORD_REGISTER | 13},
+	{"SP",ASMKEYWORD_REGISTER | 14},
+	{"R14",ASMKEYWORD_REGISTER | 15},
+	{"LR",ASMKEYWORD_REGISTER | 16},
+	{"R15",ASMKEYWORD_REGISTER | 17},
+	{"PC",ASMKEYWORD_REGISTER | 18},
+	{"LSL",ASMKEYWORD_SHIFT | 0},
+	{"LSR",ASMKEYWORD_SHIFT | 1},
+	{"ASL",ASMKEYWORD_SHIFT | 2},
+	{"ASR",ASMKEYWORD_SHIFT | 3},
+	{"ROR",ASMKEYWORD_SHIFT | 4},
+	{"EQU",ASMKEYWORD_EQU},
+	{"DW",ASMKEYWORD_DW},
+	{"DH",ASMKEYWORD_DH},
+	{"DB",ASMKEYWORD_DB},
+	{NULL,KEYWORD_NONE},
+};
+
 typedef struct
 {
 	BYTE Type;
@@ -171,7 +213,7 @@ typedef struct
 
 typedef struct _LABEL
 {
-	LPSTR Name;
+	ULONG Name;		// Atom of the name as first defined
 	ULONG Address;
 
 	struct _LABEL* Next;
@@ -183,7 +225,7 @@ typedef struct _INSTRUCTION
 	ULONG TypeEx;
 	ULONG Location;
 	ULONG Parameters[3];
-	LPSTR Labels[3];
+	ULONG Labels[3];	// Atoms of the label names, zero if none
 	LPCONDITION Condition;
 	OPERAND Operand;
 	SHIFTER Shift;
@@ -196,6 +238,8 @@ typedef struct
 	ULONG Location;
 	LPLABEL Labels;
 	LPINSTRUCTION Instructions;
+
+	ATOMTABLE Atoms;	// Identifiers of all assembled files, labels hang off their case folded atoms
 } ASSEMBLER,*LPASSEMBLER;
 
 BOOL InitializeAssembler(LPASSEMBLER assembler);
@@ -205,11 +249,11 @@ BOOL AssembleFile(LPASSEMBLER assembler,LPCSTR path);
 BOOL AssembleBinary(LPASSEMBLER assembler,LPCSTR path);
 BOOL AssembleLabels(LPASSEMBLER assembler);
 
-BOOL AddLabel(LPLABEL* head,LPCSTR name,ULONG address);
-LPLABEL GetLabel(LPLABEL head,LPCSTR name);
+BOOL AddLabel(LPASSEMBLER assembler,ULONG name,ULONG address);
+LPLABEL GetLabel(LPASSEMBLER assembler,ULONG name);
 VOID FreeLabels(LPLABEL* head);
 
-BOOL AddInstruction(LPINSTRUCTION* head,ULONG type,ULONG typeex,ULONG location,LPCONDITION condition,LPSHIFTER shift,LPOPERAND operand,ULONG parameter0,ULONG parameter1,ULONG parameter2,LPCSTR label0,LPCSTR label1,LPCSTR label2);
+BOOL AddInstruction(LPINSTRUCTION* head,ULONG type,ULONG typeex,ULONG location,LPCONDITION condition,LPSHIFTER shift,LPOPERAND operand,ULONG parameter0,ULONG parameter1,ULONG parameter2,ULONG label0,ULONG label1,ULONG label2);
 VOID FreeInstructions(LPINSTRUCTION* head);
 
 BOOL TokenToLong(LPTOKEN token,PULONG value);
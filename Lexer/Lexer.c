@@ -23,11 +23,28 @@
 
 #include "Lexer.h"
 
-BOOL InitializeLexer(LPLEXER lexer,LPPUNCTUATION punctuations,LPSTR comment,LPCSTR multilineCommentBegin,LPCSTR multilineCommentEnd)
+// SSE2 is always there on x64 and when targeted on x86, AVX2 is checked at runtime
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEXER_SIMD
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef LEXER_COUNT_ALLOCATIONS
+LONG LexerAllocations = 0;
+LONGLONG LexerAllocationBytes = 0;
+#endif
+
+// Looks up the class of a character in the lexer character table
+#define CHARCLASS(lexer,chr) ((lexer)->Characters[(BYTE)(chr)])
+
+BOOL InitializeLexer(LPLEXER lexer,LPPUNCTUATION punctuations,LPKEYWORD keywords,BOOL keywordsNoCase,LPSTR comment,LPCSTR multilineCommentBegin,LPCSTR multilineCommentEnd)
 {
 	memset(lexer,0,sizeof(LEXER));
 
 	lexer->Punctuations = punctuations;
+	lexer->Keywords = keywords;
+	lexer->KeywordsNoCase = keywordsNoCase;
 	lexer->Comment[0] = comment[0];
 	lexer->Comment[1] = comment[1];
 	lexer->MultilineCommentBegin[0] = multilineCommentBegin[0];
@@ -35,63 +52,325 @@ BOOL InitializeLexer(LPLEXER lexer,LPPUNCTUATION punctuations,LPSTR comment,LPCS
 	lexer->MultilineCommentEnd[0] = multilineCommentEnd[0];
 	lexer->MultilineCommentEnd[1] = multilineCommentEnd[1];
 
+	InitializeCharacters(lexer);
+
+	lexer->Simd = DetectSimd();
+
+	if(!InitializePunctuations(lexer))
+		return FALSE;
+
+	if(!InitializeKeywords(lexer))
+		return FALSE;
+
 	return TRUE;
 }
 
-VOID UninitializeLexer(LPLEXER lexer)
+BOOL InitializeLexerProfile(LPLEXER lexer,ULONG profile,LPKEYWORD keywords,BOOL keywordsNoCase)
 {
-	UnloadFile(lexer);
+	BOOL initialized;
+
+	switch(profile)
+	{
+	case LEXER_PROFILE_CPP:
+		initialized = InitializeLexer(lexer,CPPPUNCTUATIONS,keywords,keywordsNoCase,CPPCOMMENT,CPPMULTILINECOMMENTBEGIN,CPPMULTILINECOMMENTEND);
+		break;
+
+	case LEXER_PROFILE_ASM:
+		initialized = InitializeLexer(lexer,CPPPUNCTUATIONS,keywords,keywordsNoCase,ASMCOMMENT,ASMMULTILINECOMMENTBEGIN,ASMMULTILINECOMMENTEND);
+		break;
+
+	default:
+		return FALSE;
+	}
+
+	// Set last, InitializeLexer clears the whole lexer
+	lexer->Profile = profile;
+
+	return initialized;
+}
+
+VOID InitializeCharacters(LPLEXER lexer)
+{
+	ULONG i;
+
+	for(i = 0; i < 256; ++i)
+	{
+		USHORT flags = 0;
+
+		if((i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || i == '_')
+			flags |= CHAR_IDENTIFIER_START | CHAR_IDENTIFIER;
+
+		if(i >= '0' && i <= '9')
+			flags |= CHAR_IDENTIFIER | CHAR_DIGIT | CHAR_HEX_DIGIT | CHAR_NUMBER;
+
+		if(i >= '0' && i <= '7')
+			flags |= CHAR_OCTAL_DIGIT;
+
+		if((i >= 'a' && i <= 'f') || (i >= 'A' && i <= 'F'))
+			flags |= CHAR_HEX_DIGIT;
+
+		if(i == '.' || i == '-' || i == '+')
+			flags |= CHAR_NUMBER;
+
+		// Everything up to space counts as whitespace, except the terminating zero
+		if(i && i <= ' ')
+			flags |= CHAR_WHITESPACE;
+
+		if(i == '\n')
+			flags |= CHAR_NEWLINE;
+
+		if(i == '\"' || i == '\'')
+			flags |= CHAR_QUOTE;
+
+		lexer->Characters[i] = flags;
+	}
+
+	for(i = 0; lexer->Punctuations[i].name; ++i)
+		CHARCLASS(lexer,lexer->Punctuations[i].name[0]) |= CHAR_PUNCTUATION;
+
+	if(lexer->Comment[0])
+		CHARCLASS(lexer,lexer->Comment[0]) |= CHAR_COMMENT;
+
+	if(lexer->MultilineCommentBegin[0])
+		CHARCLASS(lexer,lexer->MultilineCommentBegin[0]) |= CHAR_COMMENT;
 }
 
-BOOL StoreLexerState(LPLEXER lexer,LPLEXERSTATE state)
+BOOL InitializePunctuations(LPLEXER lexer)
 {
-	state->FileBuffer = malloc(FILE_BLOCK);
-	if(!state->FileBuffer)
+	ULONG i;
+	ULONG count = 1;
+
+	for(i = 0; lexer->Punctuations[i].name; ++i)
+	{
+		count += (ULONG)strlen(lexer->Punctuations[i].name);
+
+		if(lexer->Punctuations[i].id >= lexer->PunctuationIds)
+			lexer->PunctuationIds = lexer->Punctuations[i].id + 1;
+	}
+
+	COUNT_ALLOCATION(count * sizeof(PUNCTUATIONNODE));
+	if(!(lexer->PunctuationNodes = (LPPUNCTUATIONNODE)calloc(count,sizeof(PUNCTUATIONNODE))))
+		return FALSE;
+
+	COUNT_ALLOCATION((lexer->PunctuationIds + 1) * sizeof(LPCSTR));
+	if(!(lexer->PunctuationNames = (LPCSTR*)calloc(lexer->PunctuationIds + 1,sizeof(LPCSTR))))
+	{
+		free(lexer->PunctuationNodes);
+		lexer->PunctuationNodes = NULL;
 		return FALSE;
+	}
+
+	count = 1;
+
+	for(i = 0; lexer->Punctuations[i].name; ++i)
+	{
+		LPCSTR name = lexer->Punctuations[i].name;
+		USHORT* link = &lexer->PunctuationRoots[(BYTE)name[0]];
+		USHORT node = 0;
+		ULONG j;
+
+		for(j = 0; name[j]; ++j)
+		{
+			// Find the character among the nodes with the same prefix
+			while(*link && lexer->PunctuationNodes[*link].Character != name[j])
+				link = &lexer->PunctuationNodes[*link].Sibling;
+
+			if(!*link)
+			{
+				lexer->PunctuationNodes[count].Character = name[j];
+				*link = (USHORT)count++;
+			}
 
-	state->FilePointer = _ftelli64(lexer->File);
-	state->FileBufferLength = lexer->FileBufferLength;
-	state->FilePosition = lexer->FilePosition;
-	CopyMemory(state->FileBuffer,lexer->FileBuffer,FILE_BLOCK);
-	state->LineNumber = lexer->LineNumber;
+			node = *link;
+			link = &lexer->PunctuationNodes[node].Child;
+		}
+
+		// The first entry wins if the list has duplicates
+		if(node && !lexer->PunctuationNodes[node].Punctuation)
+			lexer->PunctuationNodes[node].Punctuation = (USHORT)(i + 1);
+
+		if(!lexer->PunctuationNames[lexer->Punctuations[i].id])
+			lexer->PunctuationNames[lexer->Punctuations[i].id] = name;
+	}
 
 	return TRUE;
 }
 
-BOOL RestoreLexerState(LPLEXER lexer,LPLEXERSTATE state)
+#define KEYWORD_EMPTY 0xFFFF	// Hash slot without a keyword while the hash is built
+
+BOOL InitializeKeywords(LPLEXER lexer)
 {
-	//if(!state->FileBuffer)	// Should do more than just check for buffer existance if we are error checking
-	//	return FALSE;
+	PULONG buckets;
+	PULONG sizes;
+	ULONG count;
+	ULONG size;
+	ULONG i;
+	ULONG j;
+
+	if(!lexer->Keywords)
+		return TRUE;
+
+	for(count = 0; lexer->Keywords[count].name; ++count);
+
+	if(!count)
+		return TRUE;
+
+	if(count >= KEYWORD_EMPTY)
+		return FALSE;
+
+	lexer->KeywordBuckets = (count + 1) / 2;
+	lexer->KeywordLengthMinimum = 0xFFFFFFFF;
+
+	COUNT_ALLOCATION(lexer->KeywordBuckets * sizeof(USHORT));
+	lexer->KeywordSeeds = (PUSHORT)calloc(lexer->KeywordBuckets,sizeof(USHORT));
+	COUNT_ALLOCATION(count * sizeof(USHORT));
+	lexer->KeywordSlots = (PUSHORT)malloc(count * sizeof(USHORT));
+	COUNT_ALLOCATION(count * sizeof(ULONG));
+	lexer->KeywordHashes = (PULONG)malloc(count * sizeof(ULONG));
+	COUNT_ALLOCATION(count * sizeof(ULONG));
+	buckets = (PULONG)malloc(count * sizeof(ULONG));
+	COUNT_ALLOCATION(lexer->KeywordBuckets * sizeof(ULONG));
+	sizes = (PULONG)calloc(lexer->KeywordBuckets,sizeof(ULONG));
+
+	if(!lexer->KeywordSeeds || !lexer->KeywordSlots || !lexer->KeywordHashes || !buckets || !sizes)
+	{
+		free(buckets);
+		free(sizes);
+		return FALSE;
+	}
+
+	memset(lexer->KeywordSlots,0xFF,count * sizeof(USHORT));
+
+	for(i = 0, size = 0; i < count; ++i)
+	{
+		ULONG length = (ULONG)strlen(lexer->Keywords[i].name);
+
+		lexer->KeywordLengthMinimum = min(lexer->KeywordLengthMinimum,length);
+		lexer->KeywordLengthMaximum = max(lexer->KeywordLengthMaximum,length);
+		lexer->KeywordHashes[i] = HashKeyword(lexer,lexer->Keywords[i].name,length);
+
+		// Keywords with the same hash can't be told apart, this includes duplicates
+		for(j = 0; j < i; ++j)
+		{
+			if(lexer->KeywordHashes[j] == lexer->KeywordHashes[i])
+			{
+				free(buckets);
+				free(sizes);
+				return FALSE;
+			}
+		}
+
+		buckets[i] = MixKeyword(lexer->KeywordHashes[i],0,lexer->KeywordBuckets);
+		size = max(size,++sizes[buckets[i]]);
+	}
+
+	// Place the largest buckets first while most slots are still free
+	for(; size; --size)
+	{
+		ULONG bucket;
+
+		for(bucket = 0; bucket < lexer->KeywordBuckets; ++bucket)
+		{
+			ULONG seed;
 
-	CopyMemory(lexer->FileBuffer,state->FileBuffer,FILE_BLOCK);
+			if(sizes[bucket] != size)
+				continue;
+
+			// Find a seed sending every keyword of the bucket to a free slot
+			for(seed = 1; seed <= 0xFFFF; ++seed)
+			{
+				for(i = 0; i < count; ++i)
+				{
+					ULONG slot = MixKeyword(lexer->KeywordHashes[i],seed,count);
+
+					if(buckets[i] != bucket)
+						continue;
+
+					if(lexer->KeywordSlots[slot] != KEYWORD_EMPTY)
+						break;
+
+					lexer->KeywordSlots[slot] = (USHORT)i;
+				}
+
+				if(i == count)
+					break;
+
+				// Take back the slots the seed filled
+				for(j = 0; j < i; ++j)
+					if(buckets[j] == bucket)
+						lexer->KeywordSlots[MixKeyword(lexer->KeywordHashes[j],seed,count)] = KEYWORD_EMPTY;
+			}
+
+			if(seed > 0xFFFF)
+			{
+				free(buckets);
+				free(sizes);
+				return FALSE;
+			}
+
+			lexer->KeywordSeeds[bucket] = (USHORT)seed;
+		}
+	}
 
-	lexer->FilePosition = state->FilePosition;
-	lexer->LineNumber = state->LineNumber;
-	lexer->FileBufferLength = state->FileBufferLength;
+	free(buckets);
+	free(sizes);
 
-	_fseeki64(lexer->File,state->FilePointer,SEEK_SET);
+	lexer->KeywordCount = count;
 
 	return TRUE;
 }
 
-VOID FreeLexerState(LPLEXERSTATE state)
+VOID UninitializeLexer(LPLEXER lexer)
+{
+	UnloadFile(lexer);
+
+	free(lexer->StreamBuffer);
+	lexer->StreamBuffer = NULL;
+	lexer->StreamBufferSize = 0;
+
+	UninitializeString(&lexer->Scratch);
+
+	free(lexer->PunctuationNodes);
+	free((LPVOID)lexer->PunctuationNames);
+	lexer->PunctuationNodes = NULL;
+	lexer->PunctuationNames = NULL;
+
+	free(lexer->KeywordSeeds);
+	free(lexer->KeywordSlots);
+	free(lexer->KeywordHashes);
+	lexer->KeywordSeeds = NULL;
+	lexer->KeywordSlots = NULL;
+	lexer->KeywordHashes = NULL;
+	lexer->KeywordCount = 0;
+}
+
+VOID CheckpointLexer(LPLEXER lexer,LPLEXERCHECKPOINT checkpoint)
+{
+	// The whole input stays in memory so the position is enough to come back to
+	checkpoint->FilePosition = lexer->FilePosition;
+
+	COUNT_STATISTIC(lexer,Checkpoints);
+}
+
+VOID RewindLexer(LPLEXER lexer,LPLEXERCHECKPOINT checkpoint)
 {
-	free(state->FileBuffer);
-	state->FileBuffer = NULL;
+	lexer->FilePosition = checkpoint->FilePosition;
+
+	COUNT_STATISTIC(lexer,Rewinds);
 }
 
 BOOL InitializeToken(LPTOKEN token)
 {
 	memset(token,0,sizeof(TOKEN));
 
-	InitializeString(&token->Value);
-
 	return TRUE;
 }
 
 VOID UninitializeToken(LPTOKEN token)
 {
-	UninitializeString(&token->Value);
+	// Values are owned by the lexer
+	token->Value = NULL;
+	token->Length = 0;
 }
 
 BOOL ResetToken(LPTOKEN token)
@@ -111,1038 +390,3183 @@ VOID UninitializeString(LPSTRING string)
 {
 	free(string->Buffer);
 	string->Buffer = NULL;
+
+	string->Length = 0;
+	string->Block = 0;
 }
 
 BOOL LoadFile(LPLEXER lexer,LPCSTR path)
 {
-	lexer->File = fopen(path,"r");
-	if(!lexer->File)
-		return FALSE;
+	LARGE_INTEGER size;
 
-	lexer->FileBuffer = malloc(FILE_BLOCK);
-	if(!lexer->FileBuffer)
+	lexer->File = CreateFileA(path,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+	if(lexer->File == INVALID_HANDLE_VALUE)
 	{
-		fclose(lexer->File);
+		lexer->File = NULL;
 		return FALSE;
 	}
 
-	// Do the inital buffer fill
-	//lexer->FileBufferLength = (ULONG)fread(lexer->FileBuffer,1,FILE_BLOCK - 1,lexer->File);
-	lexer->FileBufferLength = 0;	// Let the first Peek/Get operation cause a buffer refill
+	// Pipes and devices have no size, they are read up to their end
+	if(GetFileType(lexer->File) != FILE_TYPE_DISK)
+	{
+		if(!ReadStream(lexer,lexer->File))
+		{
+			CloseHandle(lexer->File);
+			lexer->File = NULL;
+			return FALSE;
+		}
+	}
+	else
+	{
+		// Positions are kept in 32 bits
+		if(!GetFileSizeEx(lexer->File,&size) || size.QuadPart > 0xFFFFFFFF - FILE_PADDING)
+		{
+			CloseHandle(lexer->File);
+			lexer->File = NULL;
+			return FALSE;
+		}
 
-	lexer->FileBuffer[lexer->FileBufferLength] = 0;
+		// Map the file if possible, otherwise read all of it at once
+		if(!MapFile(lexer,size.LowPart) && !ReadWholeFile(lexer,size.LowPart))
+		{
+			CloseHandle(lexer->File);
+			lexer->File = NULL;
+			return FALSE;
+		}
+	}
 
 	lexer->FileName = _strdup(path);
 	lexer->FilePosition = 0;
-	lexer->LineNumber = 1;
+
+	COUNT_STATISTIC(lexer,Loads);
 
 	return TRUE;
 }
 
-VOID UnloadFile(LPLEXER lexer)
+BOOL LoadBuffer(LPLEXER lexer,LPCSTR buffer,ULONG length,BOOL padded,LPCSTR name)
 {
-	fclose(lexer->File);
+	if(length > 0xFFFFFFFF - FILE_PADDING)
+		return FALSE;
 
-	free(lexer->FileName);
-	lexer->FileName = NULL;
+	// The buffer is used in place when the caller owns FILE_PADDING zeros after it, otherwise it is copied
+	if(padded)
+	{
+		lexer->FileBuffer = buffer;
+		lexer->FileBufferLength = length;
+		lexer->FileInput = INPUT_BUFFER;
+	}
+	else
+	{
+		LPSTR copy;
 
-	free(lexer->FileBuffer);
-	lexer->FileBuffer = NULL;
+		COUNT_ALLOCATION(length + FILE_PADDING);
+		copy = (LPSTR)malloc(length + FILE_PADDING);
+		if(!copy)
+			return FALSE;
+
+		memcpy(copy,buffer,length);
+		memset(copy + length,0,FILE_PADDING);
+
+		lexer->FileBuffer = copy;
+		lexer->FileBufferLength = length;
+		lexer->FileInput = INPUT_HEAP;
+	}
 
+	lexer->FileName = _strdup(name ? name : "(buffer)");
 	lexer->FilePosition = 0;
-	lexer->FileBufferLength = 0;
+
+	COUNT_STATISTIC(lexer,Loads);
+
+	return TRUE;
 }
 
-ULONG GetCharEx(LPLEXER lexer,ULONG offset)
+BOOL LoadStream(LPLEXER lexer,HANDLE stream,LPCSTR name)
 {
-	if(lexer->FilePosition + offset >= lexer->FileBufferLength)
-	{
-		if(feof(lexer->File))
-		{
-			lexer->FilePosition = lexer->FileBufferLength;
-			return EOF;
-		}
+	if(!ReadStream(lexer,stream))
+		return FALSE;
 
-		offset -= lexer->FileBufferLength - lexer->FilePosition;
+	lexer->FileName = _strdup(name ? name : "(stream)");
+	lexer->FilePosition = 0;
 
-		lexer->FileBufferLength = (ULONG)fread(lexer->FileBuffer,1,FILE_BLOCK - 1,lexer->File);
-		lexer->FileBuffer[lexer->FileBufferLength] = 0;
-		lexer->FilePosition = 0;
+	COUNT_STATISTIC(lexer,Loads);
 
-#ifdef _DEBUG
-		OutputDebugStringA(__FUNCTION__": Refiling buffer.\n");
-#endif
+	return TRUE;
+}
 
-		if(lexer->FilePosition + offset >= lexer->FileBufferLength)
-		{
-			lexer->FilePosition = lexer->FileBufferLength;
-			return EOF;
-		}
-	}
+BOOL MapFile(LPLEXER lexer,ULONG size)
+{
+	SYSTEM_INFO info;
 
-	lexer->FilePosition += offset;
+	GetSystemInfo(&info);
 
-	return lexer->FileBuffer[lexer->FilePosition++];
-}
+	// The view is only usable if the zero filled tail of its last page can serve as the padding
+	if(!size || !(size % info.dwPageSize) || info.dwPageSize - size % info.dwPageSize < FILE_PADDING)
+		return FALSE;
 
-ULONG GetChar(LPLEXER lexer)
-{
-	return GetCharEx(lexer,0);
-}
+	lexer->FileMapping = CreateFileMappingA(lexer->File,NULL,PAGE_READONLY,0,0,NULL);
+	if(!lexer->FileMapping)
+		return FALSE;
 
-ULONG GetCharFar(LPLEXER lexer)
-{
-	return GetCharEx(lexer,1);
+	lexer->FileBuffer = (LPCSTR)MapViewOfFile(lexer->FileMapping,FILE_MAP_READ,0,0,0);
+	if(!lexer->FileBuffer)
+	{
+		CloseHandle(lexer->FileMapping);
+		lexer->FileMapping = NULL;
+		return FALSE;
+	}
+
+	lexer->FileBufferLength = size;
+	lexer->FileInput = INPUT_MAPPED;
+
+	return TRUE;
 }
 
-ULONG PeekCharEx(LPLEXER lexer,ULONG offset)
+BOOL ReadWholeFile(LPLEXER lexer,ULONG size)
 {
-	if(lexer->FilePosition + offset >= lexer->FileBufferLength)
-	{
-		ULONG salvaged;
+	LPSTR buffer;
+	ULONG length;
 
-		if(feof(lexer->File))
-			return EOF;
+	COUNT_ALLOCATION(size + FILE_PADDING);
+	buffer = (LPSTR)malloc(size + FILE_PADDING);
+	if(!buffer)
+		return FALSE;
 
-		salvaged = lexer->FileBufferLength - lexer->FilePosition;
+	for(length = 0; length < size; )
+	{
+		DWORD read;
 
-		MoveMemory(lexer->FileBuffer,lexer->FileBuffer + lexer->FilePosition,salvaged);
+		if(!ReadFile(lexer->File,buffer + length,size - length,&read,NULL))
+		{
+			free(buffer);
+			return FALSE;
+		}
 
-		lexer->FileBufferLength = salvaged + (ULONG)fread(lexer->FileBuffer + salvaged,1,FILE_BLOCK - 1 - salvaged,lexer->File);
-		lexer->FileBuffer[lexer->FileBufferLength] = 0;
-		lexer->FilePosition = 0;
+		// File got shorter since we asked for the size
+		if(!read)
+			break;
 
-#ifdef _DEBUG
-		OutputDebugStringA(__FUNCTION__": Refiling buffer.\n");
-#endif
+		length += read;
 	}
 
-	// TODO Check if removing this line would cause problems
-	if(!lexer->FileBuffer[lexer->FilePosition + offset])
-		return EOF;
+	memset(buffer + length,0,FILE_PADDING);
 
-	return lexer->FileBuffer[lexer->FilePosition + offset];
-}
+	lexer->FileBuffer = buffer;
+	lexer->FileBufferLength = length;
+	lexer->FileInput = INPUT_HEAP;
 
-ULONG PeekChar(LPLEXER lexer)
-{
-	return PeekCharEx(lexer,0);
+	return TRUE;
 }
 
-ULONG PeekCharFar(LPLEXER lexer)
+BOOL ReadStream(LPLEXER lexer,HANDLE stream)
 {
-	return PeekCharEx(lexer,1);
-}
+	ULONG length = 0;
 
-ULONG ReadWhitespace(LPLEXER lexer)
-{
 	while(1)
 	{
-		// Whitespace chars
-		while(PeekChar(lexer) <= ' ')
-		{
-			if(PeekChar(lexer) == '\n')
-				++lexer->LineNumber;
-
-			GetChar(lexer);
-		}
+		DWORD read;
 
-		if(PeekChar(lexer) == EOF)
-			return ERROR_EOF;
-
-		// Single-line Comments
-		if(lexer->Comment[0] && PeekChar(lexer) == lexer->Comment[0] && (!lexer->Comment[1] || PeekCharFar(lexer) == lexer->Comment[1]))
+		// Grow by doubling so every read can ask for a large block, positions are kept in 32 bits
+		if((ULONGLONG)length + STREAM_BLOCK + FILE_PADDING > lexer->StreamBufferSize && lexer->StreamBufferSize < 0xFFFFFFFF)
 		{
-			if(!lexer->Comment[1])
-				GetChar(lexer);
-			else
-				GetCharFar(lexer);
+			ULONGLONG size = max((ULONGLONG)lexer->StreamBufferSize * 2,(ULONGLONG)length + STREAM_BLOCK + FILE_PADDING);
+			LPSTR buffer;
 
-			while(PeekChar(lexer) != '\n')
-			{
-				if(PeekChar(lexer) == EOF)
-					return ERROR_EOF;
+			size = min(size,0xFFFFFFFF);
 
-				GetChar(lexer);
-			}
+			COUNT_ALLOCATION(size);
+			buffer = (LPSTR)realloc(lexer->StreamBuffer,(size_t)size);
+			if(!buffer)
+				return FALSE;
 
-			continue;
+			lexer->StreamBuffer = buffer;
+			lexer->StreamBufferSize = (ULONG)size;
 		}
-		// Multi-line Comments
-		else if(lexer->MultilineCommentBegin[0] && PeekChar(lexer) == lexer->MultilineCommentBegin[0] && (!lexer->MultilineCommentBegin[1] || PeekCharFar(lexer) == lexer->MultilineCommentBegin[1]))
-		{
-			if(!lexer->MultilineCommentBegin[1])
-				GetChar(lexer);
-			else
-				GetCharFar(lexer);
-
-			while(1)
-			{
-				if(PeekChar(lexer) == EOF)
-					return ERROR_EOF;
-				else if(PeekChar(lexer) == '\n')
-					lexer->LineNumber++;
-				else if(PeekChar(lexer) == lexer->MultilineCommentBegin[0] && (!lexer->MultilineCommentBegin[1] || PeekCharFar(lexer) == lexer->MultilineCommentBegin[1]))
-					LexerWarning(lexer,"nested comment");
-				else if(PeekChar(lexer) == lexer->MultilineCommentEnd[0] && (!lexer->MultilineCommentEnd[1] || PeekCharFar(lexer) == lexer->MultilineCommentEnd[1]))
-				{
-					if(!lexer->MultilineCommentEnd[1])
-						GetChar(lexer);
-					else
-						GetCharFar(lexer);
 
-					break;
-				}
+		if(length + FILE_PADDING >= lexer->StreamBufferSize)
+			return FALSE;
 
-				GetChar(lexer);
-			}
+		// A pipe whose writer went away is at its end
+		if(!ReadFile(stream,lexer->StreamBuffer + length,lexer->StreamBufferSize - length - FILE_PADDING,&read,NULL))
+		{
+			if(GetLastError() == ERROR_BROKEN_PIPE)
+				break;
 
-			continue;
+			return FALSE;
 		}
 
-		break;
+		if(!read)
+			break;
+
+		length += read;
 	}
 
-	return ERROR_NONE;
+	memset(lexer->StreamBuffer + length,0,FILE_PADDING);
+
+	lexer->FileBuffer = lexer->StreamBuffer;
+	lexer->FileBufferLength = length;
+	lexer->FileInput = INPUT_STREAM;
+
+	return TRUE;
 }
 
-ULONG ReadEscapeSequence(LPLEXER lexer,PCHAR escape)
+VOID UnloadFile(LPLEXER lexer)
 {
-	ULONG i;
-	ULONG total;
-	ULONG current;
+	ReleaseInput(lexer->FileBuffer,lexer->FileInput,lexer->FileMapping);
 
-	// Skip the '\\'
-	GetChar(lexer);
+	if(lexer->File)
+		CloseHandle(lexer->File);
 
-	if(PeekChar(lexer) == EOF)
+	FreeStrings(lexer);
+
+	free(lexer->FileName);
+	lexer->FileName = NULL;
+
+	lexer->File = NULL;
+	lexer->FileMapping = NULL;
+	lexer->FileBuffer = NULL;
+	lexer->FileInput = INPUT_NONE;
+
+	lexer->FilePosition = 0;
+	lexer->FileBufferLength = 0;
+
+	free(lexer->Lines);
+	lexer->Lines = NULL;
+	lexer->LineCount = 0;
+}
+
+VOID ReleaseInput(LPCSTR buffer,ULONG input,HANDLE mapping)
+{
+	switch(input)
 	{
-		LexerError(lexer,"escape sequence not complete");
-		return ERROR_EOF;
+	case INPUT_MAPPED:
+		UnmapViewOfFile(buffer);
+		CloseHandle(mapping);
+		break;
+
+	case INPUT_HEAP:
+		free((LPVOID)buffer);
+		break;
+
+	case INPUT_BUFFER:
+	case INPUT_STREAM:
+		// Caller buffers stay with the caller, the stream buffer is kept for the next stream
+		break;
 	}
+}
 
-	switch(PeekChar(lexer))
+VOID SetFileBase(LPLEXER lexer,ULONG base)
+{
+	lexer->FileBase = base;
+}
+
+ULONG GetLexerLocation(LPLEXER lexer)
+{
+	return lexer->FileBase + lexer->FilePosition;
+}
+
+BOOL BuildLineTable(LPLEXER lexer)
+{
+	LPCSTR chars = lexer->FileBuffer;
+	LPCSTR end = lexer->FileBuffer + lexer->FileBufferLength;
+	ULONG count = 1;
+	ULONG stop;
+	ULONG size;
+
+	// Count the line breaks a block at a time so the table is allocated once, zero characters only add room to spare
+	while(chars < end && (size = ScanBlock(lexer,chars,SCAN_LINE,&stop)))
 	{
-		case '\\':
-			GetChar(lexer);
-			escape[0] = '\\';
-			break;
+		count += CountBits(stop);
+		chars += size;
+	}
 
-		case 'n':
-			GetChar(lexer);
-			escape[0] = '\n';
-			break;
+	for(; chars < end; ++chars)
+		if(chars[0] == '\n')
+			++count;
 
-		case 'r':
-			GetChar(lexer);
-			escape[0] = '\r';
-			break;
+	COUNT_ALLOCATION(count * sizeof(ULONG));
+	lexer->Lines = (PULONG)malloc(count * sizeof(ULONG));
+	if(!lexer->Lines)
+		return FALSE;
 
-		case 't':
-			GetChar(lexer);
-			escape[0] = '\t';
+	lexer->Lines[0] = 0;
+	lexer->LineCount = 1;
+
+	// Lexing stops at the first zero character, so does the table
+	chars = lexer->FileBuffer;
+
+	while(1)
+	{
+		chars = ScanChars(lexer,chars,SCAN_LINE);
+
+		if(!chars[0])
 			break;
 
-		case 'v':
-			GetChar(lexer);
-			escape[0] = '\v';
+		lexer->Lines[lexer->LineCount++] = (ULONG)(++chars - lexer->FileBuffer);
+	}
+
+	return TRUE;
+}
+
+BOOL GetLocationLine(LPLEXER lexer,ULONG location,PULONG line,PULONG column)
+{
+	ULONG offset = location - lexer->FileBase;
+	ULONG low = 0;
+	ULONG high;
+
+	if(!lexer->FileBuffer || location < lexer->FileBase || offset > lexer->FileBufferLength)
+		return FALSE;
+
+	if(!lexer->Lines && !BuildLineTable(lexer))
+		return FALSE;
+
+	// Find the last line starting at or before the offset
+	high = lexer->LineCount;
+
+	while(high - low > 1)
+	{
+		ULONG middle = (low + high) / 2;
+
+		if(lexer->Lines[middle] <= offset)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	*line = low + 1;
+	*column = offset - lexer->Lines[low] + 1;
+
+	return TRUE;
+}
+
+BOOL IsLineStartAt(LPLEXER lexer,ULONG offset)
+{
+	LPCSTR buffer = lexer->FileBuffer;
+
+	// Only blanks may come before the offset on its line
+	while(offset && (buffer[offset - 1] == ' ' || buffer[offset - 1] == '\t' || buffer[offset - 1] == '\r' || buffer[offset - 1] == '\f' || buffer[offset - 1] == '\v'))
+		--offset;
+
+	if(!offset)
+		return TRUE;
+
+	if(buffer[offset - 1] != '\n')
+		return FALSE;
+
+	// A line ending in a backslash goes on in the next one
+	if(--offset && buffer[offset - 1] == '\r')
+		--offset;
+
+	return !offset || buffer[offset - 1] != '\\';
+}
+
+BOOL IsSpaceBefore(LPLEXER lexer,ULONG offset)
+{
+	LPCSTR buffer = lexer->FileBuffer;
+
+	if(!offset)
+		return FALSE;
+
+	if(CHARCLASS(lexer,buffer[offset - 1]) & CHAR_WHITESPACE)
+		return TRUE;
+
+	// Line comments end with a line break, the others with their end marker
+	return offset > 1 && buffer[offset - 2] == lexer->MultilineCommentEnd[0] && buffer[offset - 1] == lexer->MultilineCommentEnd[1];
+}
+
+// The input is always zero terminated so none of the character functions need to check the length
+ULONG GetCharEx(LPLEXER lexer,ULONG offset)
+{
+	ULONG chr = lexer->FileBuffer[lexer->FilePosition + offset];
+
+	if(!chr)
+		return EOF;
+
+	lexer->FilePosition += offset + 1;
+
+	return chr;
+}
+
+ULONG GetChar(LPLEXER lexer)
+{
+	return GetCharEx(lexer,0);
+}
+
+ULONG GetCharFar(LPLEXER lexer)
+{
+	return GetCharEx(lexer,1);
+}
+
+ULONG PeekCharEx(LPLEXER lexer,ULONG offset)
+{
+	ULONG chr = lexer->FileBuffer[lexer->FilePosition + offset];
+
+	if(!chr)
+		return EOF;
+
+	return chr;
+}
+
+ULONG PeekChar(LPLEXER lexer)
+{
+	return PeekCharEx(lexer,0);
+}
+
+ULONG PeekCharFar(LPLEXER lexer)
+{
+	return PeekCharEx(lexer,1);
+}
+
+ULONG DetectSimd(VOID)
+{
+#ifdef LEXER_SIMD
+	int info[4];
+
+	__cpuid(info,0);
+
+	if(info[0] >= 7)
+	{
+		__cpuid(info,1);
+
+		// The OS has to save the AVX registers too
+		if((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6)
+		{
+			__cpuidex(info,7,0);
+
+			if(info[1] & (1 << 5))
+				return SIMD_AVX2;
+		}
+	}
+
+	return SIMD_SSE2;
+#else
+	return SIMD_NONE;
+#endif
+}
+
+ULONG CountBits(ULONG bits)
+{
+	bits = bits - ((bits >> 1) & 0x55555555);
+	bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+	bits = (bits + (bits >> 4)) & 0x0F0F0F0F;
+
+	return (bits * 0x01010101) >> 24;
+}
+
+__forceinline ULONG ScanBlock(LPLEXER lexer,LPCSTR chars,ULONG scan,PULONG stop)
+{
+#ifdef LEXER_SIMD
+	// The terminating zero stops every scan and is followed by enough padding for a whole load
+	if(lexer->Simd == SIMD_AVX2)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)chars);
+		__m256i zero = _mm256_setzero_si256();
+		__m256i newline = _mm256_cmpeq_epi8(block,_mm256_set1_epi8('\n'));
+
+		switch(scan)
+		{
+		case SCAN_WHITESPACE:
+			// Whitespace is everything from one up to space
+			*stop = ~(ULONG)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(block,zero),_mm256_cmpgt_epi8(_mm256_set1_epi8(' ' + 1),block)));
 			break;
 
-		case 'b':
-			GetChar(lexer);
-			escape[0] = '\b';
+		case SCAN_LINE:
+			*stop = (ULONG)_mm256_movemask_epi8(_mm256_or_si256(newline,_mm256_cmpeq_epi8(block,zero)));
 			break;
 
-		case 'f':
-			GetChar(lexer);
-			escape[0] = '\f';
+		case SCAN_STRING:
+		case SCAN_LITERAL:
+			*stop = (ULONG)_mm256_movemask_epi8(_mm256_or_si256(newline,_mm256_or_si256(_mm256_cmpeq_epi8(block,zero),_mm256_or_si256(_mm256_cmpeq_epi8(block,_mm256_set1_epi8('\\')),_mm256_cmpeq_epi8(block,_mm256_set1_epi8(scan == SCAN_STRING ? '\"' : '\''))))));
 			break;
 
-		case 'a':
-			GetChar(lexer);
-			escape[0] = '\a';
+		case SCAN_DIRECTIVE:
+		case SCAN_LOGICALLINE:
+		{
+			// Quotes and comments may hide what is looked for
+			__m256i quotes = _mm256_or_si256(_mm256_cmpeq_epi8(block,_mm256_set1_epi8('\"')),_mm256_cmpeq_epi8(block,_mm256_set1_epi8('\'')));
+			__m256i comments = _mm256_or_si256(_mm256_cmpeq_epi8(block,_mm256_set1_epi8(lexer->Comment[0])),_mm256_cmpeq_epi8(block,_mm256_set1_epi8(lexer->MultilineCommentBegin[0])));
+			__m256i target = scan == SCAN_DIRECTIVE ? _mm256_cmpeq_epi8(block,_mm256_set1_epi8('#')) : newline;
+
+			*stop = (ULONG)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(target,_mm256_cmpeq_epi8(block,zero)),_mm256_or_si256(quotes,comments)));
 			break;
+		}
+		}
 
-		case '\'':
-			GetChar(lexer);
-			escape[0] = '\'';
+		return 32;
+	}
+	else if(lexer->Simd == SIMD_SSE2)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)chars);
+		__m128i zero = _mm_setzero_si128();
+		__m128i newline = _mm_cmpeq_epi8(block,_mm_set1_epi8('\n'));
+
+		switch(scan)
+		{
+		case SCAN_WHITESPACE:
+			*stop = ~(ULONG)_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(block,zero),_mm_cmplt_epi8(block,_mm_set1_epi8(' ' + 1)))) & 0xFFFF;
 			break;
 
-		case '\"':
-			GetChar(lexer);
-			escape[0] = '\"';
+		case SCAN_LINE:
+			*stop = (ULONG)_mm_movemask_epi8(_mm_or_si128(newline,_mm_cmpeq_epi8(block,zero)));
 			break;
 
-		case '\?':
-			GetChar(lexer);
-			escape[0] = '\?';
+		case SCAN_STRING:
+		case SCAN_LITERAL:
+			*stop = (ULONG)_mm_movemask_epi8(_mm_or_si128(newline,_mm_or_si128(_mm_cmpeq_epi8(block,zero),_mm_or_si128(_mm_cmpeq_epi8(block,_mm_set1_epi8('\\')),_mm_cmpeq_epi8(block,_mm_set1_epi8(scan == SCAN_STRING ? '\"' : '\''))))));
 			break;
 
-		case 'x':	// Hex
+		case SCAN_DIRECTIVE:
+		case SCAN_LOGICALLINE:
 		{
-			// Skip the inital
-			GetChar(lexer);
+			__m128i quotes = _mm_or_si128(_mm_cmpeq_epi8(block,_mm_set1_epi8('\"')),_mm_cmpeq_epi8(block,_mm_set1_epi8('\'')));
+			__m128i comments = _mm_or_si128(_mm_cmpeq_epi8(block,_mm_set1_epi8(lexer->Comment[0])),_mm_cmpeq_epi8(block,_mm_set1_epi8(lexer->MultilineCommentBegin[0])));
+			__m128i target = scan == SCAN_DIRECTIVE ? _mm_cmpeq_epi8(block,_mm_set1_epi8('#')) : newline;
 
-			for(i = 0, total = 0; ; ++i, GetChar(lexer))
-			{
-				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
-					current = PeekChar(lexer) - '0';
-				else if(PeekChar(lexer) >= 'A' && PeekChar(lexer) <= 'F')
-					current = PeekChar(lexer) - 'A' + 10;
-				else if(PeekChar(lexer) >= 'a' && PeekChar(lexer) <= 'f')
-					current = PeekChar(lexer) - 'a' + 10;
-				else
-					break;
+			*stop = (ULONG)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(target,_mm_cmpeq_epi8(block,zero)),_mm_or_si128(quotes,comments)));
+			break;
+		}
+		}
 
-				total = (total << 4) + current;
-			}
+		return 16;
+	}
+#endif
 
-			if(total > 0xFF)
+	return 0;
+}
+
+__forceinline LPCSTR ScanComment(LPLEXER lexer,LPCSTR chars,CHAR begin,CHAR end)
+{
+#ifdef LEXER_SIMD
+	ULONG index;
+
+	// The terminating zero stops the scan and is followed by enough padding for a whole load
+	if(lexer->Simd == SIMD_AVX2)
+	{
+		__m256i zero = _mm256_setzero_si256();
+		__m256i begins = _mm256_set1_epi8(begin);
+		__m256i ends = _mm256_set1_epi8(end);
+
+		while(1)
+		{
+			__m256i block = _mm256_loadu_si256((const __m256i*)chars);
+			ULONG stop = (ULONG)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block,zero),_mm256_or_si256(_mm256_cmpeq_epi8(block,begins),_mm256_cmpeq_epi8(block,ends))));
+
+			if(stop)
 			{
-				LexerWarning(lexer,"too large value in escape character");
-				total = 0xFF;
+				_BitScanForward(&index,stop);
+
+				return chars + index;
 			}
 
-			escape[0] = (CHAR)total;
-			break;
+			chars += 32;
 		}
-		case '0':	// Octal or null char
+	}
+	else if(lexer->Simd == SIMD_SSE2)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i begins = _mm_set1_epi8(begin);
+		__m128i ends = _mm_set1_epi8(end);
+
+		while(1)
 		{
-			// Skip the inital
-			GetChar(lexer);
+			__m128i block = _mm_loadu_si128((const __m128i*)chars);
+			ULONG stop = (ULONG)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block,zero),_mm_or_si128(_mm_cmpeq_epi8(block,begins),_mm_cmpeq_epi8(block,ends))));
 
-			// Check for null char
-			if(PeekChar(lexer) < '0' && PeekChar(lexer) > '9')
+			if(stop)
 			{
-				GetChar(lexer);
-				escape[0] = '\0';
-				break;
+				_BitScanForward(&index,stop);
+
+				return chars + index;
 			}
 
-			for(i = 0, total = 0; ; ++i, GetChar(lexer))
-			{
-				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '7')
-					current = PeekChar(lexer) - '0';
-				else
-				{
-					if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9' && i < 3)
-						LexerWarning(lexer,"decimal digit terminates octal escape sequence");	
+			chars += 16;
+		}
+	}
+#endif
 
-					break;
-				}
+	while(chars[0] && chars[0] != begin && chars[0] != end)
+		++chars;
 
-				total = (total << 3) + current;
-			}
+	return chars;
+}
 
-			if(total > 0xFF)
-			{
-				LexerWarning(lexer,"too large value in escape character");
-				total = 0xFF;
-			}
+LPCSTR ScanChars(LPLEXER lexer,LPCSTR chars,ULONG scan)
+{
+	ULONG stop;
+	ULONG size;
 
-			escape[0] = (CHAR)total;
-			break;
-		}
-		default:
+	// Comments have a loop of their own so profiles can pass their markers as constants
+	if(scan == SCAN_COMMENT)
+		return ScanComment(lexer,chars,lexer->MultilineCommentBegin[0],lexer->MultilineCommentEnd[0]);
+
+	// Most tokens are separated by a single space or nothing at all
+	if(scan == SCAN_WHITESPACE)
+	{
+		if(chars[0] == ' ')
+			++chars;
+
+		if(!(CHARCLASS(lexer,chars[0]) & CHAR_WHITESPACE))
+			return chars;
+	}
+
+	// Whole blocks at a time
+	while(size = ScanBlock(lexer,chars,scan,&stop))
+	{
+		if(stop)
 		{
-			if(PeekChar(lexer) < '0' && PeekChar(lexer) > '9')
+			ULONG index;
+
+			_BitScanForward(&index,stop);
+
+			return chars + index;
+		}
+
+		chars += size;
+	}
+
+	// One character at a time
+	switch(scan)
+	{
+	case SCAN_WHITESPACE:
+		while(CHARCLASS(lexer,chars[0]) & CHAR_WHITESPACE)
+			++chars;
+		break;
+
+	case SCAN_LINE:
+		while(chars[0] && chars[0] != '\n')
+			++chars;
+		break;
+
+	case SCAN_STRING:
+	case SCAN_LITERAL:
+		while(chars[0] && chars[0] != '\\' && chars[0] != '\n' && chars[0] != (scan == SCAN_STRING ? '\"' : '\''))
+			++chars;
+		break;
+
+	case SCAN_DIRECTIVE:
+	case SCAN_LOGICALLINE:
+		while(chars[0] && chars[0] != (scan == SCAN_DIRECTIVE ? '#' : '\n') && !(CHARCLASS(lexer,chars[0]) & (CHAR_QUOTE | CHAR_COMMENT)))
+			++chars;
+		break;
+	}
+
+	return chars;
+}
+
+__forceinline ULONG ReadWhitespaceEx(LPLEXER lexer,LPCSTR comment,LPCSTR multilineCommentBegin,LPCSTR multilineCommentEnd)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+	ULONG error = ERROR_NONE;
+
+	while(1)
+	{
+		// Whitespace chars
+		chars = ScanChars(lexer,chars,SCAN_WHITESPACE);
+
+		if(!chars[0])
+		{
+			error = ERROR_EOF;
+			break;
+		}
+
+		if(!(CHARCLASS(lexer,chars[0]) & CHAR_COMMENT))
+			break;
+
+		// Single-line Comments
+		if(comment[0] && chars[0] == comment[0] && (!comment[1] || chars[1] == comment[1]))
+		{
+			chars = ScanChars(lexer,chars + (comment[1] ? 2 : 1),SCAN_LINE);
+
+			if(!chars[0])
 			{
-				LexerError(lexer,"unknown escape sequence");
+				error = ERROR_EOF;
 				break;
 			}
-			
-			// Decimal
-			
+
+			continue;
+		}
+		// Multi-line Comments
+		else if(multilineCommentBegin[0] && chars[0] == multilineCommentBegin[0] && (!multilineCommentBegin[1] || chars[1] == multilineCommentBegin[1]))
+		{
+			chars += multilineCommentBegin[1] ? 2 : 1;
+
+			while(1)
+			{
+				// Skip to the next character that could begin or end a comment
+				chars = ScanComment(lexer,chars,multilineCommentBegin[0],multilineCommentEnd[0]);
+
+				if(!chars[0])
+				{
+					error = ERROR_EOF;
+					break;
+				}
+				else if(chars[0] == multilineCommentBegin[0] && (!multilineCommentBegin[1] || chars[1] == multilineCommentBegin[1]))
+				{
+					lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+					LexerWarning(lexer,"nested comment");
+				}
+				else if(chars[0] == multilineCommentEnd[0] && (!multilineCommentEnd[1] || chars[1] == multilineCommentEnd[1]))
+				{
+					chars += multilineCommentEnd[1] ? 2 : 1;
+					break;
+				}
+
+				++chars;
+			}
+
+			if(error)
+				break;
+
+			continue;
+		}
+
+		break;
+	}
+
+	lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+
+	return error;
+}
+
+ULONG ReadWhitespace(LPLEXER lexer)
+{
+	ULONG error;
+#ifdef LEXER_STATISTICS
+	ULONGLONG ticks = GetLexerTicks();
+	ULONG position = lexer->FilePosition;
+#endif
+
+	// Profiles get a scanner with their comment markers as constants
+	switch(lexer->Profile)
+	{
+	case LEXER_PROFILE_CPP:
+		error = ReadWhitespaceEx(lexer,CPPCOMMENT,CPPMULTILINECOMMENTBEGIN,CPPMULTILINECOMMENTEND);
+		break;
+
+	case LEXER_PROFILE_ASM:
+		error = ReadWhitespaceEx(lexer,ASMCOMMENT,ASMMULTILINECOMMENTBEGIN,ASMMULTILINECOMMENTEND);
+		break;
+
+	default:
+		error = ReadWhitespaceEx(lexer,lexer->Comment,lexer->MultilineCommentBegin,lexer->MultilineCommentEnd);
+		break;
+	}
+
+#ifdef LEXER_STATISTICS
+	lexer->Statistics.Bytes += lexer->FilePosition - position;
+	lexer->Statistics.WhitespaceTicks += GetLexerTicks() - ticks;
+#endif
+
+	return error;
+}
+
+// Skip mode moves over the input without building tokens, decoding anything or reporting diagnostics
+ULONG SkipToDirective(LPLEXER lexer)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+
+	while(1)
+	{
+		chars = ScanChars(lexer,chars,SCAN_DIRECTIVE);
+
+		if(!chars[0])
+		{
+			lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+			return ERROR_EOF;
+		}
+
+		// Only a number sign starting a line begins a directive
+		if(chars[0] == '#')
+		{
+			if(IsLineStartAt(lexer,(ULONG)(chars - lexer->FileBuffer)))
+			{
+				lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+				return ERROR_NONE;
+			}
+
+			++chars;
+			continue;
+		}
+
+		chars = SkipSpan(lexer,chars);
+	}
+}
+
+ULONG SkipToLineEnd(LPLEXER lexer)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+
+	while(1)
+	{
+		chars = ScanChars(lexer,chars,SCAN_LOGICALLINE);
+
+		if(!chars[0])
+		{
+			lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+			return ERROR_EOF;
+		}
+
+		// Line breaks after a backslash do not end the line, neither do the ones in multi-line comments
+		if(chars[0] == '\n')
+		{
+			++chars;
+
+			if(IsLineStartAt(lexer,(ULONG)(chars - lexer->FileBuffer)))
+			{
+				lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+				return ERROR_NONE;
+			}
+
+			continue;
+		}
+
+		chars = SkipSpan(lexer,chars);
+	}
+}
+
+LPCSTR SkipSpan(LPLEXER lexer,LPCSTR chars)
+{
+	LPCSTR comment = lexer->Comment;
+	LPCSTR begin = lexer->MultilineCommentBegin;
+	LPCSTR end = lexer->MultilineCommentEnd;
+	CHAR quote = chars[0];
+
+	// Single-line comments, the line break is left for the caller
+	if(comment[0] && chars[0] == comment[0] && (!comment[1] || chars[1] == comment[1]))
+		return ScanChars(lexer,chars + (comment[1] ? 2 : 1),SCAN_LINE);
+
+	// Multi-line comments
+	if(begin[0] && chars[0] == begin[0] && (!begin[1] || chars[1] == begin[1]))
+	{
+		chars += begin[1] ? 2 : 1;
+
+		while(1)
+		{
+			chars = ScanComment(lexer,chars,begin[0],end[0]);
+
+			if(!chars[0])
+				return chars;
+
+			if(chars[0] == end[0] && (!end[1] || chars[1] == end[1]))
+				return chars + (end[1] ? 2 : 1);
+
+			++chars;
+		}
+	}
+
+	// Strings and literals, which unlike when lexing end with their line so a stray quote in a skipped region hides nothing
+	if(quote == '\"' || quote == '\'')
+	{
+		++chars;
+
+		while(1)
+		{
+			chars = ScanChars(lexer,chars,quote == '\"' ? SCAN_STRING : SCAN_LITERAL);
+
+			if(chars[0] == quote)
+				return chars + 1;
+
+			if(chars[0] != '\\' || !chars[1])
+				return chars;
+
+			// Escaped line breaks go on in the next line
+			chars += chars[1] == '\r' && chars[2] == '\n' ? 3 : 2;
+		}
+	}
+
+	// A comment marker that begins no comment
+	return chars + 1;
+}
+
+ULONG ReadEscapeSequence(LPLEXER lexer,PCHAR escape)
+{
+	ULONG i;
+	ULONG total;
+	ULONG current;
+
+	// Skip the '\\'
+	GetChar(lexer);
+
+	if(PeekChar(lexer) == EOF)
+	{
+		LexerError(lexer,"escape sequence not complete");
+		return ERROR_EOF;
+	}
+
+	switch(PeekChar(lexer))
+	{
+		case '\\':
+			GetChar(lexer);
+			escape[0] = '\\';
+			break;
+
+		case 'n':
+			GetChar(lexer);
+			escape[0] = '\n';
+			break;
+
+		case 'r':
+			GetChar(lexer);
+			escape[0] = '\r';
+			break;
+
+		case 't':
+			GetChar(lexer);
+			escape[0] = '\t';
+			break;
+
+		case 'v':
+			GetChar(lexer);
+			escape[0] = '\v';
+			break;
+
+		case 'b':
+			GetChar(lexer);
+			escape[0] = '\b';
+			break;
+
+		case 'f':
+			GetChar(lexer);
+			escape[0] = '\f';
+			break;
+
+		case 'a':
+			GetChar(lexer);
+			escape[0] = '\a';
+			break;
+
+		case '\'':
+			GetChar(lexer);
+			escape[0] = '\'';
+			break;
+
+		case '\"':
+			GetChar(lexer);
+			escape[0] = '\"';
+			break;
+
+		case '\?':
+			GetChar(lexer);
+			escape[0] = '\?';
+			break;
+
+		case 'x':	// Hex
+		{
 			// Skip the inital
 			GetChar(lexer);
 
-			for(i = 0, total = 0; ; ++i, GetChar(lexer))
-			{
-				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
-					current = PeekChar(lexer) - '0';
-				else
-					break;
+			for(i = 0, total = 0; ; ++i, GetChar(lexer))
+			{
+				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
+					current = PeekChar(lexer) - '0';
+				else if(PeekChar(lexer) >= 'A' && PeekChar(lexer) <= 'F')
+					current = PeekChar(lexer) - 'A' + 10;
+				else if(PeekChar(lexer) >= 'a' && PeekChar(lexer) <= 'f')
+					current = PeekChar(lexer) - 'a' + 10;
+				else
+					break;
+
+				total = (total << 4) + current;
+			}
+
+			if(total > 0xFF)
+			{
+				LexerWarning(lexer,"too large value in escape character");
+				total = 0xFF;
+			}
+
+			escape[0] = (CHAR)total;
+			break;
+		}
+		case '0':	// Octal or null char
+		{
+			// Skip the inital
+			GetChar(lexer);
+
+			// Check for null char
+			if(PeekChar(lexer) < '0' && PeekChar(lexer) > '9')
+			{
+				GetChar(lexer);
+				escape[0] = '\0';
+				break;
+			}
+
+			for(i = 0, total = 0; ; ++i, GetChar(lexer))
+			{
+				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '7')
+					current = PeekChar(lexer) - '0';
+				else
+				{
+					if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9' && i < 3)
+						LexerWarning(lexer,"decimal digit terminates octal escape sequence");	
+
+					break;
+				}
+
+				total = (total << 3) + current;
+			}
+
+			if(total > 0xFF)
+			{
+				LexerWarning(lexer,"too large value in escape character");
+				total = 0xFF;
+			}
+
+			escape[0] = (CHAR)total;
+			break;
+		}
+		default:
+		{
+			if(PeekChar(lexer) < '0' && PeekChar(lexer) > '9')
+			{
+				LexerError(lexer,"unknown escape sequence");
+				break;
+			}
+			
+			// Decimal
+			
+			// Skip the inital
+			GetChar(lexer);
+
+			for(i = 0, total = 0; ; ++i, GetChar(lexer))
+			{
+				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
+					current = PeekChar(lexer) - '0';
+				else
+					break;
+
+				total = (total << 3) + (total << 1) + current;
+			}
+
+			if(total > 0xFF)
+			{
+				LexerWarning(lexer,"too large value in escape character");
+				total = 0xFF;
+			}
+
+			escape[0] = (CHAR)total;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+ULONG ReadString(LPLEXER lexer,LPTOKEN token)
+{
+	// Remember the type of quote
+	ULONG quote = PeekChar(lexer);
+	ULONG start;
+	ULONG end;
+	BOOL decoded = FALSE;	// Set once the value stops matching the input text
+
+	// See what type of string is it
+	if(quote == '\"')
+		token->Type = TOKEN_STRING;
+	else if(quote == '\'')
+		token->Type = TOKEN_LITERAL;
+	//else
+		// Shoul not come here
+
+	// Skip quote
+	GetChar(lexer);
+
+	start = lexer->FilePosition;
+	end = start;
+
+	ClearString(&lexer->Scratch);
+
+	while(1)
+	{
+		// Skip the run of plain characters at once
+		LPCSTR chars = ScanChars(lexer,lexer->FileBuffer + lexer->FilePosition,quote == '\"' ? SCAN_STRING : SCAN_LITERAL);
+
+		if(decoded)
+			AppendString(&lexer->Scratch,lexer->FileBuffer + lexer->FilePosition,(ULONG)(chars - lexer->FileBuffer) - lexer->FilePosition);
+
+		lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+
+		if(PeekChar(lexer) == EOF)
+		{
+			LexerError(lexer,"missing trailing quote");
+			return ERROR_EOF;
+		}
+
+		// Escape sequence
+		if(PeekChar(lexer) == '\\')
+		{
+			CHAR escape;
+			ULONG error;
+
+			if(!decoded)
+			{
+				AppendString(&lexer->Scratch,lexer->FileBuffer + start,lexer->FilePosition - start);
+				decoded = TRUE;
+			}
+
+			if(error = ReadEscapeSequence(lexer,&escape))
+				return error;
+
+			AppendChar(&lexer->Scratch,escape);
+
+			continue;
+		}
+		// Terminating quote
+		else if(PeekChar(lexer) == quote)
+		{
+			LEXERCHECKPOINT checkpoint;
+
+			if(!decoded)
+				end = lexer->FilePosition;
+
+			// Skip terminating quote
+			GetChar(lexer);
+
+			// Concatenate sequental strings seperated by whitespace
+			CheckpointLexer(lexer,&checkpoint);
+
+			if(!ReadWhitespace(lexer) && PeekChar(lexer) == quote)
+			{
+				if(!decoded)
+				{
+					AppendString(&lexer->Scratch,lexer->FileBuffer + start,end - start);
+					decoded = TRUE;
+				}
+
+				GetChar(lexer);
+				continue;
+			}
+
+			RewindLexer(lexer,&checkpoint);
+
+			break;
+		}
+		else if(PeekChar(lexer) == '\n')
+		{
+			LexerWarning(lexer,"line break in string");
+
+			//++token->Span;
+
+			// Line breaks are not part of the value
+			if(!decoded)
+			{
+				AppendString(&lexer->Scratch,lexer->FileBuffer + start,lexer->FilePosition - start);
+				decoded = TRUE;
+			}
+		}
+	
+		GetChar(lexer);
+	}
+
+	if(decoded)
+	{
+		token->Length = lexer->Scratch.Length;
+		token->Value = StoreString(lexer,lexer->Scratch.Length ? lexer->Scratch.Buffer : "",token->Length);
+		if(!token->Value)
+		{
+			LexerError(lexer,"out of memory");
+			return ERROR_INVALID;
+		}
+	}
+	else
+	{
+		// The value is exactly the text between the quotes
+		token->Value = lexer->FileBuffer + start;
+		token->Length = end - start;
+	}
+
+	if(token->Type == TOKEN_LITERAL && token->Length > 1)
+		LexerWarning(lexer,"literal is longer that one character");
+
+	return 0;
+}
+
+ULONG ReadIdentifier(LPLEXER lexer,LPTOKEN token)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+
+	token->Type = TOKEN_IDENTIFIER;
+	token->Value = chars;
+
+	while(CHARCLASS(lexer,chars[0]) & CHAR_IDENTIFIER)
+		++chars;
+
+	token->Length = (ULONG)(chars - token->Value);
+
+	lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+
+	if(lexer->KeywordCount)
+		token->TypeEx = FindKeyword(lexer,token->Value,token->Length);
+
+	if(lexer->Atoms && !(token->Atom = AddAtom(lexer->Atoms,token->Value,token->Length)))
+	{
+		LexerError(lexer,"out of memory");
+		return ERROR_INVALID;
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG ReadNumber(LPLEXER lexer,LPTOKEN token)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+	ULONGLONG value = 0;
+	BOOL overflow = FALSE;
+
+	token->Type = TOKEN_NUMBER;
+	token->TypeEx = 0;
+	token->Value = chars;
+
+	// Set sign
+	if(chars[0] == '-')
+	{
+		// Negative
+		++chars;
+		token->TypeEx = NUMBER_SIGN_MASK;
+	}
+	else if(chars[0] == '+')
+	{
+		// Positive
+		++chars;
+	}
+
+	// Hex
+	if(chars[0] == '0' && (chars[1] == 'x' || chars[1] == 'X'))
+	{
+		LPCSTR digits = chars += 2;
+
+		token->TypeEx |= NUMBER_HEX;
+
+		while(CHARCLASS(lexer,chars[0]) & CHAR_HEX_DIGIT)
+		{
+			if(value >> 60)
+				overflow = TRUE;
+
+			value = value << 4 | (chars[0] <= '9' ? chars[0] - '0' : (chars[0] | 0x20) - 'a' + 10);
+			++chars;
+		}
+
+		if(chars == digits)
+			LexerError(lexer,"hex number must have at least one digit");
+	}
+	// Octal
+	else if(chars[0] == '0' && chars[1] != '.')	// TODO Floating point numbers may have more than one leading zero
+	{
+		token->TypeEx |= NUMBER_OCTAL;
+
+		while(CHARCLASS(lexer,chars[0]) & CHAR_OCTAL_DIGIT)
+		{
+			if(value >> 61)
+				overflow = TRUE;
+
+			value = value << 3 | (chars[0] - '0');
+			++chars;
+		}
+
+		if(CHARCLASS(lexer,chars[0]) & CHAR_DIGIT)
+			LexerError(lexer,"decimal digit in octal number");	
+		else if(CHARCLASS(lexer,chars[0]) & CHAR_HEX_DIGIT)
+			LexerError(lexer,"hex digit in octal number");	
+	}
+	// Integer or Floating point
+	else
+	{
+		LPCSTR digits = chars;
+		ULONG dot = 0;
+		LONG exponent = 0;	// Power of ten the digits are scaled by
+
+		while(1)
+		{
+			if(CHARCLASS(lexer,chars[0]) & CHAR_DIGIT)
+			{
+				ULONG digit = chars[0] - '0';
+
+				// Past the last digit that fits the value is only good for floating point
+				if(value > 0xFFFFFFFFFFFFFFFFULL / 10 || (value == 0xFFFFFFFFFFFFFFFFULL / 10 && digit > 5))
+					overflow = TRUE;
+				else
+				{
+					value = value * 10 + digit;
+
+					if(dot)
+						--exponent;
+				}
+			}
+			else if(chars[0] == '.')
+				dot++;
+			else
+				break;
+
+			++chars;
+		}
+
+		// Scientific notation
+		if((chars[0] == 'e' || chars[0] == 'E') && !dot)
+			dot++;
+
+		// Floating point
+		if(dot == 1)
+		{
+			token->TypeEx |= NUMBER_FLOAT;
+
+			if(chars[0] == 'e' || chars[0] == 'E')
+			{
+				BOOL negative = FALSE;
+				LONG power = 0;
+
+				++chars;
+
+				if(chars[0] == '-' || chars[0] == '+')
+					negative = *chars++ == '-';
+
+				while(CHARCLASS(lexer,chars[0]) & CHAR_DIGIT)
+				{
+					// Anything this large is zero or infinite anyway
+					if(power < 100000)
+						power = power * 10 + chars[0] - '0';
+
+					++chars;
+				}
+
+				exponent += negative ? -power : power;
+			}
+
+			token->Float = ConvertFloat(lexer,digits,(ULONG)(chars - digits),value,exponent,!overflow);
+		}
+		else if(dot)
+			LexerError(lexer,"floating point number has more than one dot");
+		// Integer
+		else
+			token->TypeEx |= NUMBER_INTEGER;
+	}
+
+	if((token->TypeEx & NUMBER_TYPE_MASK) != NUMBER_FLOAT)
+	{
+		if(overflow)
+		{
+			LexerWarning(lexer,"number is too large");
+			value = 0xFFFFFFFFFFFFFFFFULL;
+		}
+
+		token->Integer = value;
+	}
+
+	// The value includes the sign and any prefix
+	token->Length = (ULONG)(chars - token->Value);
+
+	lexer->FilePosition = (ULONG)(chars - lexer->FileBuffer);
+
+	return ERROR_NONE;
+}
+
+double ConvertFloat(LPLEXER lexer,LPCSTR chars,ULONG length,ULONGLONG mantissa,LONG exponent,BOOL exact)
+{
+	static const double powers[NUMBER_FAST_EXPONENT + 1] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	// Both the digits and the power of ten are exact doubles, so one operation rounds correctly
+	if(exact && mantissa <= NUMBER_FAST_MANTISSA && exponent >= -NUMBER_FAST_EXPONENT && exponent <= NUMBER_FAST_EXPONENT)
+		return exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];
+
+	if(exact && !mantissa)
+		return 0.0;
+
+	// Everything else goes through the runtime, which needs a terminated copy
+	ClearString(&lexer->Scratch);
+
+	if(!AppendString(&lexer->Scratch,chars,length))
+	{
+		LexerError(lexer,"out of memory");
+		return 0.0;
+	}
+
+	return strtod(lexer->Scratch.Buffer,NULL);
+}
+
+ULONG ReadPunctuation(LPLEXER lexer,LPTOKEN token)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+	ULONG node = lexer->PunctuationRoots[(BYTE)chars[0]];
+	ULONG punctuation = 0;
+	ULONG length = 0;
+	ULONG i;
+
+	// Walk the trie and remember the longest punctuation seen
+	for(i = 1; node; ++i)
+	{
+		if(lexer->PunctuationNodes[node].Punctuation)
+		{
+			punctuation = lexer->PunctuationNodes[node].Punctuation;
+			length = i;
+		}
+
+		for(node = lexer->PunctuationNodes[node].Child; node && lexer->PunctuationNodes[node].Character != chars[i]; node = lexer->PunctuationNodes[node].Sibling);
+	}
+
+	if(!punctuation)
+		return ERROR_INVALID;
+
+	token->Type = TOKEN_PUNCTUATION;
+	token->TypeEx = lexer->Punctuations[punctuation - 1].id;
+	token->Value = chars;
+	token->Length = length;
+
+	lexer->FilePosition += length;
+
+	return ERROR_NONE;
+}
+
+BOOL IsNumber(LPLEXER lexer)
+{
+	LPCSTR chars = lexer->FileBuffer + lexer->FilePosition;
+
+	// Negative and positive numbers
+	if(chars[0] == '-' || chars[0] == '+')
+		++chars;
+
+	// Digits and decimal dot
+	return (CHARCLASS(lexer,chars[0]) & CHAR_DIGIT) || (chars[0] == '.' && (CHARCLASS(lexer,chars[1]) & CHAR_DIGIT));
+}
+
+BOOL IsString(LPLEXER lexer)
+{
+	// Single and double quotes
+	return CHARCLASS(lexer,lexer->FileBuffer[lexer->FilePosition]) & CHAR_QUOTE;
+}
+
+BOOL IsIdentifier(LPLEXER lexer)
+{
+	// Only letters and underscore
+	return CHARCLASS(lexer,lexer->FileBuffer[lexer->FilePosition]) & CHAR_IDENTIFIER_START;
+}
+
+ULONG ReadToken(LPLEXER lexer,LPTOKEN token)
+{
+	ULONG error;
+
+	// Read inital whitespace up to token
+	if(error = ReadWhitespace(lexer))
+		return error;
+
+	return ReadTokenValue(lexer,token);
+}
+
+ULONG ReadTokenValue(LPLEXER lexer,LPTOKEN token)
+{
+	ULONG error;
+	USHORT flags;
+#ifdef LEXER_STATISTICS
+	ULONGLONG ticks = GetLexerTicks();
+	ULONG position = lexer->FilePosition;
+	ULONG type;
+#endif
+
+	token->Location = lexer->FileBase + lexer->FilePosition;
+
+	// Told from the input so lexing in chunks, again or from a cache agrees
+	token->Flags = IsSpaceBefore(lexer,lexer->FilePosition) ? TOKEN_SPACE : 0;
+
+	flags = CHARCLASS(lexer,lexer->FileBuffer[lexer->FilePosition]);
+
+	// Number
+	if((flags & CHAR_NUMBER) && IsNumber(lexer))
+		error = ReadNumber(lexer,token);
+
+	// String
+	else if(flags & CHAR_QUOTE)
+		error = ReadString(lexer,token);
+
+	// Identifier
+	else if(flags & CHAR_IDENTIFIER_START)
+		error = ReadIdentifier(lexer,token);
+
+	// Punctuation
+	else if(flags & CHAR_PUNCTUATION)
+		error = ReadPunctuation(lexer,token);
+
+	else
+		error = ERROR_INVALID;
+
+#ifdef LEXER_STATISTICS
+	type = error || token->Type >= TOKEN_TYPES ? TOKEN_NONE : token->Type;
+
+	lexer->Statistics.Bytes += lexer->FilePosition - position;
+	lexer->Statistics.Tokens[type]++;
+	lexer->Statistics.TokenTicks[type] += GetLexerTicks() - ticks;
+#endif
+
+	return error;
+}
+
+ULONG ExpectTokenString(LPLEXER lexer,LPCSTR string)
+{
+	ULONG error;
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	if(error = ReadToken(lexer,&token))
+	{
+		if(error != ERROR_EOF)
+			LexerError(lexer,"cound not find expected '%s'",string);
+
+		UninitializeToken(&token);
+		return error;
+	}
+
+	if(!TokenEqual(&token,string))
+	{
+		LexerError(lexer,"expected '%s' but found '%.*s'",string,token.Length,token.Value);
+		UninitializeToken(&token);
+		return ERROR_INVALID;
+	}
+
+	UninitializeToken(&token);
+
+	return ERROR_NONE;
+}
+
+ULONG ExpectTokenType(LPLEXER lexer,ULONG type,ULONG typeex,LPTOKEN token)
+{
+	ULONG error;
+
+	if(error = ReadToken(lexer,token))
+	{
+		if(error != ERROR_EOF)
+			LexerError(lexer,"could not read expected token");
+
+		return error;
+	}
+
+	if(token->Type != type)
+	{
+		LPCSTR typestring;
+
+		switch(type)
+		{
+		case TOKEN_PUNCTUATION:
+			//typestring = "punctuation";
+			typestring = GetPunctuationName(lexer,typeex);
+			break;
+
+		case TOKEN_IDENTIFIER:
+			typestring = "identifier";
+			break;
+
+		case TOKEN_NUMBER:
+			typestring = "number";
+			break;
+
+		case TOKEN_STRING:
+			typestring = "string";
+			break;
+
+		case TOKEN_LITERAL:
+			typestring = "literal";
+			break;
+
+		default:
+			typestring = "unknown";
+			break;
+		}
+
+		LexerError(lexer,"expected '%s' but found '%.*s'",typestring,token->Length,token->Value);
+		return ERROR_INVALID;
+	}
+
+	if(typeex && token->TypeEx != typeex)
+	{
+		if(token->Type == TOKEN_PUNCTUATION)
+		{
+			LexerError(lexer,"expected '%s' but found '%.*s'",GetPunctuationName(lexer,typeex),token->Length,token->Value);
+			return ERROR_INVALID;
+		}
+		else
+		{
+			LPCSTR typeexstring;
+
+			switch(typeex)
+			{
+			case NUMBER_INTEGER:
+				typeexstring = "integer";
+				break;
+
+			case NUMBER_HEX:
+				typeexstring = "hex";
+				break;
+
+			case NUMBER_OCTAL:
+				typeexstring = "octal";
+				break;
+
+			case NUMBER_FLOAT:
+				typeexstring = "float";
+				break;
+
+			default:
+				typeexstring = "unknown";
+				break;
+			}
+
+			LexerError(lexer,"expected '%s' but found '%.*s'",typeexstring,token->Length,token->Value);
+			return ERROR_INVALID;
+		}
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG ExpectTokenAny(LPLEXER lexer,LPTOKEN token)
+{
+	ULONG error;
+
+	if(error = ReadToken(lexer,token))
+	{
+		if(error != ERROR_EOF)
+			LexerError(lexer,"could not read expected token");
+
+		return error;
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG PeekTokenString(LPLEXER lexer,LPCSTR string)
+{
+	LEXERCHECKPOINT checkpoint;
+	ULONG error;
+	TOKEN token;
+
+	CheckpointLexer(lexer,&checkpoint);
+
+	InitializeToken(&token);
+
+	if(!(error = ReadToken(lexer,&token)) && !TokenEqual(&token,string))
+		error = ERROR_INVALID;
+
+	UninitializeToken(&token);
+
+	RewindLexer(lexer,&checkpoint);
+
+	return error;
+}
+
+ULONG PeekTokenType(LPLEXER lexer,ULONG type,ULONG typeex,LPTOKEN token)
+{
+	LEXERCHECKPOINT checkpoint;
+	ULONG error;
+
+	CheckpointLexer(lexer,&checkpoint);
+
+	if(!(error = ReadToken(lexer,token)) && (token->Type != type || (typeex && token->TypeEx != typeex)))
+		error = ERROR_INVALID;
+
+	RewindLexer(lexer,&checkpoint);
+
+	return error;
+}
+
+ULONG PeekTokenAny(LPLEXER lexer,LPTOKEN token)
+{
+	LEXERCHECKPOINT checkpoint;
+	ULONG error;
+
+	CheckpointLexer(lexer,&checkpoint);
+
+	error = ReadToken(lexer,token);
+
+	RewindLexer(lexer,&checkpoint);
+
+	return error;
+}
+
+ULONG SkipTokenAny(LPLEXER lexer)
+{
+	ULONG error;
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	error = ReadToken(lexer,&token);
+
+	UninitializeToken(&token);
+	return error;
+}
+
+ULONG SkipTokenType(LPLEXER lexer,ULONG type,ULONG typeex)
+{
+	LEXERCHECKPOINT checkpoint;
+	ULONG error;
+	TOKEN token;
+
+	CheckpointLexer(lexer,&checkpoint);
+
+	InitializeToken(&token);
+
+	if(!(error = ReadToken(lexer,&token)) && (token.Type != type || (typeex && token.TypeEx != typeex)))
+		error = ERROR_INVALID;
+
+	UninitializeToken(&token);
+
+	// Only consume the token if it matched
+	if(error)
+		RewindLexer(lexer,&checkpoint);
+
+	return error;
+}
+
+BOOL InitializeTokenArray(LPTOKENARRAY tokens)
+{
+	memset(tokens,0,sizeof(TOKENARRAY));
+
+	return TRUE;
+}
+
+VOID UninitializeTokenArray(LPTOKENARRAY tokens)
+{
+	free(tokens->Tokens);
+	tokens->Tokens = NULL;
+
+	tokens->Count = 0;
+	tokens->Capacity = 0;
+	tokens->Position = 0;
+}
+
+BOOL ReserveTokenArray(LPTOKENARRAY tokens,ULONG count)
+{
+	ULONG capacity;
+	LPTOKEN entries;
+
+	if(tokens->Count + count <= tokens->Capacity)
+		return TRUE;
+
+	// Expand
+	for(capacity = tokens->Capacity ? tokens->Capacity * 2 : TOKENARRAY_BLOCK; capacity < tokens->Count + count; capacity *= 2);
+
+	COUNT_ALLOCATION(capacity * sizeof(TOKEN));
+	entries = (LPTOKEN)realloc(tokens->Tokens,capacity * sizeof(TOKEN));
+	if(!entries)
+		return FALSE;
+
+	tokens->Tokens = entries;
+	tokens->Capacity = capacity;
+
+	return TRUE;
+}
+
+BOOL AppendTokenEntry(LPTOKENARRAY tokens,LPTOKEN token)
+{
+	if(!ReserveTokenArray(tokens,1))
+		return FALSE;
+
+	tokens->Tokens[tokens->Count++] = *token;
+
+	return TRUE;
+}
+
+ULONG TokenizeFile(LPLEXER lexer,LPTOKENARRAY tokens)
+{
+	ULONG error;
+
+	while(1)
+	{
+		TOKEN token;
+
+		InitializeToken(&token);
+
+		if(error = ReadToken(lexer,&token))
+			break;
+
+		if(!AppendTokenEntry(tokens,&token))
+		{
+			LexerError(lexer,"out of memory");
+			return ERROR_INVALID;
+		}
+	}
+
+	return EndTokenizing(error);
+}
+
+ULONG EndTokenizing(ULONG error)
+{
+	// Running out of input is how lexing the whole file ends, the tokens read up to there are the result
+	if(error == ERROR_EOF)
+		return ERROR_NONE;
+
+	return error;
+}
+
+ULONG TokenizeRange(LPLEXER lexer,LPTOKENARRAY tokens,ULONG end)
+{
+	ULONG error;
+
+	while(1)
+	{
+		TOKEN token;
+
+		if(error = ReadWhitespace(lexer))
+			return error;
+
+		// Leave the lexer at the first token that starts past the range
+		if(lexer->FilePosition >= end)
+			return ERROR_NONE;
+
+		InitializeToken(&token);
+
+		if(error = ReadTokenValue(lexer,&token))
+			return error;
+
+		if(!AppendTokenEntry(tokens,&token))
+		{
+			LexerError(lexer,"out of memory");
+			return ERROR_INVALID;
+		}
+	}
+}
+
+DWORD WINAPI TokenizeChunk(LPVOID parameter)
+{
+	LPLEXERCHUNK chunk = (LPLEXERCHUNK)parameter;
+	LPLEXER lexer = &chunk->Lexer;
+
+	while(1)
+	{
+		TOKEN token;
+		ULONG diagnostics = lexer->Diagnostics;
+
+		chunk->Error = ReadWhitespace(lexer);
+
+		// Diagnostics in whitespace belong with the token before it
+		if(lexer->Diagnostics != diagnostics)
+			chunk->Diagnostic = chunk->Tokens.Count;
+
+		if(chunk->Error || lexer->FilePosition >= chunk->End)
+			break;
+
+		InitializeToken(&token);
+
+		diagnostics = lexer->Diagnostics;
+		chunk->Error = ReadTokenValue(lexer,&token);
+
+		if(lexer->Diagnostics != diagnostics || chunk->Error)
+			chunk->Diagnostic = chunk->Tokens.Count + 1;
+
+		if(chunk->Error)
+			break;
+
+		if(!AppendTokenEntry(&chunk->Tokens,&token))
+		{
+			chunk->Error = ERROR_INVALID;
+			chunk->Diagnostic = chunk->Tokens.Count + 1;
+			break;
+		}
+	}
+
+	chunk->StopOffset = lexer->FilePosition;
+
+	return 0;
+}
+
+ULONG TokenizeFileParallel(LPLEXER lexer,LPTOKENARRAY tokens,ULONG threads)
+{
+	LPLEXERCHUNK chunks;
+	HANDLE handles[PARALLEL_THREADS_MAXIMUM];
+	ULONG position = lexer->FilePosition;
+	ULONG error = ERROR_NONE;
+	ULONG count;
+	ULONG i;
+
+	if(!threads)
+	{
+		SYSTEM_INFO info;
+
+		GetSystemInfo(&info);
+		threads = info.dwNumberOfProcessors;
+	}
+
+	threads = min(threads,PARALLEL_THREADS_MAXIMUM);
+	threads = min(threads,(lexer->FileBufferLength - position) / PARALLEL_CHUNK_MINIMUM);
+
+	if(threads < 2)
+		return TokenizeFile(lexer,tokens);
+
+	COUNT_ALLOCATION(threads * sizeof(LEXERCHUNK));
+	chunks = (LPLEXERCHUNK)calloc(threads,sizeof(LEXERCHUNK));
+	if(!chunks)
+		return TokenizeFile(lexer,tokens);
+
+	// Guess restart points at line starts, the guesses are checked when stitching
+	for(i = 0, count = 0; i < threads; ++i)
+	{
+		LPLEXERCHUNK chunk;
+		ULONG start = position;
+
+		if(i)
+		{
+			LPCSTR newline;
+
+			start = position + (ULONG)((ULONGLONG)(lexer->FileBufferLength - position) * i / threads);
+
+			newline = (LPCSTR)memchr(lexer->FileBuffer + start,'\n',lexer->FileBufferLength - start);
+			if(!newline)
+				break;
+
+			start = (ULONG)(newline + 1 - lexer->FileBuffer);
+
+			if(start <= chunks[count - 1].Lexer.FilePosition)
+				continue;
+
+			chunks[count - 1].End = start;
+		}
+
+		chunk = &chunks[count++];
+
+		chunk->Lexer = *lexer;
+		chunk->Lexer.FilePosition = start;
+		chunk->Lexer.Quiet = TRUE;
+		chunk->Lexer.Diagnostics = 0;
+		chunk->Lexer.Strings = NULL;
+		chunk->Lexer.Atoms = NULL;	// Interned in order while stitching
+#ifdef LEXER_STATISTICS
+		memset(&chunk->Lexer.Statistics,0,sizeof(LEXERSTATISTICS));
+#endif
+		InitializeString(&chunk->Lexer.Scratch);
+
+		InitializeTokenArray(&chunk->Tokens);
+
+		chunk->End = lexer->FileBufferLength + 1;
+		chunk->Diagnostic = CHUNK_CLEAN;
+	}
+
+	// Chunks that could not get a thread are lexed right away
+	for(i = 0; i < count; ++i)
+	{
+		handles[i] = CreateThread(NULL,0,TokenizeChunk,&chunks[i],0,NULL);
+		if(!handles[i])
+			TokenizeChunk(&chunks[i]);
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		if(handles[i])
+		{
+			WaitForSingleObject(handles[i],INFINITE);
+			CloseHandle(handles[i]);
+		}
+	}
+
+	// Stitch the chunks together in order, each one has to continue where the one before stopped
+	for(i = 0; i < count; ++i)
+	{
+		LPLEXERCHUNK chunk = &chunks[i];
+		ULONG first = 0;
+		BOOL relex = FALSE;
+
+		if(i)
+		{
+			// Everything up to here was already covered
+			if(position >= chunk->End)
+				continue;
+
+			// Find the token the chunk before stopped at
+			first = FindTokenEntry(lexer,&chunk->Tokens,position);
+
+			// The chunk joins up if it has a token starting at the position
+			if(first == chunk->Tokens.Count || chunk->Tokens.Tokens[first].Location - lexer->FileBase != position)
+				relex = TRUE;
+			else if(chunk->Diagnostic != CHUNK_CLEAN && chunk->Diagnostic > first)
+				relex = TRUE;
+		}
+		else if(chunk->Diagnostic != CHUNK_CLEAN)
+			relex = TRUE;
+
+		// Lex it again in order, the workers only counted their diagnostics
+		if(relex)
+		{
+			lexer->FilePosition = position;
+
+			error = TokenizeRange(lexer,tokens,chunk->End);
+
+			position = lexer->FilePosition;
+
+			if(error)
+				break;
+		}
+		else
+		{
+			ULONG j;
+
+			if(!ReserveTokenArray(tokens,chunk->Tokens.Count - first))
+			{
+				LexerError(lexer,"out of memory");
+				error = ERROR_INVALID;
+				break;
+			}
+
+			for(j = first; j < chunk->Tokens.Count; ++j)
+			{
+				LPTOKEN token = &tokens->Tokens[tokens->Count++];
+
+				*token = chunk->Tokens.Tokens[j];
+
+				if(lexer->Atoms && token->Type == TOKEN_IDENTIFIER && !(token->Atom = AddAtom(lexer->Atoms,token->Value,token->Length)))
+				{
+					LexerError(lexer,"out of memory");
+					error = ERROR_INVALID;
+					break;
+				}
+			}
+
+			if(error)
+				break;
+
+			position = chunk->StopOffset;
+
+			if(chunk->Error)
+			{
+				error = chunk->Error;
+				break;
+			}
+		}
+	}
+
+	lexer->FilePosition = position;
+
+	// Decoded string values stay with the main lexer
+	for(i = 0; i < count; ++i)
+	{
+		LPSTRINGBLOCK block = chunks[i].Lexer.Strings;
+
+		if(block)
+		{
+			while(block->Next)
+				block = block->Next;
+
+			block->Next = lexer->Strings;
+			lexer->Strings = chunks[i].Lexer.Strings;
+		}
+
+		UninitializeString(&chunks[i].Lexer.Scratch);
+		UninitializeTokenArray(&chunks[i].Tokens);
+
+#ifdef LEXER_STATISTICS
+		// Diagnostics of the workers are reported again while stitching, the work they did is counted once
+		chunks[i].Lexer.Statistics.Warnings = 0;
+		chunks[i].Lexer.Statistics.Errors = 0;
+
+		AddLexerStatistics(&lexer->Statistics,&chunks[i].Lexer.Statistics);
+#endif
+	}
+
+	free(chunks);
+
+	return EndTokenizing(error);
+}
+
+ULONG FindTokenEntry(LPLEXER lexer,LPTOKENARRAY tokens,ULONG offset)
+{
+	ULONG low = 0;
+	ULONG high = tokens->Count;
+
+	// First token starting at the offset or past it, lexing from the same position gives the same tokens so passes that both start one there agree on the rest
+	while(low < high)
+	{
+		ULONG middle = (low + high) / 2;
+
+		if(tokens->Tokens[middle].Location - lexer->FileBase < offset)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+BOOL IsInputValue(LPCSTR buffer,ULONG length,LPTOKEN token)
+{
+	// Decoded values live in the string blocks instead
+	return (ULONG_PTR)token->Value >= (ULONG_PTR)buffer && (ULONG_PTR)(token->Value + token->Length) <= (ULONG_PTR)(buffer + length);
+}
+
+ULONG RelexTokenArray(LPLEXER lexer,LPTOKENARRAY tokens,ULONG offset,ULONG removed,LPCSTR inserted,ULONG length,LPTOKENCHANGE change)
+{
+	LPCSTR old = lexer->FileBuffer;
+	ULONG oldLength = lexer->FileBufferLength;
+	ULONG oldInput = lexer->FileInput;
+	HANDLE oldMapping = lexer->FileMapping;
+	ULONG stop = lexer->FilePosition;
+	TOKENARRAY fresh;
+	LPSTR buffer;
+	ULONG restart;
+	ULONG first;
+	ULONG next;
+	ULONG last;
+	ULONG error;
+	ULONG i;
+
+	memset(change,0,sizeof(TOKENCHANGE));
+
+	if(!old || offset > oldLength || removed > oldLength - offset || length > 0xFFFFFFFF - FILE_PADDING - (oldLength - removed))
+		return ERROR_INVALID;
+
+	// Tokens starting this close to the edit may have looked into it, the one before them is where lexing starts again
+	first = FindTokenEntry(lexer,tokens,offset >= RELEX_LOOKAHEAD ? offset - RELEX_LOOKAHEAD + 1 : 0);
+
+	if(first)
+		restart = tokens->Tokens[--first].Location - lexer->FileBase;
+	else
+		restart = 0;
+
+	// Old tokens past the removed text are the ones new tokens can line up with again
+	next = FindTokenEntry(lexer,tokens,offset + removed);
+
+	COUNT_ALLOCATION(oldLength - removed + length + FILE_PADDING);
+	buffer = (LPSTR)malloc(oldLength - removed + length + FILE_PADDING);
+	if(!buffer)
+	{
+		LexerError(lexer,"out of memory");
+		return ERROR_INVALID;
+	}
+
+	memcpy(buffer,old,offset);
+	memcpy(buffer + offset,inserted,length);
+	memcpy(buffer + offset + length,old + offset + removed,oldLength - offset - removed);
+	memset(buffer + oldLength - removed + length,0,FILE_PADDING);
+
+	// The old input is released only after every kept token has moved over to the new one
+	lexer->FileBuffer = buffer;
+	lexer->FileBufferLength = oldLength - removed + length;
+	lexer->FileInput = INPUT_HEAP;
+	lexer->FileMapping = NULL;
+
+	free(lexer->Lines);
+	lexer->Lines = NULL;
+	lexer->LineCount = 0;
+
+	for(i = 0; i < first; ++i)
+		if(IsInputValue(old,oldLength,&tokens->Tokens[i]))
+			tokens->Tokens[i].Value = buffer + (tokens->Tokens[i].Value - old);
+
+	InitializeTokenArray(&fresh);
+
+	lexer->FilePosition = restart;
+	last = tokens->Count;
+
+	while(1)
+	{
+		TOKEN token;
+
+		if(error = ReadWhitespace(lexer))
+			break;
+
+		// Past the edit and what its space flag looks at, an old token starting here joins up with the old tokens
+		if(lexer->FilePosition >= offset + length + 2)
+		{
+			ULONG position = lexer->FilePosition - length + removed;
+
+			while(next < tokens->Count && tokens->Tokens[next].Location - lexer->FileBase < position)
+				++next;
+
+			if(next < tokens->Count && tokens->Tokens[next].Location - lexer->FileBase == position)
+			{
+				last = next;
+				lexer->FilePosition = stop - removed + length;
+				break;
+			}
+		}
+
+		InitializeToken(&token);
+
+		if(error = ReadTokenValue(lexer,&token))
+			break;
+
+		if(!AppendTokenEntry(&fresh,&token))
+		{
+			LexerError(lexer,"out of memory");
+			error = ERROR_INVALID;
+			break;
+		}
+	}
+
+	if(fresh.Count > last - first && !ReserveTokenArray(tokens,fresh.Count - (last - first)))
+	{
+		LexerError(lexer,"out of memory");
+		error = ERROR_INVALID;
+
+		// Keep only what is known to be right
+		change->First = first;
+		change->Removed = tokens->Count - first;
+
+		tokens->Count = first;
+		lexer->FilePosition = restart;
+	}
+	else
+	{
+		// Tokens past the edit move with the text
+		for(i = last; i < tokens->Count; ++i)
+		{
+			LPTOKEN token = &tokens->Tokens[i];
+
+			if(IsInputValue(old,oldLength,token))
+				token->Value = buffer + (token->Value - old) - removed + length;
+
+			token->Location = token->Location - removed + length;
+		}
+
+		memmove(&tokens->Tokens[first + fresh.Count],&tokens->Tokens[last],(tokens->Count - last) * sizeof(TOKEN));
+
+		if(fresh.Count)
+			memcpy(&tokens->Tokens[first],fresh.Tokens,fresh.Count * sizeof(TOKEN));
+
+		change->First = first;
+		change->Removed = last - first;
+		change->Inserted = fresh.Count;
+
+		tokens->Count = tokens->Count - change->Removed + change->Inserted;
+	}
+
+	// A position past the change keeps pointing at the same token, one inside it goes back to its start
+	if(tokens->Position > first)
+	{
+		if(tokens->Position >= first + change->Removed)
+			tokens->Position = tokens->Position - change->Removed + change->Inserted;
+		else
+			tokens->Position = first;
+	}
+
+	UninitializeTokenArray(&fresh);
+
+	ReleaseInput(old,oldInput,oldMapping);
+
+	return EndTokenizing(error);
+}
+
+LPTOKEN PeekTokenEntry(LPTOKENARRAY tokens,ULONG ahead)
+{
+	if(tokens->Position + ahead >= tokens->Count)
+		return NULL;
+
+	return &tokens->Tokens[tokens->Position + ahead];
+}
+
+LPTOKEN NextTokenEntry(LPTOKENARRAY tokens)
+{
+	if(tokens->Position >= tokens->Count)
+		return NULL;
+
+	return &tokens->Tokens[tokens->Position++];
+}
+
+ULONG GetTokenArrayPosition(LPTOKENARRAY tokens)
+{
+	return tokens->Position;
+}
+
+VOID SetTokenArrayPosition(LPTOKENARRAY tokens,ULONG position)
+{
+	tokens->Position = position;
+}
+
+ULONGLONG HashData(ULONGLONG hash,LPCVOID data,ULONG length)
+{
+	const ULONGLONG multiplier = 0xC6A4A7935BD1E995ULL;
+	LPCSTR chars = (LPCSTR)data;
+	ULONGLONG word;
+	ULONG i;
+
+	// MurmurHash64A, eight bytes at a time
+	hash ^= length * multiplier;
+
+	for(i = 0; i + 8 <= length; i += 8)
+	{
+		memcpy(&word,chars + i,8);
+
+		word *= multiplier;
+		word ^= word >> 47;
+		word *= multiplier;
+
+		hash ^= word;
+		hash *= multiplier;
+	}
+
+	// The tail is zero extended into one more word
+	if(i < length)
+	{
+		word = 0;
+		memcpy(&word,chars + i,length - i);
+
+		hash ^= word;
+		hash *= multiplier;
+	}
+
+	hash ^= hash >> 47;
+	hash *= multiplier;
+	hash ^= hash >> 47;
+
+	return hash;
+}
+
+ULONGLONG HashConfiguration(LPLEXER lexer)
+{
+	ULONGLONG hash = TOKENCACHE_VERSION;
+	ULONG i;
+
+	for(i = 0; lexer->Punctuations[i].name; ++i)
+	{
+		hash = HashData(hash,lexer->Punctuations[i].name,(ULONG)strlen(lexer->Punctuations[i].name));
+		hash = HashData(hash,&lexer->Punctuations[i].id,sizeof(ULONG));
+	}
+
+	for(i = 0; lexer->Keywords && lexer->Keywords[i].name; ++i)
+	{
+		hash = HashData(hash,lexer->Keywords[i].name,(ULONG)strlen(lexer->Keywords[i].name));
+		hash = HashData(hash,&lexer->Keywords[i].id,sizeof(ULONG));
+	}
+
+	hash = HashData(hash,&lexer->KeywordsNoCase,sizeof(BOOL));
+	hash = HashData(hash,lexer->Comment,sizeof(lexer->Comment));
+	hash = HashData(hash,lexer->MultilineCommentBegin,sizeof(lexer->MultilineCommentBegin));
+	hash = HashData(hash,lexer->MultilineCommentEnd,sizeof(lexer->MultilineCommentEnd));
 
-				total = (total << 3) + (total << 1) + current;
-			}
+	return hash;
+}
 
-			if(total > 0xFF)
-			{
-				LexerWarning(lexer,"too large value in escape character");
-				total = 0xFF;
-			}
+ULONG TokenizeFileCached(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR path)
+{
+	ULONG diagnostics = lexer->Diagnostics;
+	ULONG error;
 
-			escape[0] = (CHAR)total;
-			break;
-		}
-	}
+	// Only whole inputs lexed into an empty array are cached
+	if(tokens->Count || lexer->FilePosition)
+		return TokenizeFile(lexer,tokens);
 
-	return 0;
+	if(LoadTokenCache(lexer,tokens,path))
+		return ERROR_NONE;
+
+	if(error = TokenizeFile(lexer,tokens))
+		return error;
+
+	// Inputs with diagnostics are lexed again every time so the diagnostics are reported again
+	if(lexer->Diagnostics == diagnostics)
+		SaveTokenCache(lexer,tokens,path);
+
+	return ERROR_NONE;
 }
 
-ULONG ReadString(LPLEXER lexer,LPTOKEN token)
+BOOL SaveTokenCache(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR path)
 {
-	// Remember the type of quote
-	ULONG quote = PeekChar(lexer);
+	TOKENCACHEHEADER header;
+	ATOMTABLE identifiers;
+	PULONGLONG numbers;
+	LPTOKENCACHEENTRY entries;
+	LPTOKENCACHEIDENTIFIER spellings;
+	LPSTR strings;
+	LPSTR cache;
+	ULONGLONG size;
+	ULONG number;
+	ULONG string;
+	HANDLE file;
+	DWORD written;
+	BOOL saved;
+	ULONG i;
 
-	// See what type of string is it
-	if(quote == '\"')
-		token->Type = TOKEN_STRING;
-	else if(quote == '\'')
-		token->Type = TOKEN_LITERAL;
-	//else
-		// Shoul not come here
+	if(!lexer->FileBuffer)
+		return FALSE;
 
-	token->LineNumber = lexer->LineNumber;
+	memset(&header,0,sizeof(header));
 
-	// Skip quote
-	GetChar(lexer);
+	header.Magic = TOKENCACHE_MAGIC;
+	header.Version = TOKENCACHE_VERSION;
+	header.InputHash = HashData(0,lexer->FileBuffer,lexer->FileBufferLength);
+	header.ConfigurationHash = HashConfiguration(lexer);
+	header.InputLength = lexer->FileBufferLength;
+	header.End = lexer->FilePosition;
+	header.TokenCount = tokens->Count;
 
-	// Inital alloc of string
-	AppendChar(&token->Value,0);	// TODO This was added 25.10.2008 as a fix for (null) empty strings
+	// Distinct identifiers are found with a private atom table, the data of an atom is its index plus one
+	InitializeAtomTable(&identifiers);
 
-	while(1)
+	for(i = 0, size = 0; i < tokens->Count; ++i)
 	{
-		if(PeekChar(lexer) == EOF)
+		LPTOKEN token = &tokens->Tokens[i];
+		ULONG offset = token->Location - lexer->FileBase;
+
+		// Every token must come from this input
+		if(offset > header.InputLength || token->Length > header.InputLength - offset)
 		{
-			LexerError(lexer,"missing trailing quote");
-			return ERROR_EOF;
+			UninitializeAtomTable(&identifiers);
+			return FALSE;
 		}
 
-		// Escape sequence
-		if(PeekChar(lexer) == '\\')
+		if(token->Type == TOKEN_NUMBER)
+			++header.NumberCount;
+		else if(token->Type == TOKEN_IDENTIFIER)
 		{
-			CHAR escape;
-			ULONG error;
-
-			if(error = ReadEscapeSequence(lexer,&escape))
-				return error;
+			ULONG atom = AddAtom(&identifiers,token->Value,token->Length);
 
-			AppendChar(&token->Value,escape);
+			if(!atom)
+			{
+				UninitializeAtomTable(&identifiers);
+				return FALSE;
+			}
 
-			continue;
+			if(!GetAtomData(&identifiers,atom))
+				SetAtomData(&identifiers,atom,(LPVOID)(ULONG_PTR)++header.IdentifierCount);
 		}
-		// Terminating quote
-		else if(PeekChar(lexer) == quote)
-		{
-			LEXERSTATE state;
+		else if(!IsInputValue(lexer->FileBuffer,header.InputLength,token))
+			size += token->Length + 1;
+	}
 
-			// Skip terminating quote
-			GetChar(lexer);
+	if(size > 0xFFFFFFFF)
+	{
+		UninitializeAtomTable(&identifiers);
+		return FALSE;
+	}
 
-			// Concatenate sequental strings seperated by whitespace
-			StoreLexerState(lexer,&state);
+	header.StringsLength = (ULONG)size;
 
-			if(!ReadWhitespace(lexer) && PeekChar(lexer) == quote)
-			{
-				FreeLexerState(&state);
-				GetChar(lexer);
-				continue;
-			}
+	size = sizeof(TOKENCACHEHEADER) + (ULONGLONG)header.NumberCount * sizeof(ULONGLONG) + (ULONGLONG)header.TokenCount * sizeof(TOKENCACHEENTRY) + (ULONGLONG)header.IdentifierCount * sizeof(TOKENCACHEIDENTIFIER) + header.StringsLength;
+
+	COUNT_ALLOCATION(size);
+	cache = size <= 0xFFFFFFFF ? (LPSTR)calloc(1,(size_t)size) : NULL;
+	if(!cache)
+	{
+		UninitializeAtomTable(&identifiers);
+		return FALSE;
+	}
 
-			RestoreLexerState(lexer,&state);
-			FreeLexerState(&state);
+	memcpy(cache,&header,sizeof(header));
 
-			break;
+	numbers = (PULONGLONG)(cache + sizeof(TOKENCACHEHEADER));
+	entries = (LPTOKENCACHEENTRY)(numbers + header.NumberCount);
+	spellings = (LPTOKENCACHEIDENTIFIER)(entries + header.TokenCount);
+	strings = (LPSTR)(spellings + header.IdentifierCount);
+
+	for(i = 0, number = 0, string = 0; i < tokens->Count; ++i)
+	{
+		LPTOKEN token = &tokens->Tokens[i];
+		LPTOKENCACHEENTRY entry = &entries[i];
+
+		entry->Offset = token->Location - lexer->FileBase;
+		entry->Length = token->Length;
+		entry->Type = token->Type;
+		entry->TypeEx = token->TypeEx;
+
+		// The integer bits carry float values as well
+		if(token->Type == TOKEN_NUMBER)
+			numbers[number++] = token->Integer;
+
+		if(token->Type == TOKEN_IDENTIFIER)
+		{
+			entry->Value = (ULONG)(ULONG_PTR)GetAtomData(&identifiers,FindAtom(&identifiers,token->Value,token->Length)) - 1;
+
+			spellings[entry->Value].Offset = (ULONG)(token->Value - lexer->FileBuffer);
+			spellings[entry->Value].Length = token->Length;
 		}
-		else if(PeekChar(lexer) == '\n')
+		else if(!IsInputValue(lexer->FileBuffer,header.InputLength,token))
 		{
-			LexerWarning(lexer,"line break in string");
+			// Decoded values are stored zero terminated like the lexer string blocks hold them
+			entry->Type |= TOKENCACHE_DECODED;
+			entry->Value = string;
 
-			++lexer->LineNumber;
-			//++token->Span;
+			memcpy(strings + string,token->Value,token->Length);
+			string += token->Length + 1;
 		}
 		else
-			AppendChar(&token->Value,(CHAR)PeekChar(lexer));
-	
-		GetChar(lexer);
+			entry->Value = (ULONG)(token->Value - lexer->FileBuffer);
 	}
 
-	if(token->Type == TOKEN_LITERAL && strlen(token->Value.Buffer) > 1)
-		LexerWarning(lexer,"literal is longer that one character");
+	UninitializeAtomTable(&identifiers);
 
-	return 0;
-}
+	file = CreateFileA(path,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		free(cache);
+		return FALSE;
+	}
 
-ULONG ReadIdentifier(LPLEXER lexer,LPTOKEN token)
-{
-	token->Type = TOKEN_IDENTIFIER;
-	token->LineNumber = lexer->LineNumber;
+	saved = WriteFile(file,cache,(DWORD)size,&written,NULL) && written == (DWORD)size;
 
-	while((PeekChar(lexer) >= 'a' && PeekChar(lexer) <= 'z') || (PeekChar(lexer) >= 'A' && PeekChar(lexer) <= 'Z') || (PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9') || PeekChar(lexer) == '_')
-		AppendChar(&token->Value,(CHAR)GetChar(lexer));
+	CloseHandle(file);
+	free(cache);
 
-	// TODO Unnecessary?
-	if(PeekChar(lexer) == EOF)
-		return ERROR_INVALID;
+	// Never leave a truncated cache behind
+	if(!saved)
+		DeleteFileA(path);
 
-	return ERROR_NONE;
+	return saved;
 }
 
-ULONG ReadNumber(LPLEXER lexer,LPTOKEN token)
+BOOL LoadTokenCache(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR path)
 {
-	ULONG i;
+	LARGE_INTEGER size;
+	HANDLE file;
+	HANDLE mapping;
+	LPCSTR cache;
+	BOOL loaded;
 
-	token->Type = TOKEN_NUMBER;
-	token->LineNumber = lexer->LineNumber;
+	if(!lexer->FileBuffer)
+		return FALSE;
 
-	// Set sign
-	if(PeekChar(lexer) == '-')
+	file = CreateFileA(path,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if(!GetFileSizeEx(file,&size) || size.QuadPart < sizeof(TOKENCACHEHEADER) || size.QuadPart > 0xFFFFFFFF)
 	{
-		// Negative
-		AppendChar(&token->Value,(CHAR)GetChar(lexer));
-		token->TypeEx = NUMBER_SIGN_MASK;
+		CloseHandle(file);
+		return FALSE;
 	}
-	else if(PeekChar(lexer) == '+')
+
+	mapping = CreateFileMappingA(file,NULL,PAGE_READONLY,0,0,NULL);
+	if(!mapping)
 	{
-		// Positive
-		AppendChar(&token->Value,(CHAR)GetChar(lexer));
-		token->TypeEx = 0;
+		CloseHandle(file);
+		return FALSE;
 	}
 
-	// Hex
-	if(PeekChar(lexer) == '0' && (PeekCharFar(lexer) == 'x' || PeekCharFar(lexer) == 'X'))
+	cache = (LPCSTR)MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+	if(!cache)
 	{
-		GetCharFar(lexer);
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return FALSE;
+	}
 
-		token->TypeEx |= NUMBER_HEX;
+	loaded = ReadTokenCache(lexer,tokens,cache,size.LowPart);
 
-		for(i = 0; ; ++i, GetChar(lexer))
-		{
-			if((PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9') || (PeekChar(lexer) >= 'A' && PeekChar(lexer) <= 'F') || (PeekChar(lexer) >= 'a' && PeekChar(lexer) <= 'f'))
-				AppendChar(&token->Value,(CHAR)PeekChar(lexer));
-			else
-			{
-				if(!strlen(token->Value.Buffer))
-					LexerError(lexer,"hex number must have at least one digit");
+	UnmapViewOfFile(cache);
+	CloseHandle(mapping);
+	CloseHandle(file);
 
-				break;
-			}
-		}
-	}
-	// Octal
-	else if(PeekChar(lexer) == '0' && PeekCharFar(lexer) != '.')	// TODO Floating point numbers may have more than one leading zero
+	return loaded;
+}
+
+BOOL ReadTokenCache(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR cache,ULONG size)
+{
+	LPTOKENCACHEHEADER header = (LPTOKENCACHEHEADER)cache;
+	const ULONGLONG* numbers;
+	const TOKENCACHEENTRY* entries;
+	const TOKENCACHEIDENTIFIER* spellings;
+	LPCSTR strings = NULL;
+	PULONG atoms = NULL;
+	ULONG number;
+	ULONG i;
+
+	if(header->Magic != TOKENCACHE_MAGIC || header->Version != TOKENCACHE_VERSION || header->InputLength != lexer->FileBufferLength || header->End > header->InputLength)
+		return FALSE;
+
+	// The sections must fill the file exactly, anything else is a stale or truncated cache
+	if(sizeof(TOKENCACHEHEADER) + (ULONGLONG)header->NumberCount * sizeof(ULONGLONG) + (ULONGLONG)header->TokenCount * sizeof(TOKENCACHEENTRY) + (ULONGLONG)header->IdentifierCount * sizeof(TOKENCACHEIDENTIFIER) + header->StringsLength != size)
+		return FALSE;
+
+	if(header->ConfigurationHash != HashConfiguration(lexer) || header->InputHash != HashData(0,lexer->FileBuffer,lexer->FileBufferLength))
+		return FALSE;
+
+	numbers = (const ULONGLONG*)(header + 1);
+	entries = (const TOKENCACHEENTRY*)(numbers + header->NumberCount);
+	spellings = (const TOKENCACHEIDENTIFIER*)(entries + header->TokenCount);
+
+	// Every entry is checked before anything is stored, a corrupt cache leaves the lexer, its atoms and the array as they were
+	for(i = 0; i < header->IdentifierCount; ++i)
+		if(spellings[i].Offset > header->InputLength || spellings[i].Length > header->InputLength - spellings[i].Offset)
+			return FALSE;
+
+	for(i = 0, number = 0; i < header->TokenCount; ++i)
 	{
-		//GetChar(lexer);	// WTF
+		const TOKENCACHEENTRY* entry = &entries[i];
+		ULONG type = entry->Type & ~TOKENCACHE_DECODED;
 
-		token->TypeEx |= NUMBER_OCTAL;
+		if(entry->Offset > header->InputLength || entry->Length > header->InputLength - entry->Offset)
+			return FALSE;
 
-		for(i = 0; ; ++i, GetChar(lexer))
+		if(entry->Type & TOKENCACHE_DECODED)
 		{
-			if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '7')
-				AppendChar(&token->Value,(CHAR)PeekChar(lexer));
-			else
-			{
-				if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
-					LexerError(lexer,"decimal digit in octal number");	
-				else if((PeekChar(lexer) >= 'a' && PeekChar(lexer) <= 'f') || (PeekChar(lexer) >= 'A' && PeekChar(lexer) <= 'F'))
-					LexerError(lexer,"hex digit in octal number");	
-
-				break;
-			}
+			if(entry->Value >= header->StringsLength || entry->Length >= header->StringsLength - entry->Value)
+				return FALSE;
+		}
+		else if(type == TOKEN_IDENTIFIER)
+		{
+			if(entry->Value >= header->IdentifierCount)
+				return FALSE;
 		}
+		else if(entry->Value > header->InputLength || entry->Length > header->InputLength - entry->Value)
+			return FALSE;
+
+		if(type == TOKEN_NUMBER && number++ == header->NumberCount)
+			return FALSE;
 	}
-	// Integer or Floating point
-	else
+
+	if(!ReserveTokenArray(tokens,header->TokenCount))
+		return FALSE;
+
+	// The view goes away when loading is done so decoded values are copied into the string blocks
+	if(header->StringsLength && !(strings = StoreString(lexer,(LPCSTR)(spellings + header->IdentifierCount),header->StringsLength)))
+		return FALSE;
+
+	// Identifiers are interned once each instead of once per token
+	if(lexer->Atoms && header->IdentifierCount)
 	{
-		ULONG dot = 0;
+		COUNT_ALLOCATION(header->IdentifierCount * sizeof(ULONG));
+		atoms = (PULONG)malloc(header->IdentifierCount * sizeof(ULONG));
+		if(!atoms)
+			return FALSE;
 
-		while(1)
+		for(i = 0; i < header->IdentifierCount; ++i)
 		{
-			if(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
+			if(!(atoms[i] = AddAtom(lexer->Atoms,lexer->FileBuffer + spellings[i].Offset,spellings[i].Length)))
 			{
+				free(atoms);
+				return FALSE;
 			}
-			else if(PeekChar(lexer) == '.')
-				dot++;
-			else
-				break;
-
-			AppendChar(&token->Value,(CHAR)GetChar(lexer));
 		}
+	}
 
-		// Scientific notation
-		if(PeekChar(lexer) == 'e' && !dot)
-			dot++;
+	for(i = 0, number = 0; i < header->TokenCount; ++i)
+	{
+		const TOKENCACHEENTRY* entry = &entries[i];
+		LPTOKEN token = &tokens->Tokens[tokens->Count + i];
 
-		// Floating point
-		if(dot == 1)
-		{
-			token->TypeEx |= NUMBER_FLOAT;
+		InitializeToken(token);
 
-			if(PeekChar(lexer) == 'e')
-			{
-				AppendChar(&token->Value,(CHAR)GetChar(lexer));
+		token->Location = lexer->FileBase + entry->Offset;
+		token->Length = entry->Length;
+		token->Type = entry->Type & ~TOKENCACHE_DECODED;
+		token->TypeEx = entry->TypeEx;
+		token->Flags = IsSpaceBefore(lexer,entry->Offset) ? TOKEN_SPACE : 0;
 
-				if(PeekChar(lexer) == '-' || PeekChar(lexer) == '+')
-					AppendChar(&token->Value,(CHAR)GetChar(lexer));
+		if(entry->Type & TOKENCACHE_DECODED)
+			token->Value = strings + entry->Value;
+		else if(token->Type == TOKEN_IDENTIFIER)
+		{
+			token->Value = lexer->FileBuffer + entry->Offset;
 
-				while(PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9')
-					AppendChar(&token->Value,(CHAR)GetChar(lexer));
-			}
+			if(atoms)
+				token->Atom = atoms[entry->Value];
 		}
-		else if(dot)
-			LexerError(lexer,"floating point number has more than one dot");
-		// Integer
 		else
-			token->TypeEx |= NUMBER_INTEGER;
+			token->Value = lexer->FileBuffer + entry->Value;
+
+		if(token->Type == TOKEN_NUMBER)
+			token->Integer = numbers[number++];
 	}
 
-	return ERROR_NONE;
+	if(atoms)
+		free(atoms);
+
+	tokens->Count += header->TokenCount;
+	lexer->FilePosition = header->End;
+
+	return TRUE;
 }
 
-ULONG ReadPunctuation(LPLEXER lexer,LPTOKEN token)
+BOOL TokenEqual(LPTOKEN token,LPCSTR string)
+{
+	return strlen(string) == token->Length && !memcmp(token->Value,string,token->Length);
+}
+
+BOOL TokenEqualNoCase(LPTOKEN token,LPCSTR string)
+{
+	return strlen(string) == token->Length && !_strnicmp(token->Value,string,token->Length);
+}
+
+LPSTR TokenDuplicate(LPTOKEN token)
+{
+	LPSTR string;
+
+	COUNT_ALLOCATION(token->Length + 1);
+	string = (LPSTR)malloc(token->Length + 1);
+	if(!string)
+		return NULL;
+
+	memcpy(string,token->Value,token->Length);
+	string[token->Length] = 0;
+
+	return string;
+}
+
+#ifdef LEXER_STATISTICS
+ULONGLONG GetLexerTicks(VOID)
+{
+	LARGE_INTEGER ticks;
+
+	QueryPerformanceCounter(&ticks);
+
+	return ticks.QuadPart;
+}
+
+VOID AddLexerStatistics(LPLEXERSTATISTICS statistics,LPLEXERSTATISTICS add)
 {
 	ULONG i;
 
-	for(i = 0; lexer->Punctuations[i].name; ++i)
-	{
-		ULONG j;
+	for(i = 0; i < sizeof(LEXERSTATISTICS) / sizeof(ULONGLONG); ++i)
+		((PULONGLONG)statistics)[i] += ((PULONGLONG)add)[i];
+}
 
-		for(j = 0; PeekCharEx(lexer,j) && lexer->Punctuations[i].name[j]; ++j)
-			if(PeekCharEx(lexer,j) != lexer->Punctuations[i].name[j])
-				break;
+VOID PrintLexerStatistics(LPLEXER lexer,FILE* stream)
+{
+	static LPCSTR names[TOKEN_TYPES] = {"none","punctuation","identifier","number","string","literal"};
+	LPLEXERSTATISTICS statistics = &lexer->Statistics;
+	LARGE_INTEGER frequency;
+	ULONG i;
 
-		// Have we gotten through the whole punctuation
-		if(!lexer->Punctuations[i].name[j])
-		{
-			GetCharEx(lexer,j - 1);
+	QueryPerformanceFrequency(&frequency);
+
+	// Allocations are counted for the whole process, everything else for this lexer
+	fprintf(stream,"{\n");
+	fprintf(stream,"\t\"bytes\": %llu,\n",statistics->Bytes);
+	fprintf(stream,"\t\"loads\": %llu,\n",statistics->Loads);
+	fprintf(stream,"\t\"checkpoints\": %llu,\n",statistics->Checkpoints);
+	fprintf(stream,"\t\"rewinds\": %llu,\n",statistics->Rewinds);
+	fprintf(stream,"\t\"warnings\": %llu,\n",statistics->Warnings);
+	fprintf(stream,"\t\"errors\": %llu,\n",statistics->Errors);
+	fprintf(stream,"\t\"allocations\": %ld,\n",LexerAllocations);
+	fprintf(stream,"\t\"allocationBytes\": %lld,\n",LexerAllocationBytes);
+	fprintf(stream,"\t\"tickFrequency\": %lld,\n",frequency.QuadPart);
+	fprintf(stream,"\t\"whitespaceTicks\": %llu,\n",statistics->WhitespaceTicks);
+	fprintf(stream,"\t\"tokens\": {\n");
+
+	for(i = 0; i < TOKEN_TYPES; ++i)
+		fprintf(stream,"\t\t\"%s\": { \"count\": %llu, \"ticks\": %llu }%s\n",names[i],statistics->Tokens[i],statistics->TokenTicks[i],i + 1 < TOKEN_TYPES ? "," : "");
+
+	fprintf(stream,"\t}\n");
+	fprintf(stream,"}\n");
+}
+#endif
+
+VOID LexerWarning(LPLEXER lexer,LPCSTR format,...)
+{
+	CHAR buffer[2048];
+	ULONG line;
+	ULONG column;
+    
+    va_list args;
+    va_start(args,format);
+	_vsnprintf(buffer,sizeof(buffer),format,args);
+    va_end(args);
 
-			token->LineNumber = lexer->LineNumber;
-			token->Type = TOKEN_PUNCTUATION;
-			token->TypeEx = lexer->Punctuations[i].id;
-			token->Value.Buffer = _strdup(lexer->Punctuations[i].name);
-			token->Value.Block = (ULONG)strlen(lexer->Punctuations[i].name) + 1;
+	++lexer->Diagnostics;
+	COUNT_STATISTIC(lexer,Warnings);
 
-			return ERROR_NONE;
-		}
-	}
+	if(lexer->Quiet)
+		return;
 
-	return ERROR_INVALID;
+	if(GetLocationLine(lexer,GetLexerLocation(lexer),&line,&column))
+		printf("%s(%u,%u): warning: %s.\n",lexer->FileName,line,column,buffer);
+	else
+		printf("%s: warning: %s.\n",lexer->FileName,buffer);
 }
 
-BOOL IsNumber(LPLEXER lexer)
+VOID LexerError(LPLEXER lexer,LPCSTR format,...)
 {
-	// Digits and decimal dot
-	if((PeekChar(lexer) >= '0' && PeekChar(lexer) <= '9') || (PeekChar(lexer) == '.' && PeekCharFar(lexer) >= '0' && PeekCharFar(lexer) <= '9'))
-		return TRUE;
+	CHAR buffer[2048];
+	ULONG line;
+	ULONG column;
+    
+    va_list args;
+    va_start(args,format);
+	_vsnprintf(buffer,sizeof(buffer),format,args);
+    va_end(args);
 
-	// Negative numbers
-	if(PeekChar(lexer) == '-' && ((PeekCharFar(lexer) >= '0' && PeekCharFar(lexer) <= '9') || (PeekCharFar(lexer) == '.' && (PeekCharEx(lexer,2) >= '0' && PeekCharEx(lexer,2) <= '9'))))
-		return TRUE;
+	++lexer->Diagnostics;
+	COUNT_STATISTIC(lexer,Errors);
 
-	// Positive numbers
-	if(PeekChar(lexer) == '+' && ((PeekCharFar(lexer) >= '0' && PeekCharFar(lexer) <= '9') || (PeekCharFar(lexer) == '.' && (PeekCharEx(lexer,2) >= '0' && PeekCharEx(lexer,2) <= '9'))))
-		return TRUE;
+	if(lexer->Quiet)
+		return;
 
-	return FALSE;
+	if(GetLocationLine(lexer,GetLexerLocation(lexer),&line,&column))
+		printf("%s(%u,%u): error: %s.\n",lexer->FileName,line,column,buffer);
+	else
+		printf("%s: error: %s.\n",lexer->FileName,buffer);
 }
 
-BOOL IsString(LPLEXER lexer)
+BOOL InitializeAtomTable(LPATOMTABLE atoms)
 {
-	// Single and double quotes
-	if(PeekChar(lexer) == '\"' || PeekChar(lexer) == '\'')
-		return TRUE;
+	memset(atoms,0,sizeof(ATOMTABLE));
+
+	return TRUE;
+}
+
+VOID UninitializeAtomTable(LPATOMTABLE atoms)
+{
+	free(atoms->Atoms);
+	free(atoms->Slots);
+	FreeStringBlocks(&atoms->Names);
 
-	return FALSE;
+	memset(atoms,0,sizeof(ATOMTABLE));
 }
 
-BOOL IsIdentifier(LPLEXER lexer)
+VOID SetAtomTable(LPLEXER lexer,LPATOMTABLE atoms)
+{
+	lexer->Atoms = atoms;
+}
+
+ULONG HashAtom(LPCSTR name,ULONG length)
 {
-	// Only letters and underscore
-	if((PeekChar(lexer) >= 'a' && PeekChar(lexer) <= 'z') || (PeekChar(lexer) >= 'A' && PeekChar(lexer) <= 'Z') || PeekChar(lexer) == '_')
-		return TRUE;
+	ULONG hash = 2166136261;
+	ULONG i;
+
+	// FNV-1a
+	for(i = 0; i < length; ++i)
+		hash = (hash ^ (BYTE)name[i]) * 16777619;
 
-	return FALSE;
+	return hash;
 }
 
-ULONG ReadToken(LPLEXER lexer,LPTOKEN token)
+BOOL GrowAtomTable(LPATOMTABLE atoms)
 {
-	ULONG error;
+	ULONG count = atoms->SlotCount ? atoms->SlotCount * 2 : ATOMTABLE_BLOCK;
+	PULONG slots;
+	ULONG i;
 
-	// Read inital whitespace up to token
-	if(error = ReadWhitespace(lexer))
-		return error;
+	COUNT_ALLOCATION(count * sizeof(ULONG));
+	slots = (PULONG)calloc(count,sizeof(ULONG));
+	if(!slots)
+		return FALSE;
 
-	// Number
-	if(IsNumber(lexer))
-	{
-		if(error = ReadNumber(lexer,token))
-			return error;
-	}
+	// Atom zero is never handed out
+	if(!atoms->Count)
+		atoms->Count = 1;
 
-	// String
-	else if(IsString(lexer))
+	for(i = 1; i < atoms->Count; ++i)
 	{
-		if(error = ReadString(lexer,token))
-			return error;
-	}
+		ULONG slot = atoms->Atoms[i].Hash & (count - 1);
 
-	// Identifier
-	else if(IsIdentifier(lexer))
-	{
-		if(error = ReadIdentifier(lexer,token))
-			return error;
-	}
+		while(slots[slot])
+			slot = (slot + 1) & (count - 1);
 
-	// Punctuation
-	else
-	{
-		if(error = ReadPunctuation(lexer,token))
-			return error;
+		slots[slot] = i;
 	}
 
-	return ERROR_NONE;
+	free(atoms->Slots);
+
+	atoms->Slots = slots;
+	atoms->SlotCount = count;
+
+	return TRUE;
 }
 
-ULONG ExpectTokenString(LPLEXER lexer,LPCSTR string)
+ULONG AddAtom(LPATOMTABLE atoms,LPCSTR name,ULONG length)
 {
-	ULONG error;
-	TOKEN token;
+	ULONG hash = HashAtom(name,length);
+	CHAR buffer[256];
+	LPSTR folded;
+	ULONG atom;
+	ULONG slot;
+	ULONG i;
 
-	InitializeToken(&token);
+	// Keep the hash at most half full
+	if((atoms->Count + 1) * 2 > atoms->SlotCount && !GrowAtomTable(atoms))
+		return 0;
 
-	if(error = ReadToken(lexer,&token))
+	for(slot = hash & (atoms->SlotCount - 1); atom = atoms->Slots[slot]; slot = (slot + 1) & (atoms->SlotCount - 1))
 	{
-		if(error != ERROR_EOF)
-			LexerError(lexer,"cound not find expected '%s'",string);
+		LPATOM entry = &atoms->Atoms[atom];
 
-		UninitializeToken(&token);
-		return error;
+		if(entry->Hash == hash && entry->Length == length && !memcmp(entry->Name,name,length))
+			return atom;
 	}
 
-	if(strcmp(token.Value.Buffer,string))
+	if(atoms->Count >= atoms->Capacity)
 	{
-		LexerError(lexer,"expected '%s' but found '%s'",string,token.Value);
-		UninitializeToken(&token);
-		return ERROR_INVALID;
-	}
-
-	UninitializeToken(&token);
-
-	return ERROR_NONE;
-}
+		ULONG capacity = atoms->Capacity ? atoms->Capacity * 2 : ATOMTABLE_BLOCK;
+		LPATOM entries;
 
-ULONG ExpectTokenType(LPLEXER lexer,ULONG type,ULONG typeex,LPTOKEN token)
-{
-	ULONG error;
-
-	if(error = ReadToken(lexer,token))
-	{
-		if(error != ERROR_EOF)
-			LexerError(lexer,"could not read expected token");
+		COUNT_ALLOCATION(capacity * sizeof(ATOM));
+		entries = (LPATOM)realloc(atoms->Atoms,capacity * sizeof(ATOM));
+		if(!entries)
+			return 0;
 
-		return error;
+		atoms->Atoms = entries;
+		atoms->Capacity = capacity;
 	}
 
-	if(token->Type != type)
-	{
-		LPCSTR typestring;
+	atom = atoms->Count;
 
-		switch(type)
-		{
-		case TOKEN_PUNCTUATION:
-			//typestring = "punctuation";
-			typestring = GetPunctuationName(lexer,typeex);
-			break;
+	atoms->Atoms[atom].Name = StoreStringBlock(&atoms->Names,name,length);
+	if(!atoms->Atoms[atom].Name)
+		return 0;
 
-		case TOKEN_IDENTIFIER:
-			typestring = "identifier";
-			break;
+	atoms->Atoms[atom].Length = length;
+	atoms->Atoms[atom].Hash = hash;
+	atoms->Atoms[atom].Folded = atom;
+	atoms->Atoms[atom].Data = NULL;
 
-		case TOKEN_NUMBER:
-			typestring = "number";
-			break;
+	atoms->Slots[slot] = atom;
+	++atoms->Count;
 
-		case TOKEN_STRING:
-			typestring = "string";
+	for(i = 0; i < length; ++i)
+		if(name[i] >= 'A' && name[i] <= 'Z')
 			break;
 
-		case TOKEN_LITERAL:
-			typestring = "literal";
-			break;
+	if(i == length)
+		return atom;
 
-		default:
-			typestring = "unknown";
-			break;
-		}
+	// The lower case spelling is an atom of its own
+	folded = length < sizeof(buffer) ? buffer : (LPSTR)malloc(length);
+	if(!folded)
+		return atom;
 
-		LexerError(lexer,"expected '%s' but found '%s'",typestring,token->Value);
-		return ERROR_INVALID;
-	}
+	for(i = 0; i < length; ++i)
+		folded[i] = name[i] >= 'A' && name[i] <= 'Z' ? name[i] - 'A' + 'a' : name[i];
 
-	if(typeex && token->TypeEx != typeex)
-	{
-		if(token->Type == TOKEN_PUNCTUATION)
-		{
-			LexerError(lexer,"expected '%s' but found '%s'",GetPunctuationName(lexer,typeex),token->Value);
-			return ERROR_INVALID;
-		}
-		else
-		{
-			LPCSTR typeexstring;
+	// The entries can move while the folded atom is added
+	i = AddAtom(atoms,folded,length);
+	if(i)
+		atoms->Atoms[atom].Folded = i;
 
-			switch(typeex)
-			{
-			case NUMBER_INTEGER:
-				typeexstring = "integer";
-				break;
+	if(folded != buffer)
+		free(folded);
 
-			case NUMBER_HEX:
-				typeexstring = "hex";
-				break;
+	return atom;
+}
 
-			case NUMBER_OCTAL:
-				typeexstring = "octal";
-				break;
+ULONG FindAtom(LPATOMTABLE atoms,LPCSTR name,ULONG length)
+{
+	ULONG hash = HashAtom(name,length);
+	ULONG atom;
+	ULONG slot;
 
-			case NUMBER_FLOAT:
-				typeexstring = "float";
-				break;
+	if(!atoms->SlotCount)
+		return 0;
 
-			default:
-				typeexstring = "unknown";
-				break;
-			}
+	for(slot = hash & (atoms->SlotCount - 1); atom = atoms->Slots[slot]; slot = (slot + 1) & (atoms->SlotCount - 1))
+	{
+		LPATOM entry = &atoms->Atoms[atom];
 
-			LexerError(lexer,"expected '%s' but found '%s'",typeexstring,token->Value);
-			return ERROR_INVALID;
-		}
+		if(entry->Hash == hash && entry->Length == length && !memcmp(entry->Name,name,length))
+			return atom;
 	}
 
-	return ERROR_NONE;
+	return 0;	// Not found
 }
 
-ULONG ExpectTokenAny(LPLEXER lexer,LPTOKEN token)
+LPCSTR GetAtomName(LPATOMTABLE atoms,ULONG atom)
 {
-	ULONG error;
+	if(!atom || atom >= atoms->Count)
+		return NULL;
 
-	if(error = ReadToken(lexer,token))
-	{
-		if(error != ERROR_EOF)
-			LexerError(lexer,"could not read expected token");
+	return atoms->Atoms[atom].Name;
+}
 
-		return error;
-	}
+ULONG GetAtomNoCase(LPATOMTABLE atoms,ULONG atom)
+{
+	if(!atom || atom >= atoms->Count)
+		return 0;
 
-	return ERROR_NONE;
+	return atoms->Atoms[atom].Folded;
 }
 
-ULONG PeekTokenString(LPLEXER lexer,LPCSTR string)
+LPVOID GetAtomData(LPATOMTABLE atoms,ULONG atom)
 {
-	LEXERSTATE state;
-	ULONG error;
-	TOKEN token;
+	if(!atom || atom >= atoms->Count)
+		return NULL;
 
-	StoreLexerState(lexer,&state);
+	return atoms->Atoms[atom].Data;
+}
 
-	InitializeToken(&token);
+VOID SetAtomData(LPATOMTABLE atoms,ULONG atom,LPVOID data)
+{
+	if(atom && atom < atoms->Count)
+		atoms->Atoms[atom].Data = data;
+}
 
-	if(error = ReadToken(lexer,&token))
-	{
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return error;
-	}
+ULONG HashKeyword(LPLEXER lexer,LPCSTR name,ULONG length)
+{
+	ULONG hash = 2166136261;
+	ULONG i;
 
-	if(strcmp(token.Value.Buffer,string))
+	// FNV-1a, over the lower case spelling if case does not matter
+	for(i = 0; i < length; ++i)
 	{
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return ERROR_INVALID;
-	}
+		BYTE chr = (BYTE)name[i];
 
-	UninitializeToken(&token);
+		if(lexer->KeywordsNoCase && chr >= 'A' && chr <= 'Z')
+			chr += 'a' - 'A';
 
-	RestoreLexerState(lexer,&state);
-	FreeLexerState(&state);
+		hash = (hash ^ chr) * 16777619;
+	}
 
-	return ERROR_NONE;
+	return hash;
 }
 
-ULONG PeekTokenType(LPLEXER lexer,ULONG type,ULONG typeex,LPTOKEN token)
+ULONG MixKeyword(ULONG hash,ULONG seed,ULONG range)
 {
-	LEXERSTATE state;
-	ULONG error;
+	hash ^= seed * 0x9E3779B9;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35;
+	hash ^= hash >> 16;
+
+	// Scale into the range without dividing
+	return (ULONG)(((ULONGLONG)hash * range) >> 32);
+}
 
-	StoreLexerState(lexer,&state);
+ULONG FindKeyword(LPLEXER lexer,LPCSTR name,ULONG length)
+{
+	ULONG hash;
+	ULONG index;
+	LPCSTR keyword;
 
-	if(error = ReadToken(lexer,token))
-	{
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return error;
-	}
+	if(length < lexer->KeywordLengthMinimum || length > lexer->KeywordLengthMaximum)
+		return KEYWORD_NONE;
 
-	if(token->Type != type)
-	{
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return ERROR_INVALID;
-	}
+	hash = HashKeyword(lexer,name,length);
+	index = lexer->KeywordSlots[MixKeyword(hash,lexer->KeywordSeeds[MixKeyword(hash,0,lexer->KeywordBuckets)],lexer->KeywordCount)];
 
-	if(typeex && token->TypeEx != typeex)
-	{
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return ERROR_INVALID;
-	}
+	// Every slot holds a keyword, the hash tells if it is the right one
+	if(lexer->KeywordHashes[index] != hash)
+		return KEYWORD_NONE;
 
-	RestoreLexerState(lexer,&state);
-	FreeLexerState(&state);
+	keyword = lexer->Keywords[index].name;
 
-	return ERROR_NONE;
+	if((lexer->KeywordsNoCase ? _strnicmp(keyword,name,length) : strncmp(keyword,name,length)) || keyword[length])
+		return KEYWORD_NONE;
+
+	return lexer->Keywords[index].id;
 }
 
-ULONG PeekTokenAny(LPLEXER lexer,LPTOKEN token)
+ULONG GetKeywordId(LPLEXER lexer,LPCSTR name)
 {
-	LEXERSTATE state;
-	ULONG error;
-
-	StoreLexerState(lexer,&state);
+	if(!lexer->KeywordCount)
+		return KEYWORD_NONE;
 
-	if(error = ReadToken(lexer,token))
-	{
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return error;
-	}
+	return FindKeyword(lexer,name,(ULONG)strlen(name));
+}
 
-	RestoreLexerState(lexer,&state);
-	FreeLexerState(&state);
+LPCSTR GetPunctuationName(LPLEXER lexer,ULONG id)
+{
+	if(id >= lexer->PunctuationIds)
+		return NULL;
 
-	return ERROR_NONE;
+	return lexer->PunctuationNames[id];
 }
 
-ULONG SkipTokenAny(LPLEXER lexer)
+ULONG GetPunctuationId(LPLEXER lexer,LPCSTR name)
 {
-	ULONG error;
-	TOKEN token;
+	ULONG node = lexer->PunctuationRoots[(BYTE)name[0]];
+	ULONG i;
 
-	InitializeToken(&token);
+	if(!name[0])
+		return PUNCTUATION_NONE;
 
-	error = ReadToken(lexer,&token);
+	// Follow the name down the trie
+	for(i = 1; node && name[i]; ++i)
+		for(node = lexer->PunctuationNodes[node].Child; node && lexer->PunctuationNodes[node].Character != name[i]; node = lexer->PunctuationNodes[node].Sibling);
 
-	UninitializeToken(&token);
-	return error;
+	if(!node || !lexer->PunctuationNodes[node].Punctuation)
+		return PUNCTUATION_NONE;
+
+	return lexer->Punctuations[lexer->PunctuationNodes[node].Punctuation - 1].id;
 }
 
-ULONG SkipTokenType(LPLEXER lexer,ULONG type,ULONG typeex)
+BOOL ReserveString(LPSTRING string,ULONG length)
 {
-	LEXERSTATE state;
-	ULONG error;
-	TOKEN token;
-
-	StoreLexerState(lexer,&state);
+	ULONG block;
+	LPSTR buffer;
 
-	InitializeToken(&token);
+	// Room for the terminating zero too
+	if(string->Length + length < string->Block)
+		return TRUE;
 
-	if(error = ReadToken(lexer,&token))
-	{
-		UninitializeToken(&token);
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return error;
-	}
+	for(block = string->Block ? string->Block * 2 : STRING_BLOCK; block <= string->Length + length; block *= 2);
 
-	if(token.Type != type)
-	{
-		UninitializeToken(&token);
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return ERROR_INVALID;
-	}
+	// Expand
+	COUNT_ALLOCATION(block);
+	buffer = (LPSTR)realloc(string->Buffer,block);
+	if(!buffer)
+		return FALSE;
 
-	if(typeex && token.TypeEx != typeex)
-	{
-		UninitializeToken(&token);
-		RestoreLexerState(lexer,&state);
-		FreeLexerState(&state);
-		return ERROR_INVALID;
-	}
+	string->Buffer = buffer;
+	string->Block = block;
 
-	UninitializeToken(&token);
-	FreeLexerState(&state);
-	return ERROR_NONE;
+	return TRUE;
 }
 
-VOID LexerWarning(LPLEXER lexer,LPCSTR format,...)
+BOOL AppendChar(LPSTRING string,CHAR chr)
 {
-	CHAR buffer[2048];
-    
-    va_list args;
-    va_start(args,format);
-	_vsnprintf(buffer,sizeof(buffer),format,args);
-    va_end(args);
+	if(string->Length + 1 >= string->Block && !ReserveString(string,1))
+		return FALSE;
 
-	printf("%s(%d): warning: %s.\n",lexer->FileName,lexer->LineNumber,buffer);
+	string->Buffer[string->Length++] = chr;
+	string->Buffer[string->Length] = 0;
+
+	return TRUE;
 }
 
-VOID LexerError(LPLEXER lexer,LPCSTR format,...)
+BOOL AppendString(LPSTRING string,LPCSTR chars,ULONG length)
 {
-	CHAR buffer[2048];
-    
-    va_list args;
-    va_start(args,format);
-	_vsnprintf(buffer,sizeof(buffer),format,args);
-    va_end(args);
+	if(!ReserveString(string,length))
+		return FALSE;
+
+	memcpy(string->Buffer + string->Length,chars,length);
+
+	string->Length += length;
+	string->Buffer[string->Length] = 0;
 
-	printf("%s(%d): error: %s.\n",lexer->FileName,lexer->LineNumber,buffer);
+	return TRUE;
 }
 
-LPCSTR GetPunctuationName(LPLEXER lexer,ULONG id)
+VOID ClearString(LPSTRING string)
 {
-	ULONG i;
-
-	for(i = 0; lexer->Punctuations[i].name; ++i)
-		if(lexer->Punctuations[i].id == id)
-			return lexer->Punctuations[i].name;
+	string->Length = 0;
 
-	return NULL;
+	if(string->Buffer)
+		string->Buffer[0] = 0;
 }
 
-ULONG GetPunctuationId(LPLEXER lexer,LPCSTR name)
+LPCSTR StoreString(LPLEXER lexer,LPCSTR string,ULONG length)
 {
-	ULONG i;
-
-	for(i = 0; lexer->Punctuations[i].name; ++i)
-		if(!strcmp(lexer->Punctuations[i].name,name))
-			return lexer->Punctuations[i].id;
+	return StoreStringBlock(&lexer->Strings,string,length);
+}
 
-	return PUNCTUATION_NONE;
+VOID FreeStrings(LPLEXER lexer)
+{
+	FreeStringBlocks(&lexer->Strings);
 }
 
-BOOL AppendChar(LPSTRING string,CHAR chr)
+LPCSTR StoreStringBlock(LPSTRINGBLOCK* blocks,LPCSTR string,ULONG length)
 {
-	ULONG length;
+	LPSTRINGBLOCK block = *blocks;
+	LPSTR value;
 
-	if(!string->Buffer)
+	if(!block || block->Size - block->Length < length + 1)
 	{
-		string->Buffer = (LPSTR)malloc(STRING_BLOCK);
-		if(!string->Buffer)
-			return FALSE;
+		ULONG size = max(STRINGBLOCK_SIZE,length + 1);
 
-		string->Buffer[0] = 0;
-		string->Block = STRING_BLOCK;
+		COUNT_ALLOCATION(sizeof(STRINGBLOCK) + size);
+		block = (LPSTRINGBLOCK)malloc(sizeof(STRINGBLOCK) + size);
+		if(!block)
+			return NULL;
+
+		block->Next = *blocks;
+		block->Length = 0;
+		block->Size = size;
+
+		*blocks = block;
 	}
 
-	length = (ULONG)strlen(string->Buffer);
-	if(string->Block == length + 1)
-	{
-		// Expand
-		LPSTR buffer = (LPSTR)malloc(string->Block + STRING_BLOCK);
-		if(!buffer)
-			return FALSE;
+	value = (LPSTR)(block + 1) + block->Length;
 
-		memcpy(buffer,string->Buffer,string->Block);
+	memcpy(value,string,length);
+	value[length] = 0;
 
-		free(string->Buffer);
+	block->Length += length + 1;
 
-		string->Buffer = buffer;
-		string->Block += STRING_BLOCK;
-	}
+	return value;
+}
+
+VOID FreeStringBlocks(LPSTRINGBLOCK* blocks)
+{
+	while(*blocks)
+	{
+		LPSTRINGBLOCK next = (*blocks)->Next;
 
-	string->Buffer[length] = chr;
-	string->Buffer[length + 1] = 0;
+		free(*blocks);
 
-	return TRUE;
-}
\ No newline at end of file
+		*blocks = next;
+	}
+}
@@ -27,6 +27,10 @@
 #define TOKEN_NUMBER		3
 #define TOKEN_STRING		4
 #define TOKEN_LITERAL		5
+#define TOKEN_TYPES			6	// One past the largest basic token type
+
+// Token flags
+#define TOKEN_SPACE			0x0001	// Whitespace or a comment comes right before the token
 
 // Number extended types
 #define NUMBER_INTEGER		1
@@ -42,6 +46,9 @@
 #define NUMBER_SIGN_MASK	0x80000000
 #define NUMBER_TYPE_MASK	0x7FFFFFFF
 
+#define NUMBER_FAST_EXPONENT	22		// Largest power of ten a double holds exactly
+#define NUMBER_FAST_MANTISSA	(1ULL << 53)	// Integers up to this a double holds exactly
+
 // Punctuation extended types/punctuation identifiers
 #define PUNCTUATION_NONE				0
 #define PUNCTUATION_RSHIFT_ASSIGN		1
@@ -96,6 +103,82 @@
 #define PUNCTUATION_PREPROCESSOR		50
 #define PUNCTUATION_DOLLAR				51
 
+// Identifier extended types/keyword identifiers, zero if the identifier is no keyword
+#define KEYWORD_NONE					0
+#define KEYWORD_ALIGNAS					1
+#define KEYWORD_ALIGNOF					2
+#define KEYWORD_ASM						3
+#define KEYWORD_AUTO					4
+#define KEYWORD_BOOL					5
+#define KEYWORD_BREAK					6
+#define KEYWORD_CASE					7
+#define KEYWORD_CATCH					8
+#define KEYWORD_CHAR					9
+#define KEYWORD_CHAR16_T				10
+#define KEYWORD_CHAR32_T				11
+#define KEYWORD_CLASS					12
+#define KEYWORD_CONST					13
+#define KEYWORD_CONSTEXPR				14
+#define KEYWORD_CONST_CAST				15
+#define KEYWORD_CONTINUE				16
+#define KEYWORD_DECLTYPE				17
+#define KEYWORD_DEFAULT					18
+#define KEYWORD_DELETE					19
+#define KEYWORD_DO						20
+#define KEYWORD_DOUBLE					21
+#define KEYWORD_DYNAMIC_CAST			22
+#define KEYWORD_ELSE					23
+#define KEYWORD_ENUM					24
+#define KEYWORD_EXPLICIT				25
+#define KEYWORD_EXPORT					26
+#define KEYWORD_EXTERN					27
+#define KEYWORD_FALSE					28
+#define KEYWORD_FLOAT					29
+#define KEYWORD_FOR						30
+#define KEYWORD_FRIEND					31
+#define KEYWORD_GOTO					32
+#define KEYWORD_IF						33
+#define KEYWORD_INLINE					34
+#define KEYWORD_INT						35
+#define KEYWORD_LONG					36
+#define KEYWORD_MUTABLE					37
+#define KEYWORD_NAMESPACE				38
+#define KEYWORD_NEW						39
+#define KEYWORD_NOEXCEPT				40
+#define KEYWORD_NULLPTR					41
+#define KEYWORD_OPERATOR				42
+#define KEYWORD_PRIVATE					43
+#define KEYWORD_PROTECTED				44
+#define KEYWORD_PUBLIC					45
+#define KEYWORD_REGISTER				46
+#define KEYWORD_REINTERPRET_CAST		47
+#define KEYWORD_RETURN					48
+#define KEYWORD_SHORT					49
+#define KEYWORD_SIGNED					50
+#define KEYWORD_SIZEOF					51
+#define KEYWORD_STATIC					52
+#define KEYWORD_STATIC_ASSERT			53
+#define KEYWORD_STATIC_CAST				54
+#define KEYWORD_STRUCT					55
+#define KEYWORD_SWITCH					56
+#define KEYWORD_TEMPLATE				57
+#define KEYWORD_THIS					58
+#define KEYWORD_THREAD_LOCAL			59
+#define KEYWORD_THROW					60
+#define KEYWORD_TRUE					61
+#define KEYWORD_TRY						62
+#define KEYWORD_TYPEDEF					63
+#define KEYWORD_TYPEID					64
+#define KEYWORD_TYPENAME				65
+#define KEYWORD_UNION					66
+#define KEYWORD_UNSIGNED				67
+#define KEYWORD_USING					68
+#define KEYWORD_VIRTUAL					69
+#define KEYWORD_VOID					70
+#define KEYWORD_VOLATILE				71
+#define KEYWORD_WCHAR_T					72
+#define KEYWORD_WHILE					73
+
 // Function result codes
 #define ERROR_NONE		0	// No error occured
 #define ERROR_INVALID	1	// Something is invalid in the input data
@@ -108,10 +191,35 @@ typedef struct
 	ULONG id;
 } PUNCTUATION, *LPPUNCTUATION;
 
+// This structure represents a node of the compiled punctuation trie
+typedef struct
+{
+	CHAR Character;
+	USHORT Child;		// First node one character further, zero if none
+	USHORT Sibling;		// Next node with the same prefix, zero if none
+	USHORT Punctuation;	// One past the punctuation list index if a punctuation ends here, zero otherwise
+} PUNCTUATIONNODE, *LPPUNCTUATIONNODE;
+
+// This structure represents a keyword in the keyword list
+typedef struct
+{
+	LPSTR name;
+	ULONG id;
+} KEYWORD, *LPKEYWORD;
+
 #define CPPCOMMENT "//"
 #define CPPMULTILINECOMMENTBEGIN "/*"
 #define CPPMULTILINECOMMENTEND "*/"
 
+#define ASMCOMMENT ";"
+#define ASMMULTILINECOMMENTBEGIN "<;"
+#define ASMMULTILINECOMMENTEND ";>"
+
+// Lexer profiles, configurations fixed at compile time that get scanners specialized for them
+#define LEXER_PROFILE_GENERIC	0	// Configured at runtime by InitializeLexer
+#define LEXER_PROFILE_CPP		1	// C++ punctuations and comments
+#define LEXER_PROFILE_ASM		2	// C++ punctuations and assembly comments
+
 // C++ punctuation list
 static PUNCTUATION CPPPUNCTUATIONS[] = 
 {
@@ -169,71 +277,389 @@ static PUNCTUATION CPPPUNCTUATIONS[] =
 	{NULL,PUNCTUATION_NONE}
 };
 
-#define STRING_BLOCK 32		// Size of string allocation blocks
+// C++ keyword list
+static KEYWORD CPPKEYWORDS[] =
+{
+	{"alignas",KEYWORD_ALIGNAS},
+	{"alignof",KEYWORD_ALIGNOF},
+	{"asm",KEYWORD_ASM},
+	{"auto",KEYWORD_AUTO},
+	{"bool",KEYWORD_BOOL},
+	{"break",KEYWORD_BREAK},
+	{"case",KEYWORD_CASE},
+	{"catch",KEYWORD_CATCH},
+	{"char",KEYWORD_CHAR},
+	{"char16_t",KEYWORD_CHAR16_T},
+	{"char32_t",KEYWORD_CHAR32_T},
+	{"class",KEYWORD_CLASS},
+	{"const",KEYWORD_CONST},
+	{"constexpr",KEYWORD_CONSTEXPR},
+	{"const_cast",KEYWORD_CONST_CAST},
+	{"continue",KEYWORD_CONTINUE},
+	{"decltype",KEYWORD_DECLTYPE},
+	{"default",KEYWORD_DEFAULT},
+	{"delete",KEYWORD_DELETE},
+	{"do",KEYWORD_DO},
+	{"double",KEYWORD_DOUBLE},
+	{"dynamic_cast",KEYWORD_DYNAMIC_CAST},
+	{"else",KEYWORD_ELSE},
+	{"enum",KEYWORD_ENUM},
+	{"explicit",KEYWORD_EXPLICIT},
+	{"export",KEYWORD_EXPORT},
+	{"extern",KEYWORD_EXTERN},
+	{"false",KEYWORD_FALSE},
+	{"float",KEYWORD_FLOAT},
+	{"for",KEYWORD_FOR},
+	{"friend",KEYWORD_FRIEND},
+	{"goto",KEYWORD_GOTO},
+	{"if",KEYWORD_IF},
+	{"inline",KEYWORD_INLINE},
+	{"int",KEYWORD_INT},
+	{"long",KEYWORD_LONG},
+	{"mutable",KEYWORD_MUTABLE},
+	{"namespace",KEYWORD_NAMESPACE},
+	{"new",KEYWORD_NEW},
+	{"noexcept",KEYWORD_NOEXCEPT},
+	{"nullptr",KEYWORD_NULLPTR},
+	{"operator",KEYWORD_OPERATOR},
+	{"private",KEYWORD_PRIVATE},
+	{"protected",KEYWORD_PROTECTED},
+	{"public",KEYWORD_PUBLIC},
+	{"register",KEYWORD_REGISTER},
+	{"reinterpret_cast",KEYWORD_REINTERPRET_CAST},
+	{"return",KEYWORD_RETURN},
+	{"short",KEYWORD_SHORT},
+	{"signed",KEYWORD_SIGNED},
+	{"sizeof",KEYWORD_SIZEOF},
+	{"static",KEYWORD_STATIC},
+	{"static_assert",KEYWORD_STATIC_ASSERT},
+	{"static_cast",KEYWORD_STATIC_CAST},
+	{"struct",KEYWORD_STRUCT},
+	{"switch",KEYWORD_SWITCH},
+	{"template",KEYWORD_TEMPLATE},
+	{"this",KEYWORD_THIS},
+	{"thread_local",KEYWORD_THREAD_LOCAL},
+	{"throw",KEYWORD_THROW},
+	{"true",KEYWORD_TRUE},
+	{"try",KEYWORD_TRY},
+	{"typedef",KEYWORD_TYPEDEF},
+	{"typeid",KEYWORD_TYPEID},
+	{"typename",KEYWORD_TYPENAME},
+	{"union",KEYWORD_UNION},
+	{"unsigned",KEYWORD_UNSIGNED},
+	{"using",KEYWORD_USING},
+	{"virtual",KEYWORD_VIRTUAL},
+	{"void",KEYWORD_VOID},
+	{"volatile",KEYWORD_VOLATILE},
+	{"wchar_t",KEYWORD_WCHAR_T},
+	{"while",KEYWORD_WHILE},
+	{NULL,KEYWORD_NONE}
+};
+
+#define STRING_BLOCK 32		// Size of the first string allocation, later ones double it
 
 // This Structure represents a string object
 typedef struct
 {
 	LPSTR Buffer;
-	ULONG Block;
+	ULONG Length;
+	ULONG Block;	// Allocated size of the buffer
 } STRING, *LPSTRING;
 
-// This structure represents a token
+// This structure represents a token, the value stays valid until the input is unloaded
 typedef struct
 {
-	STRING Value;
-	ULONG LineNumber;
+	LPCSTR Value;		// Not zero terminated, points into the input or into the lexer string blocks
+	ULONG Length;
+	ULONG Location;		// File base of the input plus the offset of the first character, see GetLocationLine
+	ULONG Atom;			// Interned identifier, zero for other tokens or when the lexer has no atom table
 	//ULONG LineSpan;	// Used to count number of lines a multiline string span over
 	ULONG Type;
 	ULONG TypeEx;
+	ULONG Flags;
+	union
+	{
+		ULONGLONG Integer;	// Value of integer numbers without the sign, saturated if too large
+		double Float;		// Value of floating point numbers without the sign
+	};
 } TOKEN, *LPTOKEN;
 
-#define FILE_BLOCK 4096		// Size of file allocation blocks
+#define TOKENARRAY_BLOCK 1024	// Inital number of entries in a token array
+
+// This structure represents an input lexed in advance, members should not be accessed directly
+typedef struct
+{
+	LPTOKEN Tokens;
+	ULONG Count;
+	ULONG Capacity;
+	ULONG Position;		// Index of the next token
+} TOKENARRAY, *LPTOKENARRAY;
+
+#define RELEX_LOOKAHEAD 16	// More than the lexer ever looks past the end of a token to decide where it ends
+
+// This structure describes the part of a token array replaced after an edit
+typedef struct
+{
+	ULONG First;		// Index of the first replaced token
+	ULONG Removed;		// Number of old tokens replaced
+	ULONG Inserted;		// Number of new tokens in their place
+} TOKENCHANGE, *LPTOKENCHANGE;
+
+#define FILE_PADDING 32		// Number of zero bytes guaranteed after the end of the input
+
+// Character classes
+#define CHAR_IDENTIFIER_START	0x0001	// Can start an identifier
+#define CHAR_IDENTIFIER			0x0002	// Can continue an identifier
+#define CHAR_DIGIT				0x0004
+#define CHAR_HEX_DIGIT			0x0008
+#define CHAR_OCTAL_DIGIT		0x0010
+#define CHAR_NUMBER				0x0020	// Can start a number (digits, dot and sign)
+#define CHAR_WHITESPACE			0x0040
+#define CHAR_NEWLINE			0x0080
+#define CHAR_QUOTE				0x0100
+#define CHAR_PUNCTUATION		0x0200	// Can start a punctuation
+#define CHAR_COMMENT			0x0400	// Can start a comment
+
+#define STRINGBLOCK_SIZE 65536	// Size of the blocks holding decoded string values
+
+// This structure represents a block of decoded string values, the characters follow the header
+typedef struct _STRINGBLOCK
+{
+	struct _STRINGBLOCK* Next;
+	ULONG Length;
+	ULONG Size;
+} STRINGBLOCK, *LPSTRINGBLOCK;
+
+#define ATOMTABLE_BLOCK 1024	// Initial number of hash slots in an atom table
+
+// This structure represents an interned identifier
+typedef struct
+{
+	LPCSTR Name;		// Zero terminated, stays valid until the atom table is uninitialized
+	ULONG Length;
+	ULONG Hash;
+	ULONG Folded;		// Atom of the lower case spelling, the atom itself if it has no upper case characters
+	LPVOID Data;		// Free for the user of the table
+} ATOM, *LPATOM;
+
+// This structure represents a table of interned identifiers, members should not be accessed directly
+typedef struct
+{
+	LPATOM Atoms;		// Indexed by atom, atom zero is unused
+	ULONG Count;
+	ULONG Capacity;
+	PULONG Slots;		// Open addressed hash of the atoms, zero if empty
+	ULONG SlotCount;	// Always a power of two
+	LPSTRINGBLOCK Names;
+} ATOMTABLE, *LPATOMTABLE;
+
+// Statistics, define LEXER_STATISTICS to count what each lexer does, it implies LEXER_COUNT_ALLOCATIONS
+#if defined(LEXER_STATISTICS) && !defined(LEXER_COUNT_ALLOCATIONS)
+#define LEXER_COUNT_ALLOCATIONS
+#endif
+
+// Allocation counting, define LEXER_COUNT_ALLOCATIONS to count every allocation the lexer makes
+#ifdef LEXER_COUNT_ALLOCATIONS
+extern LONG LexerAllocations;
+extern LONGLONG LexerAllocationBytes;
+#define COUNT_ALLOCATION(size) (InterlockedIncrement(&LexerAllocations),InterlockedExchangeAdd64(&LexerAllocationBytes,(LONGLONG)(size)))
+#else
+#define COUNT_ALLOCATION(size)
+#endif
+
+#ifdef LEXER_STATISTICS
+// This structure holds the counters of a lexer, every member is a ULONGLONG so they can be added up as an array
+typedef struct
+{
+	ULONGLONG Bytes;					// Input characters moved over, whitespace and tokens
+	ULONGLONG Loads;					// Inputs loaded, the whole input is read at once so there are no refills
+	ULONGLONG Checkpoints;
+	ULONGLONG Rewinds;
+	ULONGLONG Warnings;
+	ULONGLONG Errors;
+	ULONGLONG WhitespaceTicks;			// Time spent on whitespace and comments in performance counter ticks
+	ULONGLONG Tokens[TOKEN_TYPES];		// Tokens read by type, failed reads count as TOKEN_NONE
+	ULONGLONG TokenTicks[TOKEN_TYPES];	// Time spent reading tokens by type in performance counter ticks
+} LEXERSTATISTICS, *LPLEXERSTATISTICS;
+
+#define COUNT_STATISTIC(lexer,member) (++(lexer)->Statistics.member)
+#else
+#define COUNT_STATISTIC(lexer,member)
+#endif
+
+// Vector instruction sets used to scan the input
+#define SIMD_NONE	0
+#define SIMD_SSE2	1	// 16 bytes at a time
+#define SIMD_AVX2	2	// 32 bytes at a time, the input padding must cover a whole load
+
+// Scans over runs of characters
+#define SCAN_WHITESPACE	0	// Up to the first character that is not whitespace
+#define SCAN_LINE		1	// Up to the end of the line
+#define SCAN_COMMENT	2	// Up to a possible multi-line comment begin or end
+#define SCAN_STRING		3	// Up to a double quote, backslash or end of the line
+#define SCAN_LITERAL	4	// Up to a single quote, backslash or end of the line
+#define SCAN_DIRECTIVE	5	// Up to a number sign, quote or comment begin
+#define SCAN_LOGICALLINE	6	// Up to the end of the line, a quote or comment begin
+
+// Input backends
+#define INPUT_NONE		0
+#define INPUT_MAPPED	1	// Read-only view of the whole file
+#define INPUT_HEAP		2	// Whole file read into a heap buffer
+#define INPUT_BUFFER	3	// Caller owned memory, used in place
+#define INPUT_STREAM	4	// Pipe or device read to its end into the stream buffer
+
+#define STREAM_BLOCK (1024 * 1024)	// Least number of bytes asked for by every read from a stream
 
 // This structure represents a lexer object, members should not be accessed directly
 typedef struct
 {
-	FILE* File;
+	HANDLE File;
+	HANDLE FileMapping;
 	LPSTR FileName;
-	LPSTR FileBuffer;
+	LPCSTR FileBuffer;	// Whole input, followed by at least FILE_PADDING zero bytes
 	ULONG FileBufferLength;
 	ULONG FilePosition;
+	ULONG FileInput;
+	LPSTR StreamBuffer;		// Kept between stream inputs so reading them allocates only when one is larger
+	ULONG StreamBufferSize;
+
+	ULONG FileBase;		// Location of the first input character, inputs sharing locations get disjoint ranges
+	PULONG Lines;		// Offsets of the line starts, built when a location is first turned into a line
+	ULONG LineCount;
+
+	BOOL Quiet;			// Count diagnostics instead of printing them
+	ULONG Diagnostics;	// Number of warnings and errors so far
 
-	ULONG LineNumber;
+	LPSTRINGBLOCK Strings;	// Values of strings that differ from their input text
+	LPATOMTABLE Atoms;		// Identifiers are interned here when set
+	STRING Scratch;			// Reused while decoding a string value
+
+	USHORT Characters[256];	// Character classes, indexed by the unsigned character
+	ULONG Simd;				// Instruction set used by the scanning functions
 
 	LPPUNCTUATION Punctuations;
+	LPPUNCTUATIONNODE PunctuationNodes;	// Trie of the punctuation list, node zero is unused
+	USHORT PunctuationRoots[256];		// First trie node of each character, zero if none
+	LPCSTR* PunctuationNames;			// Punctuation names indexed by id
+	ULONG PunctuationIds;				// One past the largest punctuation id
+
+	LPKEYWORD Keywords;
+	BOOL KeywordsNoCase;			// Keywords match regardless of case
+	PUSHORT KeywordSeeds;			// Perfect hash seed of each bucket
+	PUSHORT KeywordSlots;			// Keyword list index of each hash slot
+	PULONG KeywordHashes;			// Hash of each keyword, indexed like the keyword list
+	ULONG KeywordCount;
+	ULONG KeywordBuckets;
+	ULONG KeywordLengthMinimum;		// Shorter and longer identifiers are never hashed
+	ULONG KeywordLengthMaximum;
+
 	CHAR Comment[2];
 	CHAR MultilineCommentBegin[2];
 	CHAR MultilineCommentEnd[2];
+	ULONG Profile;		// Selects the scanners specialized for the configuration
+
+#ifdef LEXER_STATISTICS
+	LEXERSTATISTICS Statistics;
+#endif
 } LEXER, *LPLEXER;
 
-// This structure represents a lexer stream, members should not be accessed directly
+// This structure represents a position in the lexer input, members should not be accessed directly
 typedef struct
 {
-	LONGLONG FilePointer;
-	LPSTR FileBuffer;
-	ULONG FileBufferLength;
 	ULONG FilePosition;
+} LEXERCHECKPOINT,*LPLEXERCHECKPOINT;
+
+#define PARALLEL_CHUNK_MINIMUM	(1024 * 1024)	// Inputs are not split into chunks smaller than this
+#define PARALLEL_THREADS_MAXIMUM	64
+
+#define CHUNK_CLEAN 0xFFFFFFFF	// No diagnostic was reported in the chunk
+
+// This structure represents a part of the input lexed speculatively on a worker thread
+typedef struct
+{
+	LEXER Lexer;		// Private copy sharing the input and tables of the main lexer
+	TOKENARRAY Tokens;
+	ULONG End;			// Tokens starting here or later belong to the next chunk
+	ULONG Diagnostic;	// Number of tokens the last diagnostic belongs after, counting the one being read
+	ULONG Error;
+	ULONG StopOffset;	// Where the next token starts, or where the input ended
+} LEXERCHUNK, *LPLEXERCHUNK;
+
+#define TOKENCACHE_MAGIC	0x4B4F5458	// "XTOK"
+#define TOKENCACHE_VERSION	1
+#define TOKENCACHE_DECODED	0x80000000	// Set in the cached type when the value is in the string section
 
-	ULONG LineNumber;
-} LEXERSTATE,*LPLEXERSTATE;
+// This structure represents the header of a token cache file, the sections follow in the order of their counts
+typedef struct
+{
+	ULONG Magic;
+	ULONG Version;
+	ULONGLONG InputHash;			// Hash of the input text
+	ULONGLONG ConfigurationHash;	// Hash of the punctuation list, keyword list and comment markers
+	ULONG InputLength;
+	ULONG End;						// Where lexing stopped
+	ULONG NumberCount;				// Decoded number values, 64 bits each
+	ULONG TokenCount;				// TOKENCACHEENTRY per token
+	ULONG IdentifierCount;			// TOKENCACHEIDENTIFIER per distinct identifier
+	ULONG StringsLength;			// Decoded string values, each zero terminated
+} TOKENCACHEHEADER, *LPTOKENCACHEHEADER;
+
+// This structure represents a cached token
+typedef struct
+{
+	ULONG Offset;	// Input offset of the first character
+	ULONG Length;
+	ULONG Value;	// Identifier index for identifiers, string section offset for decoded strings, input offset otherwise
+	ULONG Type;
+	ULONG TypeEx;
+} TOKENCACHEENTRY, *LPTOKENCACHEENTRY;
+
+// This structure represents a cached identifier, interned once however many tokens spell it
+typedef struct
+{
+	ULONG Offset;	// Input offset of the first occurrence
+	ULONG Length;
+} TOKENCACHEIDENTIFIER, *LPTOKENCACHEIDENTIFIER;
 
 // Initialization functions
-BOOL InitializeLexer(LPLEXER lexer,LPPUNCTUATION punctuations,LPSTR comment,LPCSTR multilineCommentBegin,LPCSTR multilineCommentEnd);
+BOOL InitializeLexer(LPLEXER lexer,LPPUNCTUATION punctuations,LPKEYWORD keywords,BOOL keywordsNoCase,LPSTR comment,LPCSTR multilineCommentBegin,LPCSTR multilineCommentEnd);
+BOOL InitializeLexerProfile(LPLEXER lexer,ULONG profile,LPKEYWORD keywords,BOOL keywordsNoCase);
 VOID UninitializeLexer(LPLEXER lexer);
 
+// Internal initialization functions
+VOID InitializeCharacters(LPLEXER lexer);
+BOOL InitializePunctuations(LPLEXER lexer);
+BOOL InitializeKeywords(LPLEXER lexer);
+
 BOOL InitializeToken(LPTOKEN token);
 VOID UninitializeToken(LPTOKEN token);
 BOOL ResetToken(LPTOKEN token);
 
 // Input stream funtions
 BOOL LoadFile(LPLEXER lexer,LPCSTR path);
+BOOL LoadBuffer(LPLEXER lexer,LPCSTR buffer,ULONG length,BOOL padded,LPCSTR name);
+BOOL LoadStream(LPLEXER lexer,HANDLE stream,LPCSTR name);
 VOID UnloadFile(LPLEXER lexer);
 
-// Lexer state functions
-BOOL StoreLexerState(LPLEXER lexer,LPLEXERSTATE state);
-BOOL RestoreLexerState(LPLEXER lexer,LPLEXERSTATE state);
-VOID FreeLexerState(LPLEXERSTATE state);
+// Internal input functions
+BOOL MapFile(LPLEXER lexer,ULONG size);
+BOOL ReadWholeFile(LPLEXER lexer,ULONG size);
+BOOL ReadStream(LPLEXER lexer,HANDLE stream);
+VOID ReleaseInput(LPCSTR buffer,ULONG input,HANDLE mapping);
+
+// Source location functions
+VOID SetFileBase(LPLEXER lexer,ULONG base);
+ULONG GetLexerLocation(LPLEXER lexer);
+BOOL GetLocationLine(LPLEXER lexer,ULONG location,PULONG line,PULONG column);
+BOOL IsLineStartAt(LPLEXER lexer,ULONG offset);
+BOOL IsSpaceBefore(LPLEXER lexer,ULONG offset);
+
+// Internal source location functions
+BOOL BuildLineTable(LPLEXER lexer);
+
+// Lexer checkpoint functions
+VOID CheckpointLexer(LPLEXER lexer,LPLEXERCHECKPOINT checkpoint);
+VOID RewindLexer(LPLEXER lexer,LPLEXERCHECKPOINT checkpoint);
 
 // Token stream functions
 ULONG ExpectTokenString(LPLEXER lexer,LPCSTR string);
@@ -245,17 +671,94 @@ ULONG PeekTokenAny(LPLEXER lexer,LPTOKEN token);
 ULONG SkipTokenType(LPLEXER lexer,ULONG type,ULONG typeex);
 ULONG SkipTokenAny(LPLEXER lexer);
 
+// Token value functions
+BOOL TokenEqual(LPTOKEN token,LPCSTR string);
+BOOL TokenEqualNoCase(LPTOKEN token,LPCSTR string);
+LPSTR TokenDuplicate(LPTOKEN token);
+
+// Token array functions
+BOOL InitializeTokenArray(LPTOKENARRAY tokens);
+VOID UninitializeTokenArray(LPTOKENARRAY tokens);
+ULONG TokenizeFile(LPLEXER lexer,LPTOKENARRAY tokens);
+ULONG TokenizeFileParallel(LPLEXER lexer,LPTOKENARRAY tokens,ULONG threads);
+LPTOKEN PeekTokenEntry(LPTOKENARRAY tokens,ULONG ahead);
+LPTOKEN NextTokenEntry(LPTOKENARRAY tokens);
+ULONG GetTokenArrayPosition(LPTOKENARRAY tokens);
+VOID SetTokenArrayPosition(LPTOKENARRAY tokens,ULONG position);
+
+// Internal token array functions
+BOOL ReserveTokenArray(LPTOKENARRAY tokens,ULONG count);
+BOOL AppendTokenEntry(LPTOKENARRAY tokens,LPTOKEN token);
+ULONG EndTokenizing(ULONG error);
+ULONG TokenizeRange(LPLEXER lexer,LPTOKENARRAY tokens,ULONG end);
+ULONG FindTokenEntry(LPLEXER lexer,LPTOKENARRAY tokens,ULONG offset);
+BOOL IsInputValue(LPCSTR buffer,ULONG length,LPTOKEN token);
+DWORD WINAPI TokenizeChunk(LPVOID parameter);
+
+// Incremental lexing functions
+ULONG RelexTokenArray(LPLEXER lexer,LPTOKENARRAY tokens,ULONG offset,ULONG removed,LPCSTR inserted,ULONG length,LPTOKENCHANGE change);
+
+// Skip mode functions
+ULONG SkipToDirective(LPLEXER lexer);
+ULONG SkipToLineEnd(LPLEXER lexer);
+
+// Internal skip mode functions
+LPCSTR SkipSpan(LPLEXER lexer,LPCSTR chars);
+
+// Token cache functions
+ULONG TokenizeFileCached(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR path);
+BOOL LoadTokenCache(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR path);
+BOOL SaveTokenCache(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR path);
+
+// Internal token cache functions
+ULONGLONG HashData(ULONGLONG hash,LPCVOID data,ULONG length);
+ULONGLONG HashConfiguration(LPLEXER lexer);
+BOOL ReadTokenCache(LPLEXER lexer,LPTOKENARRAY tokens,LPCSTR cache,ULONG size);
+
+// Atom table functions
+BOOL InitializeAtomTable(LPATOMTABLE atoms);
+VOID UninitializeAtomTable(LPATOMTABLE atoms);
+VOID SetAtomTable(LPLEXER lexer,LPATOMTABLE atoms);
+ULONG AddAtom(LPATOMTABLE atoms,LPCSTR name,ULONG length);
+ULONG FindAtom(LPATOMTABLE atoms,LPCSTR name,ULONG length);
+LPCSTR GetAtomName(LPATOMTABLE atoms,ULONG atom);
+ULONG GetAtomNoCase(LPATOMTABLE atoms,ULONG atom);
+LPVOID GetAtomData(LPATOMTABLE atoms,ULONG atom);
+VOID SetAtomData(LPATOMTABLE atoms,ULONG atom,LPVOID data);
+
+// Internal atom table functions
+ULONG HashAtom(LPCSTR name,ULONG length);
+BOOL GrowAtomTable(LPATOMTABLE atoms);
+
 // Punctuation list helper functions
 LPCSTR GetPunctuationName(LPLEXER lexer,ULONG id);
 ULONG GetPunctuationId(LPLEXER lexer,LPCSTR name);
 
+// Keyword list helper functions
+ULONG GetKeywordId(LPLEXER lexer,LPCSTR name);
+
+// Internal keyword functions
+ULONG HashKeyword(LPLEXER lexer,LPCSTR name,ULONG length);
+ULONG MixKeyword(ULONG hash,ULONG seed,ULONG range);
+ULONG FindKeyword(LPLEXER lexer,LPCSTR name,ULONG length);
+
+// Internal scanning functions
+ULONG DetectSimd(VOID);
+ULONG CountBits(ULONG bits);
+ULONG ScanBlock(LPLEXER lexer,LPCSTR chars,ULONG scan,PULONG stop);
+LPCSTR ScanChars(LPLEXER lexer,LPCSTR chars,ULONG scan);
+LPCSTR ScanComment(LPLEXER lexer,LPCSTR chars,CHAR begin,CHAR end);
+
 // Internal functions
 ULONG ReadWhitespace(LPLEXER lexer);
+ULONG ReadWhitespaceEx(LPLEXER lexer,LPCSTR comment,LPCSTR multilineCommentBegin,LPCSTR multilineCommentEnd);
 ULONG ReadEscapeSequence(LPLEXER lexer,PCHAR sequence);
 ULONG ReadString(LPLEXER lexer,LPTOKEN token);
 ULONG ReadIdentifier(LPLEXER lexer,LPTOKEN token);
 ULONG ReadNumber(LPLEXER lexer,LPTOKEN token);
+double ConvertFloat(LPLEXER lexer,LPCSTR chars,ULONG length,ULONGLONG mantissa,LONG exponent,BOOL exact);
 ULONG ReadPunctuation(LPLEXER lexer,LPTOKEN token);
+ULONG ReadTokenValue(LPLEXER lexer,LPTOKEN token);
 ULONG ReadToken(LPLEXER lexer,LPTOKEN token);
 
 // Internal parsing functions
@@ -263,6 +766,15 @@ BOOL IsNumber(LPLEXER lexer);
 BOOL IsString(LPLEXER lexer);
 BOOL IsIdentifier(LPLEXER lexer);
 
+#ifdef LEXER_STATISTICS
+// Statistics functions
+VOID PrintLexerStatistics(LPLEXER lexer,FILE* stream);
+
+// Internal statistics functions
+ULONGLONG GetLexerTicks(VOID);
+VOID AddLexerStatistics(LPLEXERSTATISTICS statistics,LPLEXERSTATISTICS add);
+#endif
+
 // Internal error reporting functions
 VOID LexerWarning(LPLEXER lexer,LPCSTR format,...);
 VOID LexerError(LPLEXER lexer,LPCSTR format,...);
@@ -270,4 +782,11 @@ VOID LexerError(LPLEXER lexer,LPCSTR format,...);
 // Internal string manipulation functions
 BOOL InitializeString(LPSTRING string);
 VOID UninitializeString(LPSTRING string);
-BOOL AppendChar(LPSTRING string,CHAR chr);
\ No newline at end of file
+BOOL AppendChar(LPSTRING string,CHAR chr);
+BOOL AppendString(LPSTRING string,LPCSTR chars,ULONG length);
+BOOL ReserveString(LPSTRING string,ULONG length);
+VOID ClearString(LPSTRING string);
+LPCSTR StoreString(LPLEXER lexer,LPCSTR string,ULONG length);
+VOID FreeStrings(LPLEXER lexer);
+LPCSTR StoreStringBlock(LPSTRINGBLOCK* blocks,LPCSTR string,ULONG length);
+VOID FreeStringBlocks(LPSTRINGBLOCK* blocks);
\ No newline at end of file
@@ -1,142 +1,484 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <windows.h>
+#include <psapi.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "Lexer.h"
 
-//#define _NO_OUTPUT
+// Lexer benchmark
+//
+// Usage: Lexer [-runs count] [-size megabytes] [-threads count] [-cache] [-stats] [-asm] [file ...]
+//
+// Without files a synthetic corpus of each kind is generated into a temporary file
+// and lexed, otherwise the given files are. Every input is lexed the given number
+// of times and the best and average throughput is reported. With -threads the input
+// is lexed into a token array in parallel, zero threads means one per processor.
+// With -cache the first run saves the token array into a token cache next to the
+// input and the later runs load it from there. With -stats the lexer statistics of
+// the last run of every input are printed as JSON, the lexer must be built with
+// LEXER_STATISTICS for that. The memory reported is how much the working set grew
+// during the first run of every input.
+
+// Allocations are only counted when the lexer is built with LEXER_COUNT_ALLOCATIONS
+#ifndef LEXER_COUNT_ALLOCATIONS
+static LONG LexerAllocations = 0;
+#endif
+
+#define DEFAULT_RUNS	5
+#define DEFAULT_SIZE	16		// Megabytes per synthetic corpus
+
+// Synthetic corpus kinds
+#define CORPUS_IDENTIFIERS	0
+#define CORPUS_PUNCTUATIONS	1
+#define CORPUS_COMMENTS		2
+#define CORPUS_STRINGS		3
+#define CORPUS_NUMBERS		4
+#define CORPUS_COUNT		5
 
-int main(void)
+static LPCSTR CORPUSNAMES[CORPUS_COUNT] =
 {
-	LPCSTR source = "D:\\Irssi.txt";
-	LPCSTR destination = "D:\\IrssiProcessed.txt";
-	LARGE_INTEGER start,end,frequency;
-	LEXER lexer;
-	FILE* file;
+	"identifiers",
+	"punctuation",
+	"comments",
+	"strings",
+	"numbers",
+};
+
+// This structure holds the results of benchmarking one input
+typedef struct
+{
+	ULONG Bytes;
+	ULONG Tokens;
+	ULONG Allocations;
+	ULONG Errors;
+	SIZE_T Memory;	// Working set the first run grew by
+	double Best;	// Fastest run in seconds
+	double Total;	// All runs together in seconds
+} BENCHMARK, *LPBENCHMARK;
+
+static ULONG Seed = 1;
+
+ULONG Random(ULONG range)
+{
+	// Same sequence on every run and every machine
+	Seed = Seed * 1103515245 + 12345;
 
-#ifndef _NO_OUTPUT
-	file = fopen(destination,"w");
-	if(!file)
-		return 1;
-#endif
+	return (Seed >> 16) % range;
+}
 
-	InitializeLexer(&lexer,CPPPUNCTUATIONS,CPPCOMMENT,CPPMULTILINECOMMENTBEGIN,CPPMULTILINECOMMENTEND);
-	//InitializeLexer(&lexer,CPPPUNCTUATIONS,";","<*","*>");
+ULONG GenerateIdentifier(LPSTR line)
+{
+	static const CHAR first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	static const CHAR rest[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+	ULONG length = 1 + Random(16);
+	ULONG i;
 
-	if(!LoadFile(&lexer,source))
-	{
-		UninitializeLexer(&lexer);
-		return 1;
-	}
+	line[0] = first[Random(sizeof(first) - 1)];
 
-	QueryPerformanceCounter(&start);
+	for(i = 1; i < length; ++i)
+		line[i] = rest[Random(sizeof(rest) - 1)];
 
-	while(1)
-	{
-		TOKEN token;
+	return length;
+}
 
-		InitializeToken(&token);
+ULONG GenerateLine(LPSTR line,ULONG kind,BOOL assembly)
+{
+	ULONG length = 0;
+	ULONG i;
 
-		if(ExpectTokenAny(&lexer,&token))
-			break;
+	switch(kind)
+	{
+	case CORPUS_IDENTIFIERS:
+		for(i = 0; i < 8; ++i)
+		{
+			length += GenerateIdentifier(line + length);
+			line[length++] = ' ';
+		}
 
-#ifndef _NO_OUTPUT
-		fprintf(file,"TOKEN\n{\n");
-		fprintf(file,"  Line: %d\n",token.LineNumber);
+		line[length++] = ',';
+		break;
 
-		switch(token.Type)
+	case CORPUS_PUNCTUATIONS:
+		for(i = 0; i < 24; ++i)
 		{
-		case TOKEN_NONE:
-			fprintf(file,"  Type: TOKEN_NONE\n\n");
-			break;
+			LPCSTR name = CPPPUNCTUATIONS[Random(sizeof(CPPPUNCTUATIONS) / sizeof(PUNCTUATION) - 1)].name;
 
-		case TOKEN_PUNCTUATION:
-			fprintf(file,"  Type: TOKEN_PUNCTUATION\n");
-			fprintf(file,"  TypeEx: %d\n",token.TypeEx);
-			fprintf(file,"  Value: '%s'\n",token.Value.Buffer);		// fprintf(file,"  '%s'\n",GetPunctuationName(token.TypeEx));
-			break;
+			// Separated so they never merge into a comment
+			while(*name)
+				line[length++] = *name++;
 
-		case TOKEN_IDENTIFIER:
-			fprintf(file,"  Type: TOKEN_IDENTIFIER\n");
-			fprintf(file,"  Value: '%s'\n",token.Value.Buffer);
-			break;
+			line[length++] = ' ';
+		}
+		break;
+
+	case CORPUS_COMMENTS:
+		if(Random(4))
+		{
+			LPCSTR begin = assembly ? ASMMULTILINECOMMENTBEGIN : CPPMULTILINECOMMENTBEGIN;
+			LPCSTR end = assembly ? ASMMULTILINECOMMENTEND : CPPMULTILINECOMMENTEND;
 
-		case TOKEN_NUMBER:
-			fprintf(file,"  Type: TOKEN_NUMBER\n");
+			length += sprintf(line + length,"%s",Random(2) ? (assembly ? ASMCOMMENT : CPPCOMMENT) : begin);
 
-			switch(token.TypeEx)
+			for(i = 0; i < 10; ++i)
 			{
-			case NUMBER_INTEGER:
-				fprintf(file,"  TypeEx: NUMBER_INTEGER\n");
-				break;
+				line[length++] = ' ';
+				length += GenerateIdentifier(line + length);
+			}
 
-			case NUMBER_NEGATIVE_INTEGER:
-				fprintf(file,"  TypeEx: NUMBER_NEGATIVE_INTEGER\n");
-				break;
+			if(line[0] == begin[0] && line[1] == begin[1])
+				length += sprintf(line + length,"\n   license text\n\n %s",end);
+		}
+		else
+		{
+			length += GenerateIdentifier(line + length);
+			length += sprintf(line + length," = %u,",Random(1000));
+		}
+		break;
 
-			case NUMBER_HEX:
-				fprintf(file,"  TypeEx: NUMBER_HEX\n");
-				break;
+	case CORPUS_STRINGS:
+		length += sprintf(line + length,"\tdb \"");
 
-			case NUMBER_NEGATIVE_HEX:
-				fprintf(file,"  TypeEx: NUMBER_NEGATIVE_HEX\n");
-				break;
+		for(i = 0; i < 120; ++i)
+		{
+			if(!Random(40))
+				length += sprintf(line + length,"\\n");
+			else
+				line[length++] = (CHAR)(Random(8) ? 'a' + Random(26) : ' ');
+		}
+
+		length += sprintf(line + length,"\",0");
+		break;
 
-			case NUMBER_OCTAL:
-				fprintf(file,"  TypeEx: NUMBER_OCTAL\n");
+	case CORPUS_NUMBERS:
+		length += sprintf(line + length,"\tdd");
+
+		for(i = 0; i < 8; ++i)
+		{
+			switch(Random(4))
+			{
+			case 0:
+				length += sprintf(line + length," %u,",Random(100000));
 				break;
 
-			case NUMBER_NEGATIVE_OCTAL:
-				fprintf(file,"  TypeEx: NUMBER_NEGATIVE_OCTAL\n");
+			case 1:
+				length += sprintf(line + length," 0x%X,",Random(0x10000));
 				break;
 
-			case NUMBER_FLOAT:
-				fprintf(file,"  TypeEx: NUMBER_FLOAT\n");
+			case 2:
+				length += sprintf(line + length," 0%o,",Random(01000));
 				break;
 
-			case NUMBER_NEGATIVE_FLOAT:
-				fprintf(file,"  TypeEx: NUMBER_NEGATIVE_FLOAT\n");
+			case 3:
+				length += sprintf(line + length," %u.%u,",Random(1000),Random(1000));
 				break;
 			}
+		}
+		break;
+	}
+
+	line[length++] = '\n';
+
+	return length;
+}
+
+BOOL GenerateCorpus(LPCSTR path,ULONG kind,ULONG size,BOOL assembly)
+{
+	CHAR line[1024];
+	ULONG written = 0;
+	FILE* file;
+
+	file = fopen(path,"wb");
+	if(!file)
+		return FALSE;
+
+	Seed = kind + 1;
+
+	while(written < size)
+	{
+		ULONG length = GenerateLine(line,kind,assembly);
+
+		if(fwrite(line,1,length,file) != length)
+		{
+			fclose(file);
+			return FALSE;
+		}
+
+		written += length;
+	}
+
+	fclose(file);
 
-			fprintf(file,"  Value: '%s'\n",token.Value.Buffer);
-			break;
+	return TRUE;
+}
 
-		case TOKEN_STRING:
-			fprintf(file,"  Type: TOKEN_STRING\n");
-			fprintf(file,"  Value: '%s'\n",token.Value.Buffer);
-			break;
+SIZE_T GetWorkingSet(VOID)
+{
+	PROCESS_MEMORY_COUNTERS memory;
+
+	memset(&memory,0,sizeof(memory));
+	GetProcessMemoryInfo(GetCurrentProcess(),&memory,sizeof(memory));
+
+	return memory.WorkingSetSize;
+}
+
+BOOL BenchmarkFile(LPCSTR path,ULONG runs,BOOL assembly,BOOL parallel,ULONG threads,BOOL cache,BOOL statistics,LPBENCHMARK benchmark)
+{
+	LARGE_INTEGER frequency;
+	CHAR cachePath[MAX_PATH];
+	ULONG run;
+
+	memset(benchmark,0,sizeof(BENCHMARK));
+
+	QueryPerformanceFrequency(&frequency);
+
+	if(cache)
+	{
+		if(strlen(path) + sizeof(".tokens") > MAX_PATH)
+			return FALSE;
+
+		sprintf(cachePath,"%s.tokens",path);
 
-		case TOKEN_LITERAL:
-			fprintf(file,"  Type: TOKEN_LITERAL\n");
-			fprintf(file,"  Value: '%s'\n",token.Value.Buffer);
-			break;
+		// Start from a miss
+		DeleteFileA(cachePath);
+	}
+
+	for(run = 0; run < runs; ++run)
+	{
+		LARGE_INTEGER start,end;
+		LONG allocations = LexerAllocations;
+		SIZE_T baseline = 0;
+		TOKENARRAY array;
+		ULONG tokens = 0;
+		ULONG errors = 0;
+		double time;
+		LEXER lexer;
+
+		// The first run measures memory, trimmed first so everything it touches is counted
+		if(!run)
+		{
+			SetProcessWorkingSetSize(GetCurrentProcess(),(SIZE_T)-1,(SIZE_T)-1);
+			baseline = GetWorkingSet();
 		}
 
-		fprintf(file,"}\n");
+		InitializeTokenArray(&array);
+
+		if(assembly)
+			InitializeLexerProfile(&lexer,LEXER_PROFILE_ASM,NULL,FALSE);
+		else
+			InitializeLexerProfile(&lexer,LEXER_PROFILE_CPP,CPPKEYWORDS,FALSE);
+
+		QueryPerformanceCounter(&start);
+
+		if(!LoadFile(&lexer,path))
+		{
+			UninitializeLexer(&lexer);
+			return FALSE;
+		}
+
+		if(parallel || cache)
+		{
+			ULONG error;
+
+			if(cache)
+				error = TokenizeFileCached(&lexer,&array,cachePath);
+			else
+				error = TokenizeFileParallel(&lexer,&array,threads);
+
+			if(error)
+				++errors;
+
+			tokens = array.Count;
+		}
+
+		while(!parallel && !cache)
+		{
+			TOKEN token;
+			ULONG error;
+
+			InitializeToken(&token);
+
+			if(error = ReadToken(&lexer,&token))
+			{
+				if(error == ERROR_EOF)
+					break;
+
+				++errors;
+
+				// Step over whatever could not be lexed
+				if(!lexer.FileBuffer[lexer.FilePosition])
+					break;
+
+				++lexer.FilePosition;
+				continue;
+			}
+
+			++tokens;
+		}
+
+		benchmark->Bytes = lexer.FileBufferLength;
+
+		// Taken while the input and the tokens are still held
+		if(!run)
+			benchmark->Memory = max(GetWorkingSet(),baseline) - baseline;
+
+#ifdef LEXER_STATISTICS
+		if(statistics && run == runs - 1)
+			PrintLexerStatistics(&lexer,stdout);
 #endif
 
-		UninitializeToken(&token);
+		UninitializeTokenArray(&array);
+		UninitializeLexer(&lexer);
+
+		QueryPerformanceCounter(&end);
+
+		time = (end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+		if(!run || time < benchmark->Best)
+			benchmark->Best = time;
+
+		benchmark->Total += time;
+		benchmark->Tokens = tokens;
+		benchmark->Errors = errors;
+		benchmark->Allocations = (ULONG)(LexerAllocations - allocations);
 	}
 
-	QueryPerformanceCounter(&end);
-	QueryPerformanceFrequency(&frequency);
+	if(cache)
+		DeleteFileA(cachePath);
 
-	UninitializeLexer(&lexer);
+	return TRUE;
+}
 
-#ifndef _NO_OUTPUT
-	fprintf(file,"\n------------------------------------------------------------------------------------------\n");
-	fprintf(file,"- Source file: %s\n",source);
-	fprintf(file,"- Parse time: %g miliseconds",(end.QuadPart - start.QuadPart) / (double)(frequency.QuadPart / 1000LL));
-	
-	fclose(file);
+VOID PrintBenchmark(LPCSTR name,ULONG runs,LPBENCHMARK benchmark)
+{
+	double megabytes = benchmark->Bytes / (1024.0 * 1024.0);
+	double average = benchmark->Total / runs;
+
+	printf("%-16s %8.2f MB %10lu tokens  best %8.1f MB/s  avg %8.1f MB/s  %7.2f Mtokens/s  %.4f allocs/token  memory %lu MB",
+		name,
+		megabytes,
+		benchmark->Tokens,
+		megabytes / benchmark->Best,
+		megabytes / average,
+		benchmark->Tokens / benchmark->Best / 1000000.0,
+		benchmark->Tokens ? benchmark->Allocations / (double)benchmark->Tokens : 0.0,
+		(ULONG)(benchmark->Memory / (1024 * 1024)));
+
+	if(benchmark->Errors)
+		printf("  %lu errors",benchmark->Errors);
+
+	printf("\n");
+}
+
+int main(int argc,char** argv)
+{
+	ULONG runs = DEFAULT_RUNS;
+	ULONG size = DEFAULT_SIZE;
+	ULONG threads = 0;
+	BOOL assembly = FALSE;
+	BOOL parallel = FALSE;
+	BOOL cache = FALSE;
+	BOOL statistics = FALSE;
+	BOOL files = FALSE;
+	BENCHMARK benchmark;
+	int i;
+
+	for(i = 1; i < argc; ++i)
+	{
+		if(!strcmp(argv[i],"-runs") && i + 1 < argc)
+			runs = strtoul(argv[++i],NULL,10);
+		else if(!strcmp(argv[i],"-size") && i + 1 < argc)
+			size = strtoul(argv[++i],NULL,10);
+		else if(!strcmp(argv[i],"-threads") && i + 1 < argc)
+		{
+			threads = strtoul(argv[++i],NULL,10);
+			parallel = TRUE;
+		}
+		else if(!strcmp(argv[i],"-cache"))
+			cache = TRUE;
+		else if(!strcmp(argv[i],"-stats"))
+			statistics = TRUE;
+		else if(!strcmp(argv[i],"-asm"))
+			assembly = TRUE;
+		else if(argv[i][0] == '-')
+		{
+			printf("Usage: %s [-runs count] [-size megabytes] [-threads count] [-cache] [-stats] [-asm] [file ...]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(!runs || !size)
+	{
+		printf("Runs and size must be at least one\n");
+		return 1;
+	}
+
+#ifndef LEXER_STATISTICS
+	if(statistics)
+	{
+		printf("Statistics need a lexer built with LEXER_STATISTICS\n");
+		return 1;
+	}
 #endif
 
-	printf("Source: %s\n",source);
-	printf("Destination: %s\n",destination);
-	printf("Parsing time: %g miliseconds\n",(end.QuadPart - start.QuadPart) / (double)(frequency.QuadPart / 1000LL));
+	printf("%lu runs, %s comments\n",runs,assembly ? "assembly" : "C++");
+
+	// Real files
+	for(i = 1; i < argc; ++i)
+	{
+		if(!strcmp(argv[i],"-runs") || !strcmp(argv[i],"-size") || !strcmp(argv[i],"-threads"))
+		{
+			++i;
+			continue;
+		}
+
+		if(argv[i][0] == '-')
+			continue;
+
+		files = TRUE;
+
+		if(!BenchmarkFile(argv[i],runs,assembly,parallel,threads,cache,statistics,&benchmark))
+		{
+			printf("%s: could not be loaded\n",argv[i]);
+			continue;
+		}
+
+		PrintBenchmark(argv[i],runs,&benchmark);
+	}
+
+	// Synthetic corpora
+	if(!files)
+	{
+		CHAR directory[MAX_PATH];
+		CHAR path[MAX_PATH];
+		ULONG kind;
+
+		if(!GetTempPathA(MAX_PATH,directory) || !GetTempFileNameA(directory,"lex",0,path))
+		{
+			printf("Could not create a temporary file\n");
+			return 1;
+		}
+
+		for(kind = 0; kind < CORPUS_COUNT; ++kind)
+		{
+			if(!GenerateCorpus(path,kind,size * 1024 * 1024,assembly))
+			{
+				printf("%s: could not be generated\n",CORPUSNAMES[kind]);
+				continue;
+			}
+
+			if(!BenchmarkFile(path,runs,assembly,parallel,threads,cache,statistics,&benchmark))
+			{
+				printf("%s: could not be loaded\n",CORPUSNAMES[kind]);
+				continue;
+			}
+
+			PrintBenchmark(CORPUSNAMES[kind],runs,&benchmark);
+		}
+
+		DeleteFileA(path);
+	}
 
-	system("pause");
 	return 0;
-}
\ No newline at end of file
+}
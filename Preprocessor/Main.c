@@ -1,9 +1,229 @@
+#define _CRT_SECURE_NO_WARNINGS
+
 #include <windows.h>
 #include <stdio.h>
 
 #include "Preprocessor.h"
 
-int main(void)
+// Preprocessor
+//
+// Usage: Preprocessor [-I directory] [-D name[=value]] [-threads count] [-stats] file ...
+//
+// Every file is preprocessed on its own and the tokens are printed, every line of
+// the input the tokens come from on a line of its own. The files share an include
+// cache, headers they have in common are loaded and lexed once. With -threads the
+// files are preprocessed on that many threads, zero means one per processor, the
+// output is still printed in order. With -stats the preprocessor statistics of
+// every file are printed as JSON after its tokens.
+
+#define THREADS_MAXIMUM 64
+
+// This structure represents a file to preprocess
+typedef struct
+{
+	LPCSTR Path;
+	PREPROCESSOR Preprocessor;
+	TOKENARRAY Tokens;
+	ULONG Error;
+} JOB, *LPJOB;
+
+// This structure represents the work shared by the preprocessing threads
+typedef struct
+{
+	LPJOB Jobs;
+	ULONG Count;
+	LONG Next;			// Index of the next job to take
+	LPINCLUDECACHE Cache;
+	LPSTR* Directories;
+	ULONG DirectoryCount;
+	LPSTR* Definitions;	// Names, each followed by its value or NULL
+	ULONG DefinitionCount;
+} WORK, *LPWORK;
+
+VOID PrintTokens(LPPREPROCESSOR preprocessor,LPTOKENARRAY tokens)
 {
+	LPCSTR previousName = NULL;
+	ULONG previousLine = 0;
+	ULONG next = 0;
+	STRING spelling;
+	ULONG i;
+
+	InitializeString(&spelling);
+
+	for(i = 0; i < tokens->Count; ++i)
+	{
+		LPTOKEN token = &tokens->Tokens[i];
+		LPCSTR name = NULL;
+		ULONG line = 0;
+		ULONG column;
+
+		GetPreprocessorLine(preprocessor,token->Location,&name,&line,&column);
+
+		// Tokens apart in the input are printed apart, and so are tokens from
+		// different places so they never paste
+		if(i && (name != previousName || line != previousLine))
+			printf("\n");
+		else if(i && ((token->Flags & TOKEN_SPACE) || token->Location != next))
+			printf(" ");
+
+		ClearString(&spelling);
+		SpellToken(&spelling,token);
+
+		printf("%.*s",spelling.Length,spelling.Buffer);
+
+		previousName = name;
+		previousLine = line;
+		next = token->Location + spelling.Length;
+	}
+
+	if(tokens->Count)
+		printf("\n");
+
+	UninitializeString(&spelling);
+}
+
+DWORD WINAPI PreprocessJobs(LPVOID parameter)
+{
+	LPWORK work = (LPWORK)parameter;
+	LONG index;
+	ULONG i;
+
+	while((index = InterlockedIncrement(&work->Next) - 1) < (LONG)work->Count)
+	{
+		LPJOB job = &work->Jobs[index];
+
+		InitializeTokenArray(&job->Tokens);
+
+		if(!InitializePreprocessor(&job->Preprocessor,work->Cache))
+		{
+			job->Error = ERROR_INVALID;
+			continue;
+		}
+
+		for(i = 0; i < work->DirectoryCount; ++i)
+			AddIncludeDirectory(&job->Preprocessor,work->Directories[i]);
+
+		for(i = 0; i < work->DefinitionCount; ++i)
+			if(!DefineMacro(&job->Preprocessor,work->Definitions[i * 2],work->Definitions[i * 2 + 1]))
+				printf("Could not define '%s'\n",work->Definitions[i * 2]);
+
+		job->Error = PreprocessFile(&job->Preprocessor,job->Path,&job->Tokens);
+	}
+
 	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc,char** argv)
+{
+	HANDLE handles[THREADS_MAXIMUM];
+	INCLUDECACHE cache;
+	WORK work;
+	BOOL statistics = FALSE;
+	ULONG threads = 1;
+	ULONG error = ERROR_NONE;
+	int i;
+
+	memset(&work,0,sizeof(WORK));
+
+	work.Jobs = (LPJOB)calloc(argc,sizeof(JOB));
+	work.Directories = (LPSTR*)calloc(argc,sizeof(LPSTR));
+	work.Definitions = (LPSTR*)calloc(argc * 2,sizeof(LPSTR));
+
+	if(!work.Jobs || !work.Directories || !work.Definitions || !InitializeIncludeCache(&cache))
+	{
+		printf("Could not initialize the preprocessor\n");
+		return 1;
+	}
+
+	work.Cache = &cache;
+
+	for(i = 1; i < argc; ++i)
+	{
+		if(!strcmp(argv[i],"-I") && i + 1 < argc)
+			work.Directories[work.DirectoryCount++] = argv[++i];
+		else if(!strcmp(argv[i],"-D") && i + 1 < argc)
+		{
+			LPSTR name = argv[++i];
+			LPSTR value = strchr(name,'=');
+
+			if(value)
+				*value++ = 0;
+
+			work.Definitions[work.DefinitionCount * 2] = name;
+			work.Definitions[work.DefinitionCount++ * 2 + 1] = value;
+		}
+		else if(!strcmp(argv[i],"-threads") && i + 1 < argc)
+			threads = strtoul(argv[++i],NULL,10);
+		else if(!strcmp(argv[i],"-stats"))
+			statistics = TRUE;
+		else if(argv[i][0] == '-')
+		{
+			work.Count = 0;
+			break;
+		}
+		else
+			work.Jobs[work.Count++].Path = argv[i];
+	}
+
+	if(!work.Count)
+	{
+		printf("Usage: %s [-I directory] [-D name[=value]] [-threads count] [-stats] file ...\n",argv[0]);
+		UninitializeIncludeCache(&cache);
+		return 1;
+	}
+
+	if(!threads)
+	{
+		SYSTEM_INFO info;
+
+		GetSystemInfo(&info);
+		threads = info.dwNumberOfProcessors;
+	}
+
+	threads = min(threads,THREADS_MAXIMUM);
+	threads = min(threads,work.Count);
+
+	// The calling thread takes jobs too
+	for(i = 1; i < (int)threads; ++i)
+		handles[i] = CreateThread(NULL,0,PreprocessJobs,&work,0,NULL);
+
+	PreprocessJobs(&work);
+
+	for(i = 1; i < (int)threads; ++i)
+	{
+		if(handles[i])
+		{
+			WaitForSingleObject(handles[i],INFINITE);
+			CloseHandle(handles[i]);
+		}
+	}
+
+	// Preprocessors are kept up to here, their tokens are printed with the names of their files
+	for(i = 0; i < (int)work.Count; ++i)
+	{
+		LPJOB job = &work.Jobs[i];
+
+		if(job->Error)
+			error = job->Error;
+
+		if(job->Preprocessor.Cache)
+		{
+			PrintTokens(&job->Preprocessor,&job->Tokens);
+
+			if(statistics)
+				PrintPreprocessorStatistics(&job->Preprocessor,stdout);
+
+			UninitializePreprocessor(&job->Preprocessor);
+		}
+
+		UninitializeTokenArray(&job->Tokens);
+	}
+
+	UninitializeIncludeCache(&cache);
+
+	free(work.Jobs);
+	free(work.Directories);
+	free(work.Definitions);
+
+	return error ? 2 : 0;
+}
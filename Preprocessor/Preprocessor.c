@@ -1,5 +1,3575 @@
+/*
+ *	Preprocessor - C Preprocessor on the Lexer token stream
+ *	Copyright (C) 2007 Marko Mihovilic
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
 #include <windows.h>
 #include <stdio.h>
 
 #include "Preprocessor.h"
 
+#include "..\Lexer\Lexer.h"
+#include "..\Lexer\Lexer.c"	// Nasty
+
+#define IsPunctuation(token,id) ((token)->Type == TOKEN_PUNCTUATION && (token)->TypeEx == (id))
+
+BOOL InitializePreprocessor(LPPREPROCESSOR preprocessor,LPINCLUDECACHE cache)
+{
+	ULONG i;
+
+	memset(preprocessor,0,sizeof(PREPROCESSOR));
+
+	// Without a shared cache the files are still loaded once for this preprocessor
+	if(!cache)
+	{
+		if(!InitializeIncludeCache(&preprocessor->PrivateCache))
+			return FALSE;
+
+		cache = &preprocessor->PrivateCache;
+	}
+
+	preprocessor->Cache = cache;
+
+	if(!InitializeAtomTable(&preprocessor->Atoms) || !InitializeMacroTable(&preprocessor->Macros))
+	{
+		UninitializePreprocessor(preprocessor);
+		return FALSE;
+	}
+
+	// Directives are told apart by their atom data
+	for(i = 1; i < sizeof(DIRECTIVENAMES) / sizeof(LPCSTR); ++i)
+	{
+		ULONG atom = AddAtom(&preprocessor->Atoms,DIRECTIVENAMES[i],(ULONG)strlen(DIRECTIVENAMES[i]));
+
+		if(!atom)
+		{
+			UninitializePreprocessor(preprocessor);
+			return FALSE;
+		}
+
+		SetAtomData(&preprocessor->Atoms,atom,(LPVOID)(ULONG_PTR)i);
+	}
+
+	if(!InitializeLexerProfile(&preprocessor->Paste,LEXER_PROFILE_CPP,CPPKEYWORDS,FALSE))
+	{
+		UninitializePreprocessor(preprocessor);
+		return FALSE;
+	}
+
+	SetAtomTable(&preprocessor->Paste,&preprocessor->Atoms);
+	preprocessor->Paste.Quiet = TRUE;
+
+	InitializeString(&preprocessor->Scratch);
+
+	// Location zero is left for tokens that come from no file
+	preprocessor->FileBase = FILE_BASE_GAP;
+
+	if(!DefineBuiltinMacros(preprocessor))
+	{
+		UninitializePreprocessor(preprocessor);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+VOID UninitializePreprocessor(LPPREPROCESSOR preprocessor)
+{
+	ULONG i;
+
+	while(preprocessor->ExpansionCount)
+		PopExpansion(preprocessor);
+
+	for(i = 0; i < preprocessor->FileCount; ++i)
+	{
+		free(preprocessor->Files[i]->Name);
+		free(preprocessor->Files[i]->Marks);
+		free(preprocessor->Files[i]);
+	}
+
+	for(i = 0; i < preprocessor->ReferenceCount; ++i)
+		free(preprocessor->References[i].Atoms);
+
+	for(i = 0; i < preprocessor->NameSlotCount; ++i)
+	{
+		free(preprocessor->Names[i].Key);
+		free(preprocessor->Names[i].Path);
+	}
+
+	for(i = 0; i < preprocessor->DirectoryCount; ++i)
+		free(preprocessor->Directories[i]);
+
+	free(preprocessor->Files);
+	free(preprocessor->References);
+	free(preprocessor->Names);
+	free(preprocessor->Expansions);
+	free(preprocessor->Conditionals);
+	free(preprocessor->Directories);
+
+	preprocessor->Source = NULL;
+	preprocessor->Files = NULL;
+	preprocessor->FileCount = 0;
+	preprocessor->References = NULL;
+	preprocessor->ReferenceCount = 0;
+	preprocessor->Names = NULL;
+	preprocessor->NameSlotCount = 0;
+	preprocessor->NameCount = 0;
+	preprocessor->Expansions = NULL;
+	preprocessor->Conditionals = NULL;
+	preprocessor->ConditionalCount = 0;
+	preprocessor->Directories = NULL;
+	preprocessor->DirectoryCount = 0;
+
+	FreeStringBlocks(&preprocessor->Strings);
+	UninitializeString(&preprocessor->Scratch);
+	UninitializeLexer(&preprocessor->Paste);
+
+	UninitializeMacroTable(&preprocessor->Macros);
+	UninitializeAtomTable(&preprocessor->Atoms);
+
+	if(preprocessor->Cache == &preprocessor->PrivateCache)
+		UninitializeIncludeCache(&preprocessor->PrivateCache);
+
+	preprocessor->Cache = NULL;
+}
+
+BOOL AddIncludeDirectory(LPPREPROCESSOR preprocessor,LPCSTR directory)
+{
+	LPSTR* directories;
+	LPSTR copy;
+
+	directories = (LPSTR*)realloc(preprocessor->Directories,(preprocessor->DirectoryCount + 1) * sizeof(LPSTR));
+	if(!directories)
+		return FALSE;
+
+	preprocessor->Directories = directories;
+
+	copy = _strdup(directory);
+	if(!copy)
+		return FALSE;
+
+	preprocessor->Directories[preprocessor->DirectoryCount++] = copy;
+
+	return TRUE;
+}
+
+BOOL DefineMacro(LPPREPROCESSOR preprocessor,LPCSTR name,LPCSTR value)
+{
+	TOKENARRAY tokens;
+	LPMACRO macro;
+	TOKEN token;
+	ULONG error;
+
+	InitializeTokenArray(&tokens);
+
+	// The value is lexed like a pasted token, the values are kept with the preprocessor
+	ClearString(&preprocessor->Scratch);
+
+	if(!AppendString(&preprocessor->Scratch,value ? value : "1",value ? (ULONG)strlen(value) : 1) || !LoadScratch(preprocessor,"<command line>"))
+		return FALSE;
+
+	while(1)
+	{
+		InitializeToken(&token);
+
+		if(error = ReadToken(&preprocessor->Paste,&token))
+			break;
+
+		token.Value = StoreStringBlock(&preprocessor->Strings,token.Value,token.Length);
+		token.Location = 0;
+
+		if(!token.Value || !AppendTokenEntry(&tokens,&token))
+		{
+			error = ERROR_INVALID;
+			break;
+		}
+	}
+
+	UnloadFile(&preprocessor->Paste);
+
+	if(error != ERROR_EOF)
+	{
+		UninitializeTokenArray(&tokens);
+		return FALSE;
+	}
+
+	macro = (LPMACRO)calloc(1,sizeof(MACRO));
+	if(!macro)
+	{
+		UninitializeTokenArray(&tokens);
+		return FALSE;
+	}
+
+	SetMacroTokens(macro,&tokens);
+
+	macro->Name = AddAtom(&preprocessor->Atoms,name,(ULONG)strlen(name));
+
+	if(!macro->Name || !AddMacro(preprocessor,macro))
+	{
+		FreeMacro(macro);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL DefineBuiltinMacros(LPPREPROCESSOR preprocessor)
+{
+	static LPCSTR months[] = {"Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"};
+	SYSTEMTIME time;
+	CHAR date[16];
+	CHAR clock[16];
+
+	// Taken once, the date and time of translation do not change while it runs
+	GetLocalTime(&time);
+
+	sprintf(date,"\"%s %2u %u\"",months[time.wMonth - 1],time.wDay,time.wYear);
+	sprintf(clock,"\"%02u:%02u:%02u\"",time.wHour,time.wMinute,time.wSecond);
+
+	return DefineMacro(preprocessor,"__STDC__","1") && DefineMacro(preprocessor,"__DATE__",date) && DefineMacro(preprocessor,"__TIME__",clock) &&
+		DefineBuiltinMacro(preprocessor,"__LINE__",MACRO_LINE) && DefineBuiltinMacro(preprocessor,"__FILE__",MACRO_FILE);
+}
+
+BOOL DefineBuiltinMacro(LPPREPROCESSOR preprocessor,LPCSTR name,ULONG flags)
+{
+	LPMACRO macro = (LPMACRO)calloc(1,sizeof(MACRO));
+
+	if(!macro)
+		return FALSE;
+
+	// Replaced when expanded, the definition stays empty
+	macro->Flags = flags;
+	macro->Name = AddAtom(&preprocessor->Atoms,name,(ULONG)strlen(name));
+
+	if(!macro->Name || !AddMacro(preprocessor,macro))
+	{
+		FreeMacro(macro);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+ULONG PreprocessFile(LPPREPROCESSOR preprocessor,LPCSTR path,LPTOKENARRAY tokens)
+{
+	LPINCLUDEENTRY entry;
+	ULONG error;
+
+	if(!(entry = OpenSourceFile(preprocessor,path)) || !EnterSourceFile(preprocessor,path,entry))
+	{
+		PreprocessorError(preprocessor,NULL,"could not open '%s'",path);
+		return ERROR_INVALID;
+	}
+
+	while(1)
+	{
+		TOKEN token;
+
+		InitializeToken(&token);
+
+		if(error = ReadExpandedToken(preprocessor,&token))
+			break;
+
+		// The mark only matters while expanding
+		if(token.Type == TOKEN_IDENTIFIER)
+			token.TypeEx &= ~TOKEN_NOEXPAND;
+
+		if(!AppendTokenEntry(tokens,&token))
+		{
+			PreprocessorError(preprocessor,&token,"out of memory");
+			error = ERROR_INVALID;
+			break;
+		}
+	}
+
+	// Leave everything behind when stopped early
+	while(preprocessor->ExpansionCount)
+		PopExpansion(preprocessor);
+
+	while(preprocessor->Source)
+		LeaveSourceFile(preprocessor);
+
+	preprocessor->ConditionalCount = 0;
+
+	// The end of the main file is how preprocessing ends
+	if(error == ERROR_EOF)
+		return preprocessor->Errors ? ERROR_INVALID : ERROR_NONE;
+
+	return error;
+}
+
+BOOL GetPreprocessorLine(LPPREPROCESSOR preprocessor,ULONG location,LPCSTR* name,PULONG line,PULONG column)
+{
+	LPSOURCEFILE source = FindSourceFile(preprocessor,location);
+	ULONG low = 0;
+	ULONG high;
+
+	// The line table of the entry was built when it was loaded
+	if(!source || !GetLocationLine(&source->Entry->Lexer,location - source->FileBase,line,column))
+		return FALSE;
+
+	*name = source->Name;
+
+	// Find the last #line directive before the location, the lines after it are numbered from it
+	high = source->MarkCount;
+
+	while(low < high)
+	{
+		ULONG middle = low + (high - low) / 2;
+
+		if(source->Marks[middle].Offset <= location - source->FileBase)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if(low)
+	{
+		LPLINEMARK mark = &source->Marks[low - 1];
+
+		*line = mark->Number + (*line - mark->Line);
+
+		if(mark->Name)
+			*name = mark->Name;
+	}
+
+	return TRUE;
+}
+
+VOID PrintPreprocessorStatistics(LPPREPROCESSOR preprocessor,FILE* stream)
+{
+	LPPREPROCESSORSTATISTICS statistics = &preprocessor->Statistics;
+
+	fprintf(stream,"{\n");
+	fprintf(stream,"\t\"files\": %llu,\n",statistics->Files);
+	fprintf(stream,"\t\"directives\": %llu,\n",statistics->Directives);
+	fprintf(stream,"\t\"macros\": %llu,\n",statistics->Macros);
+	fprintf(stream,"\t\"expansions\": %llu,\n",statistics->Expansions);
+	fprintf(stream,"\t\"lookups\": %llu,\n",statistics->Lookups);
+	fprintf(stream,"\t\"probes\": %llu,\n",statistics->Probes);
+	fprintf(stream,"\t\"skippedBytes\": %llu,\n",statistics->SkippedBytes);
+	fprintf(stream,"\t\"includeHits\": %llu,\n",statistics->IncludeHits);
+	fprintf(stream,"\t\"includeLoads\": %llu,\n",statistics->IncludeLoads);
+	fprintf(stream,"\t\"includeSkips\": %llu,\n",statistics->IncludeSkips);
+	fprintf(stream,"\t\"errors\": %lu\n",preprocessor->Errors);
+	fprintf(stream,"}\n");
+}
+
+BOOL InitializeMacroTable(LPMACROTABLE macros)
+{
+	memset(macros,0,sizeof(MACROTABLE));
+
+	macros->Slots = (LPMACROSLOT)calloc(MACROTABLE_BLOCK,sizeof(MACROSLOT));
+	if(!macros->Slots)
+		return FALSE;
+
+	macros->SlotCount = MACROTABLE_BLOCK;
+
+	return TRUE;
+}
+
+VOID UninitializeMacroTable(LPMACROTABLE macros)
+{
+	ULONG i;
+
+	for(i = 0; i < macros->SlotCount; ++i)
+		if(macros->Slots[i].Name)
+			FreeMacro(macros->Slots[i].Macro);
+
+	for(i = 0; i < macros->RetiredCount; ++i)
+		FreeMacro(macros->Retired[i]);
+
+	free(macros->Slots);
+	free(macros->Retired);
+
+	memset(macros,0,sizeof(MACROTABLE));
+}
+
+ULONG HashMacro(ULONG name,ULONG mask)
+{
+	// Atoms are handed out in order, mix every bit into the low ones before masking
+	name ^= name >> 16;
+	name *= 0x85EBCA6B;
+	name ^= name >> 13;
+	name *= 0xC2B2AE35;
+	name ^= name >> 16;
+
+	return name & mask;
+}
+
+LPMACRO FindMacro(LPPREPROCESSOR preprocessor,ULONG name)
+{
+	LPMACROTABLE macros = &preprocessor->Macros;
+	ULONG mask = macros->SlotCount - 1;
+	ULONG i = HashMacro(name,mask);
+
+	++preprocessor->Statistics.Lookups;
+
+	while(1)
+	{
+		LPMACROSLOT slot = &macros->Slots[i];
+
+		++preprocessor->Statistics.Probes;
+
+		if(slot->Name == name)
+			return slot->Macro;
+
+		if(!slot->Name)
+			return NULL;
+
+		i = (i + 1) & mask;
+	}
+}
+
+BOOL GrowMacroTable(LPMACROTABLE macros)
+{
+	LPMACROSLOT slots = macros->Slots;
+	ULONG count = macros->SlotCount;
+	ULONG mask = count * 2 - 1;
+	ULONG i;
+
+	macros->Slots = (LPMACROSLOT)calloc(count * 2,sizeof(MACROSLOT));
+	if(!macros->Slots)
+	{
+		macros->Slots = slots;
+		return FALSE;
+	}
+
+	macros->SlotCount = count * 2;
+
+	// Reinsert, names are unique so no comparing is needed
+	for(i = 0; i < count; ++i)
+	{
+		ULONG j;
+
+		if(!slots[i].Name)
+			continue;
+
+		for(j = HashMacro(slots[i].Name,mask); macros->Slots[j].Name; j = (j + 1) & mask);
+
+		macros->Slots[j] = slots[i];
+	}
+
+	free(slots);
+
+	return TRUE;
+}
+
+BOOL AddMacro(LPPREPROCESSOR preprocessor,LPMACRO macro)
+{
+	LPMACROTABLE macros = &preprocessor->Macros;
+	ULONG mask;
+	ULONG i;
+
+	// Keep the table at most half full so probe sequences stay short
+	if((macros->Count + 1) * 2 > macros->SlotCount && !GrowMacroTable(macros))
+		return FALSE;
+
+	mask = macros->SlotCount - 1;
+
+	for(i = HashMacro(macro->Name,mask); macros->Slots[i].Name; i = (i + 1) & mask)
+	{
+		// Redefinition
+		if(macros->Slots[i].Name == macro->Name)
+		{
+			if(!RetireMacro(macros,macros->Slots[i].Macro))
+				return FALSE;
+
+			macros->Slots[i].Macro = macro;
+
+			++preprocessor->Statistics.Macros;
+
+			return TRUE;
+		}
+	}
+
+	macros->Slots[i].Name = macro->Name;
+	macros->Slots[i].Macro = macro;
+	++macros->Count;
+
+	++preprocessor->Statistics.Macros;
+
+	return TRUE;
+}
+
+BOOL RemoveMacro(LPPREPROCESSOR preprocessor,ULONG name)
+{
+	LPMACROTABLE macros = &preprocessor->Macros;
+	ULONG mask = macros->SlotCount - 1;
+	ULONG i;
+	ULONG j;
+
+	for(i = HashMacro(name,mask); macros->Slots[i].Name != name; i = (i + 1) & mask)
+		if(!macros->Slots[i].Name)
+			return FALSE;
+
+	if(!RetireMacro(macros,macros->Slots[i].Macro))
+		return FALSE;
+
+	// Move later entries of the probe sequence back so lookups never need tombstones
+	for(j = (i + 1) & mask; macros->Slots[j].Name; j = (j + 1) & mask)
+	{
+		ULONG home = HashMacro(macros->Slots[j].Name,mask);
+
+		// Entries whose home is cyclically after the hole and not after them stay
+		if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		macros->Slots[i] = macros->Slots[j];
+		i = j;
+	}
+
+	macros->Slots[i].Name = 0;
+	macros->Slots[i].Macro = NULL;
+	--macros->Count;
+
+	return TRUE;
+}
+
+BOOL RetireMacro(LPMACROTABLE macros,LPMACRO macro)
+{
+	// An expansion still being read keeps using its macro
+	if(macro->Disabled)
+	{
+		if(macros->RetiredCount == macros->RetiredCapacity)
+		{
+			ULONG capacity = macros->RetiredCapacity ? macros->RetiredCapacity * 2 : 16;
+			LPMACRO* retired = (LPMACRO*)realloc(macros->Retired,capacity * sizeof(LPMACRO));
+
+			if(!retired)
+				return FALSE;
+
+			macros->Retired = retired;
+			macros->RetiredCapacity = capacity;
+		}
+
+		macros->Retired[macros->RetiredCount++] = macro;
+
+		return TRUE;
+	}
+
+	FreeMacro(macro);
+
+	return TRUE;
+}
+
+VOID FreeMacro(LPMACRO macro)
+{
+	free(macro->Tokens);
+	free(macro);
+}
+
+VOID SetMacroTokens(LPMACRO macro,LPTOKENARRAY tokens)
+{
+	LPTOKEN shrunk;
+
+	// Definitions are kept for the whole run, the array is cut down to its tokens
+	if(tokens->Count && (shrunk = (LPTOKEN)realloc(tokens->Tokens,tokens->Count * sizeof(TOKEN))))
+		tokens->Tokens = shrunk;
+
+	macro->Tokens = tokens->Tokens;
+	macro->Count = tokens->Count;
+}
+
+BOOL EqualMacro(LPMACRO macro1,LPMACRO macro2)
+{
+	ULONG i;
+
+	if(macro1->Flags != macro2->Flags || macro1->Parameters != macro2->Parameters || macro1->Count != macro2->Count)
+		return FALSE;
+
+	for(i = 0; i < macro1->Count; ++i)
+	{
+		LPTOKEN token1 = &macro1->Tokens[i];
+		LPTOKEN token2 = &macro2->Tokens[i];
+
+		if(token1->Type != token2->Type || token1->TypeEx != token2->TypeEx || token1->Length != token2->Length || memcmp(token1->Value,token2->Value,token1->Length))
+			return FALSE;
+
+		// Whitespace between tokens counts, not how much
+		if(i && (token1->Flags & TOKEN_SPACE) != (token2->Flags & TOKEN_SPACE))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL InitializeIncludeCache(LPINCLUDECACHE cache)
+{
+	memset(cache,0,sizeof(INCLUDECACHE));
+
+	cache->Slots = (LPINCLUDESLOT)calloc(INCLUDECACHE_BLOCK,sizeof(INCLUDESLOT));
+	if(!cache->Slots)
+		return FALSE;
+
+	cache->SlotCount = INCLUDECACHE_BLOCK;
+
+	InitializeCriticalSection(&cache->Lock);
+
+	return TRUE;
+}
+
+VOID UninitializeIncludeCache(LPINCLUDECACHE cache)
+{
+	ULONG i;
+
+	// Several paths may share an entry, entries are freed from the entry list
+	for(i = 0; i < cache->SlotCount; ++i)
+		free(cache->Slots[i].Path);
+
+	for(i = 0; i < cache->EntryCount; ++i)
+		FreeIncludeEntry(cache->Entries[i]);
+
+	free(cache->Slots);
+	free(cache->Entries);
+
+	DeleteCriticalSection(&cache->Lock);
+
+	memset(cache,0,sizeof(INCLUDECACHE));
+}
+
+ULONG HashIncludePath(LPCSTR path)
+{
+	ULONG hash = 2166136261;
+
+	// Paths name the same file whatever their case
+	for(; *path; ++path)
+		hash = (hash ^ (UCHAR)(*path >= 'A' && *path <= 'Z' ? *path - 'A' + 'a' : *path)) * 16777619;
+
+	return hash;
+}
+
+LPINCLUDESLOT FindIncludeSlot(LPINCLUDECACHE cache,LPCSTR path,ULONG hash)
+{
+	ULONG mask = cache->SlotCount - 1;
+	ULONG slot;
+
+	// The slot of the path, or the empty one it goes into
+	for(slot = hash & mask; cache->Slots[slot].Path; slot = (slot + 1) & mask)
+		if(cache->Slots[slot].Hash == hash && !_stricmp(cache->Slots[slot].Path,path))
+			break;
+
+	return &cache->Slots[slot];
+}
+
+BOOL GrowIncludeCache(LPINCLUDECACHE cache)
+{
+	LPINCLUDESLOT slots = cache->Slots;
+	ULONG count = cache->SlotCount;
+	ULONG i;
+
+	cache->Slots = (LPINCLUDESLOT)calloc(count * 2,sizeof(INCLUDESLOT));
+	if(!cache->Slots)
+	{
+		cache->Slots = slots;
+		return FALSE;
+	}
+
+	cache->SlotCount = count * 2;
+
+	for(i = 0; i < count; ++i)
+		if(slots[i].Path)
+			*FindIncludeSlot(cache,slots[i].Path,slots[i].Hash) = slots[i];
+
+	free(slots);
+
+	return TRUE;
+}
+
+BOOL AddIncludeEntry(LPINCLUDECACHE cache,LPCSTR path,LPINCLUDEENTRY entry)
+{
+	ULONG hash = HashIncludePath(path);
+	LPINCLUDESLOT slot;
+	LPSTR copy = NULL;
+
+	// Called with the lock held, nothing changes unless everything fits
+	if((cache->Count + 1) * 2 > cache->SlotCount && !GrowIncludeCache(cache))
+		return FALSE;
+
+	slot = FindIncludeSlot(cache,path,hash);
+
+	if(!slot->Path && !(copy = _strdup(path)))
+		return FALSE;
+
+	// New entries are listed so they are freed with the cache
+	if(entry->Index >= cache->EntryCount || cache->Entries[entry->Index] != entry)
+	{
+		if(cache->EntryCount == cache->EntryCapacity)
+		{
+			ULONG capacity = cache->EntryCapacity ? cache->EntryCapacity * 2 : INCLUDECACHE_BLOCK;
+			LPINCLUDEENTRY* entries = (LPINCLUDEENTRY*)realloc(cache->Entries,capacity * sizeof(LPINCLUDEENTRY));
+
+			if(!entries)
+			{
+				free(copy);
+				return FALSE;
+			}
+
+			cache->Entries = entries;
+			cache->EntryCapacity = capacity;
+		}
+
+		entry->Index = cache->EntryCount;
+		cache->Entries[cache->EntryCount++] = entry;
+	}
+
+	// A path loaded again points at the new version, the old one stays for whoever still reads it
+	if(copy)
+	{
+		slot->Path = copy;
+		slot->Hash = hash;
+		++cache->Count;
+	}
+
+	slot->Entry = entry;
+
+	return TRUE;
+}
+
+LPINCLUDEENTRY FindIncludeEntry(LPINCLUDECACHE cache,LPCSTR path)
+{
+	LPINCLUDESLOT slot;
+	LPINCLUDEENTRY entry;
+
+	EnterCriticalSection(&cache->Lock);
+
+	slot = FindIncludeSlot(cache,path,HashIncludePath(path));
+	entry = slot->Path ? slot->Entry : NULL;
+
+	LeaveCriticalSection(&cache->Lock);
+
+	return entry;
+}
+
+LPINCLUDEENTRY FindIncludeIdentity(LPINCLUDECACHE cache,LPINCLUDEENTRY entry)
+{
+	ULONG i;
+
+	// Files of unknown identity only match by path
+	if(!entry->Volume && !entry->FileIndex)
+		return NULL;
+
+	// Called with the lock held, only on loads so a linear search does, the latest version wins
+	for(i = cache->EntryCount; i--; )
+	{
+		LPINCLUDEENTRY loaded = cache->Entries[i];
+
+		if(loaded->Volume == entry->Volume && loaded->FileIndex == entry->FileIndex && loaded->Size == entry->Size && !memcmp(&loaded->LastWrite,&entry->LastWrite,sizeof(FILETIME)))
+			return loaded;
+	}
+
+	return NULL;
+}
+
+LPINCLUDEENTRY LoadIncludeEntry(LPINCLUDECACHE cache,LPCSTR path)
+{
+	BY_HANDLE_FILE_INFORMATION information;
+	LPINCLUDEENTRY entry;
+	LPINCLUDEENTRY loaded;
+
+	entry = (LPINCLUDEENTRY)calloc(1,sizeof(INCLUDEENTRY));
+	if(!entry)
+		return NULL;
+
+	InitializeCriticalSection(&entry->Lock);
+	InitializeTokenArray(&entry->Scratch);
+
+	// The entry is zeroed, a partly initialized one is freed like a whole one
+	if(!InitializeAtomTable(&entry->Atoms) || !InitializeLexerProfile(&entry->Lexer,LEXER_PROFILE_CPP,CPPKEYWORDS,FALSE))
+	{
+		FreeIncludeEntry(entry);
+		return NULL;
+	}
+
+	SetAtomTable(&entry->Lexer,&entry->Atoms);
+
+	// Errors are reported by every preprocessor that reads up to them
+	entry->Lexer.Quiet = TRUE;
+
+	if(!LoadFile(&entry->Lexer,path))
+	{
+		FreeIncludeEntry(entry);
+		return NULL;
+	}
+
+	// The identity comes from the handle the input was read through so it matches the contents
+	if(GetFileInformationByHandle(entry->Lexer.File,&information))
+	{
+		entry->Volume = information.dwVolumeSerialNumber;
+		entry->FileIndex = ((ULONGLONG)information.nFileIndexHigh << 32) | information.nFileIndexLow;
+		entry->LastWrite = information.ftLastWriteTime;
+		entry->Size = ((ULONGLONG)information.nFileSizeHigh << 32) | information.nFileSizeLow;
+	}
+
+	// The input outlives the handle, thousands of headers are not kept open
+	CloseHandle(entry->Lexer.File);
+	entry->Lexer.File = NULL;
+
+	// Another path to a file that is lexed already
+	EnterCriticalSection(&cache->Lock);
+
+	if(loaded = FindIncludeIdentity(cache,entry))
+	{
+		if(!AddIncludeEntry(cache,path,loaded))
+			loaded = NULL;
+
+		LeaveCriticalSection(&cache->Lock);
+
+		FreeIncludeEntry(entry);
+		return loaded;
+	}
+
+	LeaveCriticalSection(&cache->Lock);
+
+	// Split without the lock, only the directive lines are found now, the rest is lexed when first read
+	if(!SplitIncludeEntry(entry))
+	{
+		FreeIncludeEntry(entry);
+		return NULL;
+	}
+
+	FindIncludeGuard(entry);
+
+	// Built now, the entry is read by several threads without the lock once it is in the cache
+	if(!BuildLineTable(&entry->Lexer))
+	{
+		FreeIncludeEntry(entry);
+		return NULL;
+	}
+
+	// Another preprocessor may have loaded the same file meanwhile, the first one is kept
+	EnterCriticalSection(&cache->Lock);
+
+	if(!(loaded = FindIncludeIdentity(cache,entry)))
+		loaded = entry;
+
+	if(!AddIncludeEntry(cache,path,loaded))
+		loaded = NULL;
+
+	LeaveCriticalSection(&cache->Lock);
+
+	if(loaded != entry)
+		FreeIncludeEntry(entry);
+
+	return loaded;
+}
+
+BOOL IsIncludeEntryCurrent(LPINCLUDEENTRY entry,LPWIN32_FILE_ATTRIBUTE_DATA attributes)
+{
+	ULONGLONG size = ((ULONGLONG)attributes->nFileSizeHigh << 32) | attributes->nFileSizeLow;
+
+	return entry->Size == size && !memcmp(&entry->LastWrite,&attributes->ftLastWriteTime,sizeof(FILETIME));
+}
+
+BOOL SplitIncludeEntry(LPINCLUDEENTRY entry)
+{
+	LPLEXER lexer = &entry->Lexer;
+	ULONG capacity = 0;
+	ULONG position = 0;
+	ULONG end;
+
+	lexer->FilePosition = 0;
+
+	while(1)
+	{
+		ULONG error = SkipToDirective(lexer);
+		ULONG hash = lexer->FilePosition;
+
+		// The text up to the directive
+		if(hash > position && !AddIncludeSegment(entry,position,hash,FALSE,&capacity))
+			return FALSE;
+
+		if(error)
+			return TRUE;
+
+		SkipToLineEnd(lexer);
+		end = lexer->FilePosition;
+
+		if(!AddIncludeSegment(entry,hash,end,TRUE,&capacity))
+			return FALSE;
+
+		// Finding the conditional may have lexed the line and moved the lexer
+		lexer->FilePosition = position = end;
+	}
+}
+
+BOOL AddIncludeSegment(LPINCLUDEENTRY entry,ULONG offset,ULONG end,BOOL directive,PULONG capacity)
+{
+	LPINCLUDESEGMENT segment;
+
+	if(entry->SegmentCount == *capacity)
+	{
+		ULONG count = *capacity ? *capacity * 2 : SEGMENT_BLOCK;
+		LPINCLUDESEGMENT segments = (LPINCLUDESEGMENT)realloc(entry->Segments,count * sizeof(INCLUDESEGMENT));
+
+		if(!segments)
+			return FALSE;
+
+		entry->Segments = segments;
+		*capacity = count;
+	}
+
+	segment = &entry->Segments[entry->SegmentCount++];
+	memset(segment,0,sizeof(INCLUDESEGMENT));
+
+	segment->Offset = offset;
+	segment->End = end;
+	segment->Directive = directive;
+
+	if(directive)
+		segment->Conditional = FindSegmentConditional(entry,segment);
+
+	return TRUE;
+}
+
+ULONG FindSegmentConditional(LPINCLUDEENTRY entry,LPINCLUDESEGMENT segment)
+{
+	LPLEXER lexer = &entry->Lexer;
+	LPCSTR chars = lexer->FileBuffer + segment->Offset + 1;
+	ULONG length = 0;
+	ULONG i;
+
+	while(chars[0] == ' ' || chars[0] == '\t')
+		++chars;
+
+	// A comment or an escaped line break before the name, rare enough to lex the line for it
+	if(!(CHARCLASS(lexer,chars[0]) & CHAR_IDENTIFIER_START))
+	{
+		if(chars[0] != '/' && chars[0] != '\\')
+			return DIRECTIVE_NONE;
+
+		if(LexIncludeSegment(entry,segment) || segment->Count < 2 || segment->Tokens[1].Type != TOKEN_IDENTIFIER)
+			return DIRECTIVE_NONE;
+
+		chars = segment->Tokens[1].Value;
+	}
+
+	while(CHARCLASS(lexer,chars[length]) & CHAR_IDENTIFIER)
+		++length;
+
+	for(i = DIRECTIVE_IF; i <= DIRECTIVE_ENDIF; ++i)
+		if(strlen(DIRECTIVENAMES[i]) == length && !memcmp(DIRECTIVENAMES[i],chars,length))
+			return i;
+
+	return DIRECTIVE_NONE;
+}
+
+ULONG LexIncludeSegment(LPINCLUDEENTRY entry,LPINCLUDESEGMENT segment)
+{
+	LPLEXER lexer = &entry->Lexer;
+	ULONG error = ERROR_NONE;
+
+	// Lexed by whichever preprocessor reads the segment first
+	if(InterlockedCompareExchange(&segment->Lexed,FALSE,FALSE))
+		return ERROR_NONE;
+
+	EnterCriticalSection(&entry->Lock);
+
+	// Or by another one while this one waited
+	if(!InterlockedCompareExchange(&segment->Lexed,FALSE,FALSE))
+	{
+		entry->Scratch.Count = 0;
+		lexer->FilePosition = segment->Offset;
+
+		// The end of the file ends the last segment, a token running past the end of its segment is only made by broken input
+		if((segment->Error = TokenizeRange(lexer,&entry->Scratch,segment->End)) == ERROR_EOF)
+			segment->Error = ERROR_NONE;
+
+		if(segment->Error)
+			segment->ErrorOffset = lexer->FilePosition;
+
+		if(entry->Scratch.Count && !(segment->Tokens = (LPTOKEN)malloc(entry->Scratch.Count * sizeof(TOKEN))))
+			error = ERROR_INVALID;
+		else
+		{
+			if(entry->Scratch.Count)
+				memcpy(segment->Tokens,entry->Scratch.Tokens,entry->Scratch.Count * sizeof(TOKEN));
+
+			segment->Count = entry->Scratch.Count;
+
+			InterlockedExchange(&segment->Lexed,TRUE);
+		}
+	}
+
+	LeaveCriticalSection(&entry->Lock);
+
+	return error;
+}
+
+VOID FindIncludeGuard(LPINCLUDEENTRY entry)
+{
+	LPINCLUDESEGMENT segments = entry->Segments;
+	LPINCLUDESEGMENT open;
+	ULONG count = entry->SegmentCount;
+	ULONG depth = 0;
+	ULONG i = 0;
+
+	// Only comments may come before the #ifndef
+	if(i < count && !segments[i].Directive && IsSegmentBlank(entry,&segments[i]))
+		++i;
+
+	if(i == count || segments[i].Conditional != DIRECTIVE_IFNDEF)
+		return;
+
+	// The #ifndef has a name and nothing else
+	open = &segments[i];
+
+	if(LexIncludeSegment(entry,open) || open->Error || open->Count != 3 || open->Tokens[2].Type != TOKEN_IDENTIFIER)
+		return;
+
+	// Find the #endif closing it, the directives are told apart by the names found when splitting
+	for(; i < count; ++i)
+	{
+		ULONG conditional = segments[i].Conditional;
+
+		if(conditional == DIRECTIVE_IF || conditional == DIRECTIVE_IFDEF || conditional == DIRECTIVE_IFNDEF)
+			++depth;
+
+		// A branch for when the guard is defined
+		else if(depth == 1 && (conditional == DIRECTIVE_ELSE || conditional == DIRECTIVE_ELIF))
+			return;
+
+		else if(conditional == DIRECTIVE_ENDIF && !--depth)
+			break;
+	}
+
+	// Only comments may follow the line of the #endif
+	if(i == count || (i + 1 < count && (i + 2 < count || !IsSegmentBlank(entry,&segments[i + 1]))))
+		return;
+
+	entry->Guard = open->Tokens[2].Value;
+	entry->GuardLength = open->Tokens[2].Length;
+}
+
+BOOL IsSegmentBlank(LPINCLUDEENTRY entry,LPINCLUDESEGMENT segment)
+{
+	return !LexIncludeSegment(entry,segment) && !segment->Error && !segment->Count;
+}
+
+VOID FreeIncludeEntry(LPINCLUDEENTRY entry)
+{
+	ULONG i;
+
+	for(i = 0; i < entry->SegmentCount; ++i)
+		free(entry->Segments[i].Tokens);
+
+	free(entry->Segments);
+
+	DeleteCriticalSection(&entry->Lock);
+
+	UninitializeLexer(&entry->Lexer);
+	UninitializeTokenArray(&entry->Scratch);
+	UninitializeAtomTable(&entry->Atoms);
+
+	free(entry);
+}
+
+LPINCLUDEENTRY OpenSourceFile(LPPREPROCESSOR preprocessor,LPCSTR path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	CHAR full[MAX_PATH];
+	LPINCLUDEENTRY entry;
+	ULONG length;
+
+	// The cache is keyed by full path so every spelling of a path finds the same slot
+	length = GetFullPathNameA(path,MAX_PATH,full,NULL);
+	if(!length || length >= MAX_PATH)
+		return NULL;
+
+	entry = FindIncludeEntry(preprocessor->Cache,full);
+
+	// Files are taken not to change while a preprocessor runs, an entry it used is not checked again
+	if(entry && entry->Index < preprocessor->ReferenceCount && preprocessor->References[entry->Index].Entry)
+	{
+		++preprocessor->Statistics.IncludeHits;
+		return entry;
+	}
+
+	// Whether the file exists and whether the entry is current, without opening the file
+	if(!GetFileAttributesExA(full,GetFileExInfoStandard,&attributes) || (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return NULL;
+
+	if(entry && IsIncludeEntryCurrent(entry,&attributes))
+		++preprocessor->Statistics.IncludeHits;
+	else
+	{
+		if(!(entry = LoadIncludeEntry(preprocessor->Cache,full)))
+			return NULL;
+
+		++preprocessor->Statistics.IncludeLoads;
+	}
+
+	if(!ReferenceIncludeEntry(preprocessor,entry))
+		return NULL;
+
+	return entry;
+}
+
+BOOL ReferenceIncludeEntry(LPPREPROCESSOR preprocessor,LPINCLUDEENTRY entry)
+{
+	LPINCLUDEREFERENCE reference;
+
+	if(entry->Index >= preprocessor->ReferenceCount)
+	{
+		ULONG count = max(entry->Index + 1,preprocessor->ReferenceCount * 2);
+		LPINCLUDEREFERENCE references = (LPINCLUDEREFERENCE)realloc(preprocessor->References,count * sizeof(INCLUDEREFERENCE));
+
+		if(!references)
+			return FALSE;
+
+		memset(references + preprocessor->ReferenceCount,0,(count - preprocessor->ReferenceCount) * sizeof(INCLUDEREFERENCE));
+
+		preprocessor->References = references;
+		preprocessor->ReferenceCount = count;
+	}
+
+	reference = &preprocessor->References[entry->Index];
+
+	// The atom map grows as identifiers are met
+	reference->Entry = entry;
+
+	return TRUE;
+}
+
+BOOL EnterSourceFile(LPPREPROCESSOR preprocessor,LPCSTR path,LPINCLUDEENTRY entry)
+{
+	LPSOURCEFILE source;
+	ULONG length;
+
+	// Every file gets its own range of locations
+	length = entry->Lexer.FileBufferLength + FILE_BASE_GAP;
+
+	if(preprocessor->FileBase > 0xFFFFFFFF - length)
+		return FALSE;
+
+	if(preprocessor->FileCount == preprocessor->FileCapacity)
+	{
+		ULONG capacity = preprocessor->FileCapacity ? preprocessor->FileCapacity * 2 : 64;
+		LPSOURCEFILE* files = (LPSOURCEFILE*)realloc(preprocessor->Files,capacity * sizeof(LPSOURCEFILE));
+
+		if(!files)
+			return FALSE;
+
+		preprocessor->Files = files;
+		preprocessor->FileCapacity = capacity;
+	}
+
+	source = (LPSOURCEFILE)calloc(1,sizeof(SOURCEFILE));
+	if(!source)
+		return FALSE;
+
+	source->Name = _strdup(path);
+	if(!source->Name)
+	{
+		free(source);
+		return FALSE;
+	}
+
+	source->Entry = entry;
+
+	if(EnterSegment(source,0))
+	{
+		free(source->Name);
+		free(source);
+		return FALSE;
+	}
+
+	source->FileBase = preprocessor->FileBase;
+	preprocessor->FileBase += length;
+
+	preprocessor->Files[preprocessor->FileCount++] = source;
+
+	source->Parent = preprocessor->Source;
+	source->Conditionals = preprocessor->ConditionalCount;
+
+	preprocessor->Source = source;
+	++preprocessor->Depth;
+
+	++preprocessor->Statistics.Files;
+
+	return TRUE;
+}
+
+VOID LeaveSourceFile(LPPREPROCESSOR preprocessor)
+{
+	LPSOURCEFILE source = preprocessor->Source;
+
+	// Conditionals do not span files
+	while(preprocessor->ConditionalCount > source->Conditionals)
+	{
+		TOKEN token;
+
+		InitializeToken(&token);
+		token.Location = preprocessor->Conditionals[--preprocessor->ConditionalCount].Location;
+
+		PreprocessorError(preprocessor,&token,"unterminated conditional directive");
+	}
+
+	// The file is kept, locations refer to it
+	preprocessor->Source = source->Parent;
+	source->Parent = NULL;
+	--preprocessor->Depth;
+}
+
+LPSOURCEFILE FindSourceFile(LPPREPROCESSOR preprocessor,ULONG location)
+{
+	ULONG low = 0;
+	ULONG high = preprocessor->FileCount;
+
+	// Files are loaded in location order, find the last one starting at or before the location
+	while(low < high)
+	{
+		ULONG middle = low + (high - low) / 2;
+
+		if(preprocessor->Files[middle]->FileBase <= location)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if(!low)
+		return NULL;
+
+	return preprocessor->Files[low - 1];
+}
+
+LPINCLUDEENTRY ResolveInclude(LPPREPROCESSOR preprocessor,LPCSTR name,ULONG length,BOOL quoted,LPSTR path)
+{
+	CHAR key[MAX_PATH * 2];
+	LPINCLUDENAME found;
+	LPINCLUDEENTRY entry;
+	ULONG size = 0;
+
+	if(!length || length >= MAX_PATH)
+		return NULL;
+
+	// Quoted names also depend on the directory of the including file
+	if(quoted && preprocessor->Source)
+		for(size = (ULONG)strlen(preprocessor->Source->Name); size && preprocessor->Source->Name[size - 1] != '\\' && preprocessor->Source->Name[size - 1] != '/'; --size);
+
+	if(size >= MAX_PATH)
+		return SearchInclude(preprocessor,name,length,quoted,path);
+
+	memcpy(key,preprocessor->Source ? preprocessor->Source->Name : "",size);
+	key[size] = quoted ? '\"' : '<';
+	memcpy(key + size + 1,name,length);
+	key[size + 1 + length] = 0;
+
+	// A name resolved before needs no search
+	if(found = FindIncludeName(preprocessor,key,HashIncludePath(key)))
+	{
+		strcpy(path,found->Path);
+		++preprocessor->Statistics.IncludeHits;
+
+		return found->Entry;
+	}
+
+	// Missing files are not remembered, they are an error anyway
+	if(entry = SearchInclude(preprocessor,name,length,quoted,path))
+		AddIncludeName(preprocessor,key,path,entry);
+
+	return entry;
+}
+
+LPINCLUDEENTRY SearchInclude(LPPREPROCESSOR preprocessor,LPCSTR name,ULONG length,BOOL quoted,LPSTR path)
+{
+	LPINCLUDEENTRY entry;
+	ULONG i;
+
+	// Absolute paths are used as they are
+	if(name[0] == '\\' || name[0] == '/' || (length > 1 && name[1] == ':'))
+	{
+		memcpy(path,name,length);
+		path[length] = 0;
+
+		return OpenSourceFile(preprocessor,path);
+	}
+
+	// Quoted names are looked for next to the including file first
+	for(i = quoted && preprocessor->Source ? 0 : 1; i <= preprocessor->DirectoryCount; ++i)
+	{
+		LPCSTR directory;
+		ULONG size;
+
+		if(i)
+		{
+			directory = preprocessor->Directories[i - 1];
+			size = (ULONG)strlen(directory);
+		}
+		else
+		{
+			directory = preprocessor->Source->Name;
+
+			for(size = (ULONG)strlen(directory); size && directory[size - 1] != '\\' && directory[size - 1] != '/'; --size);
+		}
+
+		if(size + 1 + length >= MAX_PATH)
+			continue;
+
+		memcpy(path,directory,size);
+
+		if(size && path[size - 1] != '\\' && path[size - 1] != '/')
+			path[size++] = '\\';
+
+		memcpy(path + size,name,length);
+		path[size + length] = 0;
+
+		if(entry = OpenSourceFile(preprocessor,path))
+			return entry;
+	}
+
+	return NULL;
+}
+
+LPINCLUDENAME FindIncludeName(LPPREPROCESSOR preprocessor,LPCSTR key,ULONG hash)
+{
+	ULONG mask = preprocessor->NameSlotCount - 1;
+	ULONG slot;
+
+	if(!preprocessor->NameSlotCount)
+		return NULL;
+
+	for(slot = hash & mask; preprocessor->Names[slot].Key; slot = (slot + 1) & mask)
+		if(preprocessor->Names[slot].Hash == hash && !strcmp(preprocessor->Names[slot].Key,key))
+			return &preprocessor->Names[slot];
+
+	return NULL;
+}
+
+BOOL AddIncludeName(LPPREPROCESSOR preprocessor,LPCSTR key,LPCSTR path,LPINCLUDEENTRY entry)
+{
+	ULONG hash = HashIncludePath(key);
+	LPINCLUDENAME name;
+	ULONG mask;
+	ULONG slot;
+	ULONG i;
+
+	// Keep the table at most half full
+	if((preprocessor->NameCount + 1) * 2 > preprocessor->NameSlotCount)
+	{
+		LPINCLUDENAME names = preprocessor->Names;
+		ULONG count = preprocessor->NameSlotCount;
+
+		preprocessor->Names = (LPINCLUDENAME)calloc(count ? count * 2 : INCLUDENAME_BLOCK,sizeof(INCLUDENAME));
+		if(!preprocessor->Names)
+		{
+			preprocessor->Names = names;
+			return FALSE;
+		}
+
+		preprocessor->NameSlotCount = count ? count * 2 : INCLUDENAME_BLOCK;
+		mask = preprocessor->NameSlotCount - 1;
+
+		for(i = 0; i < count; ++i)
+		{
+			if(!names[i].Key)
+				continue;
+
+			for(slot = names[i].Hash & mask; preprocessor->Names[slot].Key; slot = (slot + 1) & mask);
+
+			preprocessor->Names[slot] = names[i];
+		}
+
+		free(names);
+	}
+
+	mask = preprocessor->NameSlotCount - 1;
+
+	for(slot = hash & mask; preprocessor->Names[slot].Key; slot = (slot + 1) & mask);
+
+	name = &preprocessor->Names[slot];
+
+	name->Key = _strdup(key);
+	name->Path = _strdup(path);
+
+	if(!name->Key || !name->Path)
+	{
+		free(name->Key);
+		free(name->Path);
+
+		name->Key = NULL;
+		name->Path = NULL;
+
+		return FALSE;
+	}
+
+	name->Hash = hash;
+	name->Entry = entry;
+
+	++preprocessor->NameCount;
+
+	return TRUE;
+}
+
+BOOL IsIncludeSkipped(LPPREPROCESSOR preprocessor,LPINCLUDEENTRY entry)
+{
+	ULONG atom;
+
+	if(preprocessor->References[entry->Index].Once)
+		return TRUE;
+
+	// A guard never met as an identifier names no macro
+	return entry->Guard && (atom = FindAtom(&preprocessor->Atoms,entry->Guard,entry->GuardLength)) && FindMacro(preprocessor,atom);
+}
+
+BOOL IsLineStart(LPSOURCEFILE source,LPTOKEN token)
+{
+	return IsLineStartAt(&source->Entry->Lexer,token->Location - source->FileBase);
+}
+
+BOOL IsLineContinuation(LPSOURCEFILE source,LPTOKEN token)
+{
+	LPCSTR chars = source->Entry->Lexer.FileBuffer + (token->Location - source->FileBase) + 1;
+
+	// A backslash right before the line break
+	if(chars[0] == '\r')
+		++chars;
+
+	return chars[0] == '\n';
+}
+
+ULONG EnterSegment(LPSOURCEFILE source,ULONG segment)
+{
+	LPINCLUDEENTRY entry = source->Entry;
+
+	source->Segment = segment;
+	source->Position = 0;
+
+	// Segments are lexed when first entered, tokens are read without checking again
+	if(segment < entry->SegmentCount)
+		return LexIncludeSegment(entry,&entry->Segments[segment]);
+
+	return ERROR_NONE;
+}
+
+ULONG ReadSegmentToken(LPPREPROCESSOR preprocessor,LPSOURCEFILE source,LPTOKEN token)
+{
+	LPINCLUDEENTRY entry = source->Entry;
+	LPINCLUDESEGMENT segment = &entry->Segments[source->Segment];
+	LPINCLUDEREFERENCE reference;
+	ULONG atom;
+
+	if(source->Position == segment->Count)
+	{
+		if(!segment->Error)
+			return ERROR_EOF;
+
+		// Reported once however often the end is peeked at
+		if(!source->Failed)
+		{
+			InitializeToken(token);
+			token->Location = source->FileBase + segment->ErrorOffset;
+
+			PreprocessorError(preprocessor,token,"invalid token");
+			source->Failed = TRUE;
+		}
+
+		return segment->Error;
+	}
+
+	*token = segment->Tokens[source->Position++];
+	token->Location += source->FileBase;
+
+	// Atoms of the entry become atoms of the preprocessor the first time they are met
+	if(atom = token->Atom)
+	{
+		reference = &preprocessor->References[entry->Index];
+
+		if(atom >= reference->AtomCount)
+		{
+			ULONG count = max(atom + 1,reference->AtomCount * 2);
+			PULONG atoms = (PULONG)realloc(reference->Atoms,count * sizeof(ULONG));
+
+			if(!atoms)
+				return ERROR_INVALID;
+
+			memset(atoms + reference->AtomCount,0,(count - reference->AtomCount) * sizeof(ULONG));
+
+			reference->Atoms = atoms;
+			reference->AtomCount = count;
+		}
+
+		if(!reference->Atoms[atom] && !(reference->Atoms[atom] = AddAtom(&preprocessor->Atoms,token->Value,token->Length)))
+			return ERROR_INVALID;
+
+		token->Atom = reference->Atoms[atom];
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG ReadEntryToken(LPPREPROCESSOR preprocessor,LPSOURCEFILE source,LPTOKEN token)
+{
+	ULONG error;
+
+	while(source->Segment < source->Entry->SegmentCount)
+	{
+		if((error = ReadSegmentToken(preprocessor,source,token)) != ERROR_EOF)
+			return error;
+
+		if(error = EnterSegment(source,source->Segment + 1))
+			return error;
+	}
+
+	return ERROR_EOF;
+}
+
+ULONG ReadFileToken(LPPREPROCESSOR preprocessor,LPTOKEN token)
+{
+	ULONG error;
+
+	while(preprocessor->Source)
+	{
+		LPSOURCEFILE source = preprocessor->Source;
+
+		if(error = ReadEntryToken(preprocessor,source,token))
+		{
+			if(error != ERROR_EOF)
+				return error;
+
+			// Go on with the including file
+			LeaveSourceFile(preprocessor);
+			continue;
+		}
+
+		if(IsPunctuation(token,PUNCTUATION_BACKSLASH) && IsLineContinuation(source,token))
+			continue;
+
+		return ERROR_NONE;
+	}
+
+	return ERROR_EOF;
+}
+
+ULONG ReadDirectiveToken(LPPREPROCESSOR preprocessor,LPTOKEN token)
+{
+	LPSOURCEFILE source = preprocessor->Source;
+	ULONG error;
+
+	// The directive ends with its line, which is where its segment ends
+	while(!(error = ReadSegmentToken(preprocessor,source,token)))
+	{
+		if(!IsPunctuation(token,PUNCTUATION_BACKSLASH) || !IsLineContinuation(source,token))
+			return ERROR_NONE;
+	}
+
+	return error;
+}
+
+VOID SkipDirectiveLine(LPPREPROCESSOR preprocessor)
+{
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	while(!ReadDirectiveToken(preprocessor,&token));
+}
+
+ULONG ReadSourceToken(LPPREPROCESSOR preprocessor,LPTOKEN token)
+{
+	ULONG error;
+
+	while(1)
+	{
+		// Expansions are read before the file
+		if(preprocessor->ExpansionCount)
+		{
+			LPEXPANSION expansion = &preprocessor->Expansions[preprocessor->ExpansionCount - 1];
+
+			if(expansion->Position < expansion->Count)
+			{
+				// Parameters and operators of a definition are read from lists of their own
+				if(IsSubstitution(expansion))
+				{
+					if(error = SubstituteExpansion(preprocessor))
+						return error;
+
+					continue;
+				}
+
+				*token = expansion->Tokens[expansion->Position++];
+
+				// The tokens of the definition are placed where the macro was used
+				if(expansion->Definition)
+					token->Location = expansion->Location;
+
+				// The first token is spaced like what the list replaces
+				if(expansion->Leading)
+				{
+					token->Flags = (token->Flags & ~TOKEN_SPACE) | expansion->Space;
+					expansion->Leading = FALSE;
+				}
+
+				token->Flags |= preprocessor->Space;
+				preprocessor->Space = 0;
+
+				return ERROR_NONE;
+			}
+
+			if(expansion->Barrier)
+				return ERROR_EOF;
+
+			PopExpansion(preprocessor);
+			continue;
+		}
+
+		if(error = ReadFileToken(preprocessor,token))
+			return error;
+
+		if(IsPunctuation(token,PUNCTUATION_PREPROCESSOR) && IsLineStart(preprocessor->Source,token))
+		{
+			if(error = ReadDirective(preprocessor,token))
+				return error;
+
+			continue;
+		}
+
+		token->Flags |= preprocessor->Space;
+		preprocessor->Space = 0;
+
+		return ERROR_NONE;
+	}
+}
+
+ULONG ReadExpandedToken(LPPREPROCESSOR preprocessor,LPTOKEN token)
+{
+	ULONG error;
+
+	while(1)
+	{
+		LPMACRO macro;
+
+		if(error = ReadSourceToken(preprocessor,token))
+			return error;
+
+		if(token->Type != TOKEN_IDENTIFIER || (token->TypeEx & TOKEN_NOEXPAND) || !(macro = FindMacro(preprocessor,token->Atom)))
+			return ERROR_NONE;
+
+		// Names of macros being expanded are never expanded again, not even later
+		if(macro->Disabled)
+		{
+			token->TypeEx |= TOKEN_NOEXPAND;
+			return ERROR_NONE;
+		}
+
+		// Function-like macros are only expanded when called
+		if((macro->Flags & MACRO_FUNCTION) && !PeekParenthesis(preprocessor))
+			return ERROR_NONE;
+
+		if(error = ExpandMacro(preprocessor,macro,token))
+			return error;
+	}
+}
+
+LPEXPANSION PushExpansion(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN tokens,ULONG count,BOOL barrier)
+{
+	LPEXPANSION expansion;
+
+	if(preprocessor->ExpansionCount == preprocessor->ExpansionCapacity)
+	{
+		ULONG capacity = preprocessor->ExpansionCapacity ? preprocessor->ExpansionCapacity * 2 : 64;
+		LPEXPANSION expansions = (LPEXPANSION)realloc(preprocessor->Expansions,capacity * sizeof(EXPANSION));
+
+		if(!expansions)
+			return NULL;
+
+		preprocessor->Expansions = expansions;
+		preprocessor->ExpansionCapacity = capacity;
+	}
+
+	expansion = &preprocessor->Expansions[preprocessor->ExpansionCount++];
+	memset(expansion,0,sizeof(EXPANSION));
+
+	expansion->Macro = macro;
+	expansion->Tokens = tokens;
+	expansion->Count = count;
+	expansion->Barrier = barrier;
+
+	if(macro)
+		++macro->Disabled;
+
+	return expansion;
+}
+
+VOID PopExpansion(LPPREPROCESSOR preprocessor)
+{
+	LPEXPANSION expansion = &preprocessor->Expansions[--preprocessor->ExpansionCount];
+
+	if(expansion->Macro)
+		--expansion->Macro->Disabled;
+
+	if(expansion->Owned)
+		free(expansion->Tokens);
+
+	if(expansion->Call)
+		FreeMacroCall(expansion->Call);
+}
+
+BOOL PeekParenthesis(LPPREPROCESSOR preprocessor)
+{
+	LPSOURCEFILE source;
+	ULONG segment;
+	ULONG position;
+	TOKEN token;
+
+	// The next token may be in any expansion below the current one, the ones read to their end are left as reading would leave them
+	while(preprocessor->ExpansionCount)
+	{
+		LPEXPANSION expansion = &preprocessor->Expansions[preprocessor->ExpansionCount - 1];
+
+		if(expansion->Position < expansion->Count)
+		{
+			// A parameter may begin with the parenthesis
+			if(IsSubstitution(expansion))
+			{
+				if(SubstituteExpansion(preprocessor))
+					return FALSE;
+
+				continue;
+			}
+
+			return IsPunctuation(&expansion->Tokens[expansion->Position],PUNCTUATION_PARENTHESESOPEN);
+		}
+
+		if(expansion->Barrier)
+			return FALSE;
+
+		PopExpansion(preprocessor);
+	}
+
+	// Or in the file, calls do not go on past its end or into a directive
+	if(!(source = preprocessor->Source))
+		return FALSE;
+
+	InitializeToken(&token);
+	segment = source->Segment;
+	position = source->Position;
+
+	while(1)
+	{
+		if(ReadEntryToken(preprocessor,source,&token))
+			break;
+
+		if(IsPunctuation(&token,PUNCTUATION_BACKSLASH) && IsLineContinuation(source,&token))
+			continue;
+
+		if(IsPunctuation(&token,PUNCTUATION_PREPROCESSOR) && IsLineStart(source,&token))
+			break;
+
+		source->Segment = segment;
+		source->Position = position;
+
+		return IsPunctuation(&token,PUNCTUATION_PARENTHESESOPEN);
+	}
+
+	source->Segment = segment;
+	source->Position = position;
+
+	return FALSE;
+}
+
+ULONG ReadArguments(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN name,LPMACROCALL call)
+{
+	LPMACROARGUMENT argument = call->Arguments;
+	BOOL empty = TRUE;
+	BOOL file = FALSE;
+	BOOL valid;
+	ULONG count = 0;
+	ULONG depth = 0;
+	ULONG error;
+	TOKEN token;
+	ULONG i;
+
+	InitializeToken(&token);
+
+	// Skip the parenthesis PeekParenthesis found
+	if(error = ReadSourceToken(preprocessor,&token))
+		return error;
+
+	while(1)
+	{
+		LPEXPANSION expansion = NULL;
+		LPTOKEN source = NULL;
+
+		if(error = ReadSourceToken(preprocessor,&token))
+		{
+			if(error == ERROR_EOF)
+				PreprocessorError(preprocessor,name,"unterminated argument list invoking macro '%s'",GetAtomName(&preprocessor->Atoms,macro->Name));
+
+			return ERROR_INVALID;
+		}
+
+		// Tokens read from an argument of another call can be read in place from there
+		if(preprocessor->ExpansionCount)
+		{
+			expansion = &preprocessor->Expansions[preprocessor->ExpansionCount - 1];
+
+			if(expansion->Holder)
+				source = &expansion->Tokens[expansion->Position - 1];
+		}
+		else
+			file = TRUE;
+
+		if(IsPunctuation(&token,PUNCTUATION_PARENTHESESOPEN))
+			++depth;
+
+		else if(IsPunctuation(&token,PUNCTUATION_PARENTHESESCLOSE))
+		{
+			if(!depth--)
+				break;
+		}
+
+		// Commas in parentheses and the ones taken by the variadic parameter do not separate arguments
+		else if(IsPunctuation(&token,PUNCTUATION_COMMA) && !depth && (!(macro->Flags & MACRO_VARIADIC) || count + 1 < macro->Parameters))
+		{
+			if(++count < macro->Parameters)
+				argument = &call->Arguments[count];
+
+			continue;
+		}
+
+		empty = FALSE;
+
+		// Extra arguments are read to find the end, the count is checked after
+		if(count >= macro->Parameters)
+			continue;
+
+		// Read in place while the tokens follow each other as they were held
+		if(argument->Holder && source == argument->Tokens + argument->Count && expansion->Holder == argument->Holder && token.Flags == source->Flags)
+		{
+			argument->Flags &= expansion->Flags;
+			++argument->Count;
+		}
+		else if(!argument->Count && source)
+		{
+			argument->Tokens = source;
+			argument->Count = 1;
+			argument->Holder = expansion->Holder;
+			argument->Flags = expansion->Flags;
+
+			++argument->Holder->References;
+		}
+		else
+		{
+			// Copied once it spans the file or several lists
+			if(!argument->Count)
+				argument->Offset = call->Copies.Count;
+
+			if((argument->Holder && !CopyArgument(call,argument)) || !AppendTokenEntry(&call->Copies,&token))
+			{
+				PreprocessorError(preprocessor,name,"out of memory");
+				return ERROR_INVALID;
+			}
+
+			++argument->Count;
+			continue;
+		}
+
+		// Nothing in the rest of a flat list ends the argument, it is taken at once
+		if(expansion->Flags & ARGUMENT_FLAT)
+		{
+			argument->Count += expansion->Count - expansion->Position;
+			expansion->Position = expansion->Count;
+		}
+	}
+
+	// A call with nothing between the parentheses passes one empty argument, the variadic one may be left out
+	if(!macro->Parameters)
+		valid = !count && empty;
+	else if(macro->Flags & MACRO_VARIADIC)
+		valid = count + 1 == macro->Parameters || count + 2 == macro->Parameters;
+	else
+		valid = count + 1 == macro->Parameters;
+
+	if(!valid)
+	{
+		PreprocessorError(preprocessor,name,"macro '%s' takes %u arguments, but %u given",GetAtomName(&preprocessor->Atoms,macro->Name),macro->Parameters,count + !empty);
+		return ERROR_REPORTED;
+	}
+
+	// Left out arguments stay empty, copies are in place now that they no longer grow
+	for(i = 0; i < macro->Parameters; ++i)
+	{
+		argument = &call->Arguments[i];
+
+		if(!argument->Holder)
+			argument->Tokens = call->Copies.Tokens + argument->Offset;
+
+		// Names a directive read on the way may have defined are looked at again
+		else if((argument->Flags & ARGUMENT_PLAIN) && !file)
+			argument->State = ARGUMENT_RAW;
+	}
+
+	return ERROR_NONE;
+}
+
+BOOL CopyArgument(LPMACROCALL call,LPMACROARGUMENT argument)
+{
+	ULONG i;
+
+	argument->Offset = call->Copies.Count;
+
+	for(i = 0; i < argument->Count; ++i)
+		if(!AppendTokenEntry(&call->Copies,&argument->Tokens[i]))
+			return FALSE;
+
+	FreeMacroCall(argument->Holder);
+
+	argument->Holder = NULL;
+	argument->Flags = 0;
+
+	return TRUE;
+}
+
+ULONG ExpandTokens(LPPREPROCESSOR preprocessor,LPTOKEN tokens,ULONG count,LPTOKENARRAY expanded)
+{
+	ULONG base = preprocessor->ExpansionCount;
+	ULONG space = preprocessor->Space;
+	ULONG error;
+	TOKEN token;
+
+	if(!count)
+		return ERROR_NONE;
+
+	preprocessor->Space = 0;
+
+	// Read in place, the barrier keeps the expansion from reading what comes after the list
+	if(!PushExpansion(preprocessor,NULL,tokens,count,TRUE))
+		return ERROR_INVALID;
+
+	while(!(error = ReadExpandedToken(preprocessor,&token)))
+	{
+		if(!AppendTokenEntry(expanded,&token))
+		{
+			error = ERROR_INVALID;
+			break;
+		}
+	}
+
+	// Expansions left above the barrier by an error go with it
+	while(preprocessor->ExpansionCount > base)
+		PopExpansion(preprocessor);
+
+	// Space left at the end of the list stays in it
+	preprocessor->Space = space;
+
+	return error == ERROR_EOF ? ERROR_NONE : error;
+}
+
+ULONG ExpandMacro(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN name)
+{
+	LPEXPANSION expansion;
+	LPMACROCALL call = NULL;
+	ULONG error;
+
+	++preprocessor->Statistics.Expansions;
+
+	if(macro->Flags & (MACRO_LINE | MACRO_FILE))
+		return ExpandBuiltinMacro(preprocessor,macro,name);
+
+	if(macro->Flags & MACRO_FUNCTION)
+	{
+		if(!(call = CreateMacroCall(macro)))
+			return ERROR_INVALID;
+
+		// A wrong call expands to nothing
+		if(error = ReadArguments(preprocessor,macro,name,call))
+		{
+			FreeMacroCall(call);
+			return error == ERROR_REPORTED ? ERROR_NONE : error;
+		}
+	}
+
+	if(!macro->Count)
+	{
+		if(call)
+			FreeMacroCall(call);
+
+		preprocessor->Space |= name->Flags & TOKEN_SPACE;
+
+		return ERROR_NONE;
+	}
+
+	// The definition is read in place, the macro stays disabled until its whole expansion has been read
+	if(!(expansion = PushExpansion(preprocessor,macro,macro->Tokens,macro->Count,FALSE)))
+	{
+		if(call)
+			FreeMacroCall(call);
+
+		return ERROR_INVALID;
+	}
+
+	expansion->Definition = TRUE;
+	expansion->Location = name->Location;
+	expansion->Call = call;
+	expansion->Leading = TRUE;
+	expansion->Space = name->Flags & TOKEN_SPACE;
+
+	return ERROR_NONE;
+}
+
+ULONG ExpandBuiltinMacro(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN name)
+{
+	LPEXPANSION expansion;
+	LPCSTR file = "<command line>";
+	ULONG line = 0;
+	ULONG column;
+	LPTOKEN token;
+	CHAR number[16];
+
+	// Where the name was used, the outermost call when it comes from a definition
+	GetPreprocessorLine(preprocessor,name->Location,&file,&line,&column);
+
+	token = (LPTOKEN)malloc(sizeof(TOKEN));
+	if(!token)
+		return ERROR_INVALID;
+
+	InitializeToken(token);
+
+	if(macro->Flags & MACRO_LINE)
+	{
+		sprintf(number,"%lu",line);
+
+		token->Type = TOKEN_NUMBER;
+		token->TypeEx = NUMBER_INTEGER;
+		token->Integer = line;
+		token->Length = (ULONG)strlen(number);
+		token->Value = StoreStringBlock(&preprocessor->Strings,number,token->Length);
+	}
+	else
+	{
+		// File names are kept until the preprocessor is uninitialized
+		token->Type = TOKEN_STRING;
+		token->Length = (ULONG)strlen(file);
+		token->Value = file;
+	}
+
+	token->Location = name->Location;
+	token->Flags = name->Flags & TOKEN_SPACE;
+
+	if(!token->Value || !(expansion = PushExpansion(preprocessor,NULL,token,1,FALSE)))
+	{
+		free(token);
+		return ERROR_INVALID;
+	}
+
+	expansion->Owned = TRUE;
+
+	return ERROR_NONE;
+}
+
+LPMACROCALL CreateMacroCall(LPMACRO macro)
+{
+	ULONG parameters = macro->Parameters;
+	LPMACROCALL call;
+
+	call = (LPMACROCALL)calloc(1,sizeof(MACROCALL) + parameters * sizeof(TOKENARRAY) + parameters * sizeof(MACROARGUMENT));
+	if(!call)
+		return NULL;
+
+	InitializeTokenArray(&call->Copies);
+
+	call->Expanded = (LPTOKENARRAY)(call + 1);
+	call->Arguments = (LPMACROARGUMENT)(call->Expanded + parameters);
+	call->Parameters = parameters;
+	call->References = 1;
+
+	return call;
+}
+
+VOID FreeMacroCall(LPMACROCALL call)
+{
+	ULONG i;
+
+	// Kept while arguments of other calls are read in place from its tokens
+	if(--call->References)
+		return;
+
+	for(i = 0; i < call->Parameters; ++i)
+	{
+		UninitializeTokenArray(&call->Expanded[i]);
+
+		if(call->Arguments[i].Holder)
+			FreeMacroCall(call->Arguments[i].Holder);
+	}
+
+	UninitializeTokenArray(&call->Copies);
+
+	free(call);
+}
+
+BOOL IsSubstitution(LPEXPANSION expansion)
+{
+	return expansion->Definition && (expansion->Tokens[expansion->Position].Type == TOKEN_PARAMETER || FindOperatorRun(expansion->Macro,expansion->Position));
+}
+
+ULONG FindOperatorRun(LPMACRO macro,ULONG position)
+{
+	ULONG end = position + 1;
+
+	// Stringizing takes the parameter after it
+	if((macro->Flags & MACRO_FUNCTION) && IsPunctuation(&macro->Tokens[position],PUNCTUATION_PREPROCESSOR))
+		++end;
+
+	// Pasting takes the token after it, as often as it is chained
+	while(end + 1 < macro->Count && IsPunctuation(&macro->Tokens[end],PUNCTUATION_PREPROCESSORMERGE))
+		end += 2;
+
+	return end - position > 1 ? end - position : 0;
+}
+
+ULONG SubstituteExpansion(LPPREPROCESSOR preprocessor)
+{
+	LPEXPANSION expansion = &preprocessor->Expansions[preprocessor->ExpansionCount - 1];
+	LPMACRO macro = expansion->Macro;
+	LPMACROCALL call = expansion->Call;
+	ULONG location = expansion->Location;
+	ULONG begin = expansion->Position;
+	ULONG length = FindOperatorRun(macro,begin);
+	ULONG space = expansion->Leading ? expansion->Space : macro->Tokens[begin].Flags & TOKEN_SPACE;
+	TOKENARRAY result;
+	LPTOKEN tokens;
+	ULONG count;
+	ULONG error;
+
+	expansion->Leading = FALSE;
+
+	// A parameter is read from its argument in place
+	if(!length)
+	{
+		LPMACROARGUMENT argument = &call->Arguments[macro->Tokens[begin].TypeEx];
+
+		++expansion->Position;
+
+		// Expanding the argument may move the expansion stack
+		if(error = GetArgument(preprocessor,macro,call,macro->Tokens[begin].TypeEx,&tokens,&count))
+			return error;
+
+		if(!count)
+		{
+			preprocessor->Space |= space;
+			return ERROR_NONE;
+		}
+
+		if(!(expansion = PushExpansion(preprocessor,NULL,tokens,count,FALSE)))
+			return ERROR_INVALID;
+
+		expansion->Leading = TRUE;
+		expansion->Space = space;
+
+		// Calls in the definition read their arguments from the tokens in place, the call holding them stays
+		expansion->Holder = argument->State == ARGUMENT_RAW && argument->Holder ? argument->Holder : call;
+		expansion->Flags = argument->Flags;
+
+		return ERROR_NONE;
+	}
+
+	// Only the operators make tokens of their own
+	expansion->Position += length;
+
+	InitializeTokenArray(&result);
+
+	if(error = SubstituteRun(preprocessor,macro,call,location,begin,begin + length,&result))
+	{
+		UninitializeTokenArray(&result);
+		return error;
+	}
+
+	if(!result.Count)
+	{
+		UninitializeTokenArray(&result);
+		preprocessor->Space |= space;
+		return ERROR_NONE;
+	}
+
+	if(!(expansion = PushExpansion(preprocessor,NULL,result.Tokens,result.Count,FALSE)))
+	{
+		UninitializeTokenArray(&result);
+		return ERROR_INVALID;
+	}
+
+	expansion->Owned = TRUE;
+	expansion->Leading = TRUE;
+	expansion->Space = space;
+
+	return ERROR_NONE;
+}
+
+ULONG GetArgument(LPPREPROCESSOR preprocessor,LPMACRO macro,LPMACROCALL call,ULONG parameter,LPTOKEN* tokens,PULONG count)
+{
+	LPMACROARGUMENT argument = &call->Arguments[parameter];
+	ULONG error;
+
+	if(argument->State == ARGUMENT_UNUSED)
+	{
+		argument->Flags = GetArgumentFlags(preprocessor,argument->Tokens,argument->Count);
+
+		// Arguments naming no macro expand to themselves and are not copied
+		if(argument->Flags & ARGUMENT_PLAIN)
+			argument->State = ARGUMENT_RAW;
+		else
+		{
+			argument->State = ARGUMENT_EXPANDED;
+
+			// Expanded once however often it is used, as if the macro was not being expanded yet
+			--macro->Disabled;
+			error = ExpandTokens(preprocessor,argument->Tokens,argument->Count,&call->Expanded[parameter]);
+			++macro->Disabled;
+
+			if(error)
+				return error;
+
+			// Calls reading their arguments from it in place need not look at them again
+			argument->Flags = GetArgumentFlags(preprocessor,call->Expanded[parameter].Tokens,call->Expanded[parameter].Count);
+		}
+	}
+
+	if(argument->State == ARGUMENT_RAW)
+	{
+		*tokens = argument->Tokens;
+		*count = argument->Count;
+	}
+	else
+	{
+		*tokens = call->Expanded[parameter].Tokens;
+		*count = call->Expanded[parameter].Count;
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG GetArgumentFlags(LPPREPROCESSOR preprocessor,LPTOKEN tokens,ULONG count)
+{
+	ULONG flags = ARGUMENT_PLAIN | ARGUMENT_FLAT;
+	ULONG i;
+
+	for(i = 0; i < count && flags; ++i)
+	{
+		if(tokens[i].Type == TOKEN_IDENTIFIER && !(tokens[i].TypeEx & TOKEN_NOEXPAND) && FindMacro(preprocessor,tokens[i].Atom))
+			flags &= ~ARGUMENT_PLAIN;
+
+		else if(IsPunctuation(&tokens[i],PUNCTUATION_PARENTHESESOPEN) || IsPunctuation(&tokens[i],PUNCTUATION_PARENTHESESCLOSE) || IsPunctuation(&tokens[i],PUNCTUATION_COMMA))
+			flags &= ~ARGUMENT_FLAT;
+	}
+
+	return flags;
+}
+
+ULONG SubstituteRun(LPPREPROCESSOR preprocessor,LPMACRO macro,LPMACROCALL call,ULONG location,ULONG begin,ULONG end,LPTOKENARRAY result)
+{
+	BOOL placemarker = FALSE;
+	ULONG error = ERROR_NONE;
+	ULONG i;
+
+	for(i = begin; i < end && !error; ++i)
+	{
+		LPTOKEN token = &macro->Tokens[i];
+		LPTOKEN tokens;
+		ULONG count;
+		TOKEN value;
+
+		// Stringizing
+		if(IsPunctuation(token,PUNCTUATION_PREPROCESSOR) && (macro->Flags & MACRO_FUNCTION) && i + 1 < end && macro->Tokens[i + 1].Type == TOKEN_PARAMETER)
+		{
+			ULONG parameter = macro->Tokens[++i].TypeEx;
+
+			if(!StringizeTokens(preprocessor,call->Arguments[parameter].Tokens,call->Arguments[parameter].Count,&value))
+				error = ERROR_INVALID;
+
+			value.Location = location;
+			value.Flags = token->Flags;
+
+			if(!error && !AppendTokenEntry(result,&value))
+				error = ERROR_INVALID;
+
+			placemarker = FALSE;
+			continue;
+		}
+
+		// Pasting
+		if(IsPunctuation(token,PUNCTUATION_PREPROCESSORMERGE) && i + 1 < end)
+		{
+			LPTOKEN operand = &macro->Tokens[++i];
+
+			// The right operand is not expanded
+			if(operand->Type == TOKEN_PARAMETER)
+			{
+				tokens = call->Arguments[operand->TypeEx].Tokens;
+				count = call->Arguments[operand->TypeEx].Count;
+
+				// A comma pasted with variadic arguments goes away when they are empty and stays apart otherwise
+				if((macro->Flags & MACRO_VARIADIC) && operand->TypeEx + 1 == macro->Parameters && !placemarker && result->Count && IsPunctuation(&result->Tokens[result->Count - 1],PUNCTUATION_COMMA))
+				{
+					if(!count)
+						--result->Count;
+					else if(!ReserveTokenArray(result,count))
+						error = ERROR_INVALID;
+					else
+					{
+						memcpy(result->Tokens + result->Count,tokens,count * sizeof(TOKEN));
+						result->Count += count;
+					}
+
+					continue;
+				}
+			}
+			else
+			{
+				value = *operand;
+				value.Location = location;
+
+				tokens = &value;
+				count = 1;
+			}
+
+			if(!count)
+				continue;
+
+			// Pasting with an empty argument leaves the other operand
+			if(placemarker || !result->Count)
+			{
+				if(!ReserveTokenArray(result,count))
+					error = ERROR_INVALID;
+				else
+				{
+					memcpy(result->Tokens + result->Count,tokens,count * sizeof(TOKEN));
+					result->Count += count;
+				}
+
+				placemarker = FALSE;
+				continue;
+			}
+
+			// The first token is pasted, the rest follow it
+			if(PasteTokens(preprocessor,&result->Tokens[result->Count - 1],&tokens[0]))
+			{
+				++tokens;
+				--count;
+			}
+			else
+			{
+				TOKEN name;
+
+				// Reported where the macro was used
+				InitializeToken(&name);
+				name.Location = location;
+
+				PreprocessorError(preprocessor,&name,"pasting \"%.*s\" and \"%.*s\" does not give a valid preprocessing token",result->Tokens[result->Count - 1].Length,result->Tokens[result->Count - 1].Value,tokens[0].Length,tokens[0].Value);
+			}
+
+			if(count)
+			{
+				if(!ReserveTokenArray(result,count))
+					error = ERROR_INVALID;
+				else
+				{
+					memcpy(result->Tokens + result->Count,tokens,count * sizeof(TOKEN));
+					result->Count += count;
+				}
+			}
+
+			continue;
+		}
+
+		// A left operand of pasting is not expanded either
+		if(token->Type == TOKEN_PARAMETER)
+		{
+			tokens = call->Arguments[token->TypeEx].Tokens;
+			count = call->Arguments[token->TypeEx].Count;
+
+			placemarker = !count;
+
+			if(count)
+			{
+				if(!ReserveTokenArray(result,count))
+					error = ERROR_INVALID;
+				else
+				{
+					memcpy(result->Tokens + result->Count,tokens,count * sizeof(TOKEN));
+					result->Count += count;
+				}
+			}
+
+			continue;
+		}
+
+		// The tokens of the definition are placed where the macro was used
+		value = *token;
+		value.Location = location;
+
+		if(!AppendTokenEntry(result,&value))
+			error = ERROR_INVALID;
+
+		placemarker = FALSE;
+	}
+
+	return error;
+}
+
+BOOL SpellToken(LPSTRING string,LPTOKEN token)
+{
+	ULONG i;
+
+	if(token->Type != TOKEN_STRING && token->Type != TOKEN_LITERAL)
+		return AppendString(string,token->Value,token->Length);
+
+	// Values of strings are decoded, spell them with their escape sequences again
+	if(!AppendChar(string,token->Type == TOKEN_STRING ? '\"' : '\''))
+		return FALSE;
+
+	for(i = 0; i < token->Length; ++i)
+	{
+		CHAR chr = token->Value[i];
+		CHAR escape[5];
+
+		switch(chr)
+		{
+		case '\n': escape[1] = 'n'; break;
+		case '\t': escape[1] = 't'; break;
+		case '\r': escape[1] = 'r'; break;
+		case '\\': escape[1] = '\\'; break;
+		case '\"': escape[1] = '\"'; break;
+		case '\'': escape[1] = '\''; break;
+
+		default:
+			if((UCHAR)chr < ' ')
+			{
+				sprintf(escape,"\\%03o",(UCHAR)chr);
+
+				if(!AppendString(string,escape,4))
+					return FALSE;
+			}
+			else if(!AppendChar(string,chr))
+				return FALSE;
+
+			continue;
+		}
+
+		escape[0] = '\\';
+
+		if(!AppendString(string,escape,2))
+			return FALSE;
+	}
+
+	return AppendChar(string,token->Type == TOKEN_STRING ? '\"' : '\'');
+}
+
+BOOL StringizeTokens(LPPREPROCESSOR preprocessor,LPTOKEN tokens,ULONG count,LPTOKEN token)
+{
+	LPSTRING scratch = &preprocessor->Scratch;
+	ULONG i;
+
+	ClearString(scratch);
+
+	for(i = 0; i < count; ++i)
+	{
+		if(!SpellToken(scratch,&tokens[i]))
+			return FALSE;
+
+		// Tokens with space before them are spelled apart
+		if(i + 1 < count && (tokens[i + 1].Flags & TOKEN_SPACE) && !AppendChar(scratch,' '))
+			return FALSE;
+	}
+
+	InitializeToken(token);
+
+	token->Type = TOKEN_STRING;
+	token->Length = scratch->Length;
+	token->Value = StoreStringBlock(&preprocessor->Strings,scratch->Length ? scratch->Buffer : "",scratch->Length);
+
+	return token->Value != NULL;
+}
+
+BOOL PasteTokens(LPPREPROCESSOR preprocessor,LPTOKEN left,LPTOKEN right)
+{
+	LPSTRING scratch = &preprocessor->Scratch;
+	LPLEXER lexer = &preprocessor->Paste;
+	TOKEN token;
+	TOKEN next;
+
+	ClearString(scratch);
+
+	if(!SpellToken(scratch,left) || !SpellToken(scratch,right))
+		return FALSE;
+
+	if(!LoadScratch(preprocessor,"<paste>"))
+		return FALSE;
+
+	InitializeToken(&token);
+	InitializeToken(&next);
+
+	// The spelling has to be exactly one token
+	if(ReadToken(lexer,&token) || ReadToken(lexer,&next) != ERROR_EOF)
+	{
+		UnloadFile(lexer);
+		return FALSE;
+	}
+
+	token.Value = StoreStringBlock(&preprocessor->Strings,token.Value,token.Length);
+	token.Location = left->Location;
+	token.Flags = left->Flags;
+
+	UnloadFile(lexer);
+
+	if(!token.Value)
+		return FALSE;
+
+	*left = token;
+
+	return TRUE;
+}
+
+BOOL LoadScratch(LPPREPROCESSOR preprocessor,LPCSTR name)
+{
+	LPSTRING scratch = &preprocessor->Scratch;
+	ULONG length = scratch->Length;
+
+	// Padded so the lexer uses the text in place
+	if(!ReserveString(scratch,FILE_PADDING))
+		return FALSE;
+
+	memset(scratch->Buffer + length,0,FILE_PADDING);
+
+	return LoadBuffer(&preprocessor->Paste,scratch->Buffer,length,TRUE,name);
+}
+
+ULONG ReadDirective(LPPREPROCESSOR preprocessor,LPTOKEN hash)
+{
+	ULONG directive;
+	ULONG error;
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	// A lone # does nothing
+	if(error = ReadDirectiveToken(preprocessor,&token))
+		return error == ERROR_EOF ? ERROR_NONE : error;
+
+	++preprocessor->Statistics.Directives;
+
+	directive = token.Type == TOKEN_IDENTIFIER ? (ULONG)(ULONG_PTR)GetAtomData(&preprocessor->Atoms,token.Atom) : DIRECTIVE_NONE;
+
+	switch(directive)
+	{
+	case DIRECTIVE_INCLUDE:
+		return ReadInclude(preprocessor,&token);
+
+	case DIRECTIVE_DEFINE:
+		return ReadDefine(preprocessor);
+
+	case DIRECTIVE_UNDEFINE:
+		return ReadUndefine(preprocessor);
+
+	case DIRECTIVE_IF:
+	case DIRECTIVE_IFDEF:
+	case DIRECTIVE_IFNDEF:
+	case DIRECTIVE_ELIF:
+	case DIRECTIVE_ELSE:
+	case DIRECTIVE_ENDIF:
+		return ReadConditional(preprocessor,directive,&token);
+
+	case DIRECTIVE_ERROR:
+	case DIRECTIVE_WARNING:
+		return ReadMessage(preprocessor,directive,&token);
+
+	case DIRECTIVE_PRAGMA:
+		return ReadPragma(preprocessor,hash,&token);
+
+	case DIRECTIVE_LINE:
+		return ReadLine(preprocessor,&token);
+	}
+
+	PreprocessorError(preprocessor,&token,"invalid preprocessing directive #%.*s",token.Length,token.Value);
+	SkipDirectiveLine(preprocessor);
+
+	return ERROR_NONE;
+}
+
+ULONG ReadDefine(LPPREPROCESSOR preprocessor)
+{
+	TOKENARRAY body;
+	PULONG parameters = NULL;
+	LPMACRO macro;
+	LPMACRO previous;
+	TOKEN name;
+	TOKEN token;
+	ULONG error;
+	ULONG i;
+
+	InitializeToken(&name);
+	InitializeToken(&token);
+	InitializeTokenArray(&body);
+
+	if(ReadDirectiveToken(preprocessor,&name) || name.Type != TOKEN_IDENTIFIER)
+	{
+		PreprocessorError(preprocessor,&name,"macro names must be identifiers");
+		SkipDirectiveLine(preprocessor);
+		return ERROR_NONE;
+	}
+
+	if((ULONG)(ULONG_PTR)GetAtomData(&preprocessor->Atoms,name.Atom) == DIRECTIVE_DEFINED)
+	{
+		PreprocessorError(preprocessor,&name,"'defined' cannot be used as a macro name");
+		SkipDirectiveLine(preprocessor);
+		return ERROR_NONE;
+	}
+
+	macro = (LPMACRO)calloc(1,sizeof(MACRO));
+	if(!macro)
+		return ERROR_INVALID;
+
+	macro->Name = name.Atom;
+	macro->Location = name.Location;
+
+	error = ReadDirectiveToken(preprocessor,&token);
+
+	// Function-like when the parenthesis follows the name right away
+	if(!error && IsPunctuation(&token,PUNCTUATION_PARENTHESESOPEN) && token.Location == name.Location + name.Length)
+	{
+		macro->Flags |= MACRO_FUNCTION;
+
+		if(error = ReadParameters(preprocessor,macro,&parameters))
+		{
+			free(parameters);
+			FreeMacro(macro);
+
+			return error == ERROR_REPORTED ? ERROR_NONE : error;
+		}
+
+		error = ReadDirectiveToken(preprocessor,&token);
+	}
+
+	// Replacement list, parameters are found now so expanding does not look them up
+	while(!error)
+	{
+		if(token.Type == TOKEN_IDENTIFIER && (macro->Flags & MACRO_FUNCTION))
+		{
+			for(i = 0; i < macro->Parameters && parameters[i] != token.Atom; ++i);
+
+			if(i < macro->Parameters)
+			{
+				token.Type = TOKEN_PARAMETER;
+				token.TypeEx = i;
+			}
+		}
+
+		if(!AppendTokenEntry(&body,&token))
+		{
+			error = ERROR_INVALID;
+			break;
+		}
+
+		error = ReadDirectiveToken(preprocessor,&token);
+	}
+
+	free(parameters);
+
+	SetMacroTokens(macro,&body);
+
+	if(error != ERROR_EOF)
+	{
+		FreeMacro(macro);
+		return error;
+	}
+
+	// Check the operators
+	for(i = 0; i < macro->Count; ++i)
+	{
+		LPTOKEN operator = &macro->Tokens[i];
+
+		if(IsPunctuation(operator,PUNCTUATION_PREPROCESSORMERGE) && (!i || i + 1 == macro->Count))
+		{
+			PreprocessorError(preprocessor,operator,"'##' cannot appear at either end of a macro expansion");
+			FreeMacro(macro);
+			return ERROR_NONE;
+		}
+
+		if(IsPunctuation(operator,PUNCTUATION_PREPROCESSOR) && (macro->Flags & MACRO_FUNCTION) && (i + 1 == macro->Count || macro->Tokens[i + 1].Type != TOKEN_PARAMETER))
+		{
+			PreprocessorError(preprocessor,operator,"'#' is not followed by a macro parameter");
+			FreeMacro(macro);
+			return ERROR_NONE;
+		}
+	}
+
+	if((previous = FindMacro(preprocessor,macro->Name)) && !EqualMacro(previous,macro))
+		PreprocessorWarning(preprocessor,&name,"'%.*s' redefined",name.Length,name.Value);
+
+	if(!AddMacro(preprocessor,macro))
+	{
+		FreeMacro(macro);
+		return ERROR_INVALID;
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG ReadParameters(LPPREPROCESSOR preprocessor,LPMACRO macro,PULONG* parameters)
+{
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	if(!ReadDirectiveToken(preprocessor,&token))
+	{
+		// No parameters
+		if(IsPunctuation(&token,PUNCTUATION_PARENTHESESCLOSE))
+			return ERROR_NONE;
+
+		while(token.Type == TOKEN_IDENTIFIER || IsPunctuation(&token,PUNCTUATION_PARMETERS))
+		{
+			PULONG names = (PULONG)realloc(*parameters,(macro->Parameters + 1) * sizeof(ULONG));
+
+			if(!names)
+				return ERROR_INVALID;
+
+			*parameters = names;
+
+			// The variadic parameter is named __VA_ARGS__ unless it is given a name
+			if(token.Type == TOKEN_IDENTIFIER)
+			{
+				names[macro->Parameters++] = token.Atom;
+
+				if(ReadDirectiveToken(preprocessor,&token))
+					break;
+			}
+			else
+				names[macro->Parameters++] = FindAtom(&preprocessor->Atoms,DIRECTIVENAMES[DIRECTIVE_VA_ARGS],(ULONG)strlen(DIRECTIVENAMES[DIRECTIVE_VA_ARGS]));
+
+			if(IsPunctuation(&token,PUNCTUATION_PARMETERS))
+			{
+				macro->Flags |= MACRO_VARIADIC;
+
+				if(ReadDirectiveToken(preprocessor,&token))
+					break;
+			}
+
+			if(IsPunctuation(&token,PUNCTUATION_PARENTHESESCLOSE))
+				return ERROR_NONE;
+
+			// Nothing follows the variadic parameter
+			if(!IsPunctuation(&token,PUNCTUATION_COMMA) || (macro->Flags & MACRO_VARIADIC) || ReadDirectiveToken(preprocessor,&token))
+				break;
+		}
+	}
+
+	// Reported at the name, the token may already be on the next line
+	token.Location = macro->Location;
+
+	PreprocessorError(preprocessor,&token,"invalid parameter list of macro '%s'",GetAtomName(&preprocessor->Atoms,macro->Name));
+	SkipDirectiveLine(preprocessor);
+
+	return ERROR_REPORTED;
+}
+
+ULONG ReadUndefine(LPPREPROCESSOR preprocessor)
+{
+	TOKEN name;
+
+	InitializeToken(&name);
+
+	if(ReadDirectiveToken(preprocessor,&name) || name.Type != TOKEN_IDENTIFIER)
+		PreprocessorError(preprocessor,&name,"macro names must be identifiers");
+	else
+		RemoveMacro(preprocessor,name.Atom);
+
+	SkipDirectiveLine(preprocessor);
+
+	return ERROR_NONE;
+}
+
+ULONG ReadInclude(LPPREPROCESSOR preprocessor,LPTOKEN directive)
+{
+	LPSOURCEFILE source = preprocessor->Source;
+	LPINCLUDEENTRY entry;
+	CHAR path[MAX_PATH];
+	LPCSTR name = NULL;
+	ULONG length = 0;
+	BOOL quoted = FALSE;
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	if(ReadDirectiveToken(preprocessor,&token))
+	{
+		PreprocessorError(preprocessor,directive,"#include expects \"FILENAME\" or <FILENAME>");
+		return ERROR_NONE;
+	}
+
+	// Names are taken from the input as they are written, escape sequences do not apply
+	if(token.Type == TOKEN_STRING || IsPunctuation(&token,PUNCTUATION_LOGIC_LESS))
+	{
+		CHAR end = token.Type == TOKEN_STRING ? '\"' : '>';
+
+		name = source->Entry->Lexer.FileBuffer + (token.Location - source->FileBase) + 1;
+		quoted = token.Type == TOKEN_STRING;
+
+		for(length = 0; name[length] && name[length] != end && name[length] != '\n'; ++length);
+
+		if(name[length] != end)
+			length = 0;
+
+		// Move past the closing bracket
+		if(!quoted)
+			while(!ReadDirectiveToken(preprocessor,&token) && !IsPunctuation(&token,PUNCTUATION_LOGIC_GREATER));
+	}
+	else
+	{
+		TOKENARRAY line;
+		TOKENARRAY expanded;
+		ULONG error;
+		ULONG i;
+
+		InitializeTokenArray(&line);
+		InitializeTokenArray(&expanded);
+
+		// Computed include, the name comes from macros
+		do
+		{
+			if(!AppendTokenEntry(&line,&token))
+			{
+				UninitializeTokenArray(&line);
+				return ERROR_INVALID;
+			}
+		}
+		while(!ReadDirectiveToken(preprocessor,&token));
+
+		error = ExpandTokens(preprocessor,line.Tokens,line.Count,&expanded);
+		UninitializeTokenArray(&line);
+
+		if(error)
+		{
+			UninitializeTokenArray(&expanded);
+			return error;
+		}
+
+		ClearString(&preprocessor->Scratch);
+
+		if(expanded.Count && expanded.Tokens[0].Type == TOKEN_STRING)
+		{
+			AppendString(&preprocessor->Scratch,expanded.Tokens[0].Value,expanded.Tokens[0].Length);
+			quoted = TRUE;
+		}
+		else if(expanded.Count && IsPunctuation(&expanded.Tokens[0],PUNCTUATION_LOGIC_LESS))
+		{
+			for(i = 1; i < expanded.Count && !IsPunctuation(&expanded.Tokens[i],PUNCTUATION_LOGIC_GREATER); ++i)
+				SpellToken(&preprocessor->Scratch,&expanded.Tokens[i]);
+
+			if(i == expanded.Count)
+				ClearString(&preprocessor->Scratch);
+		}
+
+		UninitializeTokenArray(&expanded);
+
+		name = preprocessor->Scratch.Buffer;
+		length = preprocessor->Scratch.Length;
+	}
+
+	SkipDirectiveLine(preprocessor);
+
+	if(!length)
+	{
+		PreprocessorError(preprocessor,directive,"#include expects \"FILENAME\" or <FILENAME>");
+		return ERROR_NONE;
+	}
+
+	if(!(entry = ResolveInclude(preprocessor,name,length,quoted,path)))
+	{
+		PreprocessorError(preprocessor,directive,"cannot open include file '%.*s'",length,name);
+		return ERROR_NONE;
+	}
+
+	// Neither opened nor read again when it would add nothing
+	if(IsIncludeSkipped(preprocessor,entry))
+	{
+		++preprocessor->Statistics.IncludeSkips;
+		return ERROR_NONE;
+	}
+
+	if(preprocessor->Depth >= INCLUDE_DEPTH_MAXIMUM)
+	{
+		PreprocessorError(preprocessor,directive,"#include nested too deeply");
+		return ERROR_INVALID;
+	}
+
+	if(!EnterSourceFile(preprocessor,path,entry))
+	{
+		PreprocessorError(preprocessor,directive,"cannot open include file '%s'",path);
+		return ERROR_NONE;
+	}
+
+	return ERROR_NONE;
+}
+
+BOOL PushConditional(LPPREPROCESSOR preprocessor,ULONG location,ULONG state)
+{
+	LPCONDITIONAL conditional;
+
+	if(preprocessor->ConditionalCount == preprocessor->ConditionalCapacity)
+	{
+		ULONG capacity = preprocessor->ConditionalCapacity ? preprocessor->ConditionalCapacity * 2 : 64;
+		LPCONDITIONAL conditionals = (LPCONDITIONAL)realloc(preprocessor->Conditionals,capacity * sizeof(CONDITIONAL));
+
+		if(!conditionals)
+			return FALSE;
+
+		preprocessor->Conditionals = conditionals;
+		preprocessor->ConditionalCapacity = capacity;
+	}
+
+	conditional = &preprocessor->Conditionals[preprocessor->ConditionalCount++];
+
+	conditional->Location = location;
+	conditional->State = state;
+	conditional->Else = FALSE;
+
+	return TRUE;
+}
+
+ULONG ReadConditional(LPPREPROCESSOR preprocessor,ULONG directive,LPTOKEN token)
+{
+	LPCONDITIONAL conditional = NULL;
+	BOOL value = FALSE;
+	ULONG error;
+	TOKEN name;
+
+	InitializeToken(&name);
+
+	// Branches of a conditional opened in this file
+	if(directive == DIRECTIVE_ELIF || directive == DIRECTIVE_ELSE || directive == DIRECTIVE_ENDIF)
+	{
+		if(preprocessor->ConditionalCount <= preprocessor->Source->Conditionals)
+		{
+			PreprocessorError(preprocessor,token,"#%.*s without #if",token->Length,token->Value);
+			SkipDirectiveLine(preprocessor);
+			return ERROR_NONE;
+		}
+
+		conditional = &preprocessor->Conditionals[preprocessor->ConditionalCount - 1];
+
+		if(conditional->Else && directive != DIRECTIVE_ENDIF)
+			PreprocessorError(preprocessor,token,"#%.*s after #else",token->Length,token->Value);
+	}
+
+	switch(directive)
+	{
+	case DIRECTIVE_IF:
+		if(error = EvaluateCondition(preprocessor,token,&value))
+			return error;
+		break;
+
+	case DIRECTIVE_IFDEF:
+	case DIRECTIVE_IFNDEF:
+		if(ReadDirectiveToken(preprocessor,&name) || name.Type != TOKEN_IDENTIFIER)
+			PreprocessorError(preprocessor,token,"no macro name given in #%.*s directive",token->Length,token->Value);
+		else
+			value = (FindMacro(preprocessor,name.Atom) != NULL) == (directive == DIRECTIVE_IFDEF);
+
+		SkipDirectiveLine(preprocessor);
+		break;
+
+	case DIRECTIVE_ELIF:
+	case DIRECTIVE_ELSE:
+		// Reached from a taken branch, the rest is skipped
+		SkipDirectiveLine(preprocessor);
+
+		conditional->State = CONDITIONAL_DONE;
+		conditional->Else |= directive == DIRECTIVE_ELSE;
+
+		return SkipConditional(preprocessor);
+
+	case DIRECTIVE_ENDIF:
+		SkipDirectiveLine(preprocessor);
+		--preprocessor->ConditionalCount;
+		return ERROR_NONE;
+	}
+
+	if(!PushConditional(preprocessor,token->Location,value ? CONDITIONAL_ACTIVE : CONDITIONAL_SEEKING))
+		return ERROR_INVALID;
+
+	if(!value)
+		return SkipConditional(preprocessor);
+
+	return ERROR_NONE;
+}
+
+ULONG SkipConditional(LPPREPROCESSOR preprocessor)
+{
+	LPSOURCEFILE source = preprocessor->Source;
+	LPINCLUDEENTRY entry = source->Entry;
+	LPCONDITIONAL conditional = &preprocessor->Conditionals[preprocessor->ConditionalCount - 1];
+	ULONG depth = 0;
+	ULONG error;
+	TOKEN token;
+
+	InitializeToken(&token);
+
+	// Directive to directive by the names found when the file was split, the text between them is never lexed
+	while(++source->Segment < entry->SegmentCount)
+	{
+		LPINCLUDESEGMENT segment = &entry->Segments[source->Segment];
+		ULONG directive = segment->Conditional;
+
+		source->Position = 0;
+
+		// Nested conditionals are skipped whole
+		if(directive == DIRECTIVE_IF || directive == DIRECTIVE_IFDEF || directive == DIRECTIVE_IFNDEF)
+			++depth;
+
+		else if(directive == DIRECTIVE_ENDIF)
+		{
+			if(!depth--)
+			{
+				++preprocessor->Statistics.Directives;
+				--preprocessor->ConditionalCount;
+
+				// Nothing on the line of the #endif is read
+				return EnterSegment(source,source->Segment + 1);
+			}
+		}
+
+		else if(!depth && (directive == DIRECTIVE_ELSE || directive == DIRECTIVE_ELIF))
+		{
+			BOOL value = TRUE;
+
+			++preprocessor->Statistics.Directives;
+
+			// Lexed for the name to report and the condition to evaluate
+			if(error = EnterSegment(source,source->Segment))
+				return error;
+
+			if((error = ReadSegmentToken(preprocessor,source,&token)) || (error = ReadDirectiveToken(preprocessor,&token)))
+			{
+				if(error != ERROR_EOF)
+					return error;
+
+				continue;
+			}
+
+			if(conditional->Else)
+				PreprocessorError(preprocessor,&token,"#%.*s after #else",token.Length,token.Value);
+
+			conditional->Else |= directive == DIRECTIVE_ELSE;
+
+			// Only the first true branch is taken
+			if(conditional->State == CONDITIONAL_SEEKING)
+			{
+				if(directive == DIRECTIVE_ELIF)
+				{
+					if(error = EvaluateCondition(preprocessor,&token,&value))
+						return error;
+				}
+				else
+					SkipDirectiveLine(preprocessor);
+
+				if(value)
+				{
+					conditional->State = CONDITIONAL_ACTIVE;
+					return ERROR_NONE;
+				}
+			}
+
+			continue;
+		}
+
+		preprocessor->Statistics.SkippedBytes += segment->End - segment->Offset;
+	}
+
+	// Left for LeaveSourceFile to report
+	return ERROR_NONE;
+}
+
+ULONG ReadMessage(LPPREPROCESSOR preprocessor,ULONG directive,LPTOKEN token)
+{
+	LPSTRING scratch = &preprocessor->Scratch;
+	TOKEN word;
+
+	InitializeToken(&word);
+	ClearString(scratch);
+
+	while(!ReadDirectiveToken(preprocessor,&word))
+	{
+		if(scratch->Length)
+			AppendChar(scratch,' ');
+
+		SpellToken(scratch,&word);
+	}
+
+	if(directive == DIRECTIVE_ERROR)
+		PreprocessorError(preprocessor,token,"#error %.*s",scratch->Length,scratch->Buffer);
+	else
+		PreprocessorWarning(preprocessor,token,"#warning %.*s",scratch->Length,scratch->Buffer);
+
+	return ERROR_NONE;
+}
+
+ULONG ReadPragma(LPPREPROCESSOR preprocessor,LPTOKEN hash,LPTOKEN directive)
+{
+	LPEXPANSION expansion;
+	TOKENARRAY line;
+	ULONG error;
+	TOKEN token;
+
+	InitializeToken(&token);
+	InitializeTokenArray(&line);
+
+	// Only #pragma once is for the preprocessor, the file is skipped when included again
+	if(!(error = ReadDirectiveToken(preprocessor,&token)) && token.Type == TOKEN_IDENTIFIER && (ULONG)(ULONG_PTR)GetAtomData(&preprocessor->Atoms,token.Atom) == DIRECTIVE_ONCE)
+	{
+		preprocessor->References[preprocessor->Source->Entry->Index].Once = TRUE;
+
+		SkipDirectiveLine(preprocessor);
+		return ERROR_NONE;
+	}
+
+	// Other pragmas are for the compiler, they are passed on as written
+	if(!AppendTokenEntry(&line,hash) || !AppendTokenEntry(&line,directive))
+	{
+		UninitializeTokenArray(&line);
+		return ERROR_INVALID;
+	}
+
+	for(; !error; error = ReadDirectiveToken(preprocessor,&token))
+	{
+		// Names in the pragma are not macro expanded
+		if(token.Type == TOKEN_IDENTIFIER)
+			token.TypeEx |= TOKEN_NOEXPAND;
+
+		if(!AppendTokenEntry(&line,&token))
+		{
+			UninitializeTokenArray(&line);
+			return ERROR_INVALID;
+		}
+	}
+
+	if(!(expansion = PushExpansion(preprocessor,NULL,line.Tokens,line.Count,FALSE)))
+	{
+		UninitializeTokenArray(&line);
+		return ERROR_INVALID;
+	}
+
+	expansion->Owned = TRUE;
+
+	return ERROR_NONE;
+}
+
+ULONG ReadLine(LPPREPROCESSOR preprocessor,LPTOKEN directive)
+{
+	LPSOURCEFILE source = preprocessor->Source;
+	TOKENARRAY line;
+	TOKENARRAY expanded;
+	LINEMARK mark;
+	ULONG column;
+	ULONG error;
+	TOKEN token;
+	ULONG i;
+
+	InitializeToken(&token);
+	InitializeTokenArray(&line);
+	InitializeTokenArray(&expanded);
+
+	while(!(error = ReadDirectiveToken(preprocessor,&token)))
+	{
+		if(!AppendTokenEntry(&line,&token))
+		{
+			error = ERROR_INVALID;
+			break;
+		}
+	}
+
+	// The number and the name may come from macros
+	if(error == ERROR_EOF)
+		error = ExpandTokens(preprocessor,line.Tokens,line.Count,&expanded);
+
+	UninitializeTokenArray(&line);
+
+	if(error)
+	{
+		UninitializeTokenArray(&expanded);
+		return error == ERROR_INVALID ? error : ERROR_NONE;
+	}
+
+	// The line number is a digit sequence, read in decimal even with a leading zero
+	mark.Number = 0;
+	i = 0;
+
+	if(expanded.Count && expanded.Tokens[0].Type == TOKEN_NUMBER)
+		for(i = 0; i < expanded.Tokens[0].Length && expanded.Tokens[0].Value[i] >= '0' && expanded.Tokens[0].Value[i] <= '9' && mark.Number <= 0x7FFFFFFF / 10; ++i)
+			mark.Number = mark.Number * 10 + expanded.Tokens[0].Value[i] - '0';
+
+	if(!expanded.Count || i != expanded.Tokens[0].Length || !mark.Number || expanded.Count > 2 || (expanded.Count == 2 && expanded.Tokens[1].Type != TOKEN_STRING))
+	{
+		PreprocessorError(preprocessor,directive,"#line expects a line number and an optional \"FILENAME\"");
+		UninitializeTokenArray(&expanded);
+		return ERROR_NONE;
+	}
+
+	// A name given once stays until another one is given
+	mark.Name = source->MarkCount ? source->Marks[source->MarkCount - 1].Name : NULL;
+
+	if(expanded.Count == 2 && !(mark.Name = StoreStringBlock(&preprocessor->Strings,expanded.Tokens[1].Value,expanded.Tokens[1].Length)))
+	{
+		UninitializeTokenArray(&expanded);
+		return ERROR_INVALID;
+	}
+
+	UninitializeTokenArray(&expanded);
+
+	// The directive numbers the line after it, which is where its segment ends
+	mark.Offset = source->Entry->Segments[source->Segment].End;
+
+	if(!GetLocationLine(&source->Entry->Lexer,mark.Offset,&mark.Line,&column))
+		return ERROR_NONE;
+
+	if(source->MarkCount == source->MarkCapacity)
+	{
+		ULONG capacity = source->MarkCapacity ? source->MarkCapacity * 2 : LINEMARK_BLOCK;
+		LPLINEMARK marks = (LPLINEMARK)realloc(source->Marks,capacity * sizeof(LINEMARK));
+
+		if(!marks)
+			return ERROR_INVALID;
+
+		source->Marks = marks;
+		source->MarkCapacity = capacity;
+	}
+
+	source->Marks[source->MarkCount++] = mark;
+
+	return ERROR_NONE;
+}
+
+ULONG EvaluateCondition(LPPREPROCESSOR preprocessor,LPTOKEN directive,PBOOL value)
+{
+	TOKENARRAY line;
+	TOKENARRAY expanded;
+	LONGLONG result = 0;
+	ULONG error;
+	TOKEN token;
+
+	InitializeToken(&token);
+	InitializeTokenArray(&line);
+	InitializeTokenArray(&expanded);
+
+	// The defined operator is applied before expanding macros
+	while(!(error = ReadDirectiveToken(preprocessor,&token)))
+	{
+		if(token.Type == TOKEN_IDENTIFIER && (ULONG)(ULONG_PTR)GetAtomData(&preprocessor->Atoms,token.Atom) == DIRECTIVE_DEFINED)
+		{
+			BOOL parenthesis = FALSE;
+			TOKEN name;
+			TOKEN close;
+
+			InitializeToken(&name);
+			InitializeToken(&close);
+
+			if(!(error = ReadDirectiveToken(preprocessor,&name)) && IsPunctuation(&name,PUNCTUATION_PARENTHESESOPEN))
+			{
+				parenthesis = TRUE;
+				error = ReadDirectiveToken(preprocessor,&name);
+			}
+
+			if(error || name.Type != TOKEN_IDENTIFIER || (parenthesis && (ReadDirectiveToken(preprocessor,&close) || !IsPunctuation(&close,PUNCTUATION_PARENTHESESCLOSE))))
+			{
+				PreprocessorError(preprocessor,&token,"operator 'defined' requires an identifier");
+				error = ERROR_REPORTED;
+				break;
+			}
+
+			token.Type = TOKEN_NUMBER;
+			token.TypeEx = NUMBER_INTEGER;
+			token.Integer = FindMacro(preprocessor,name.Atom) != NULL;
+			token.Value = token.Integer ? "1" : "0";
+			token.Length = 1;
+			token.Atom = 0;
+		}
+
+		if(!AppendTokenEntry(&line,&token))
+		{
+			error = ERROR_INVALID;
+			break;
+		}
+	}
+
+	if(error == ERROR_EOF)
+	{
+		if(!line.Count)
+		{
+			PreprocessorError(preprocessor,directive,"#%.*s with no expression",directive->Length,directive->Value);
+			error = ERROR_REPORTED;
+		}
+		else if(!(error = ExpandTokens(preprocessor,line.Tokens,line.Count,&expanded)) && !(error = EvaluateExpression(preprocessor,&expanded,1,&result)) && PeekTokenEntry(&expanded,0))
+		{
+			PreprocessorError(preprocessor,PeekTokenEntry(&expanded,0),"missing binary operator before token \"%.*s\"",PeekTokenEntry(&expanded,0)->Length,PeekTokenEntry(&expanded,0)->Value);
+			error = ERROR_REPORTED;
+		}
+	}
+
+	UninitializeTokenArray(&line);
+	UninitializeTokenArray(&expanded);
+
+	// Errors in the expression make it false
+	if(error && error != ERROR_INVALID)
+	{
+		SkipDirectiveLine(preprocessor);
+		error = ERROR_NONE;
+		result = 0;
+	}
+
+	*value = result != 0;
+
+	return error;
+}
+
+ULONG GetOperatorPrecedence(LPTOKEN token)
+{
+	// Numbers with a sign are a binary operator and a number
+	if(token->Type == TOKEN_NUMBER && (token->Value[0] == '-' || token->Value[0] == '+'))
+		return 10;
+
+	if(token->Type != TOKEN_PUNCTUATION)
+		return 0;
+
+	switch(token->TypeEx)
+	{
+	case PUNCTUATION_QUESTIONMARK:		return 1;
+	case PUNCTUATION_LOGIC_OR:			return 2;
+	case PUNCTUATION_LOGIC_AND:			return 3;
+	case PUNCTUATION_BIN_OR:			return 4;
+	case PUNCTUATION_BIN_XOR:			return 5;
+	case PUNCTUATION_BIN_AND:			return 6;
+	case PUNCTUATION_LOGIC_EQ:
+	case PUNCTUATION_LOGIC_UNEQ:		return 7;
+	case PUNCTUATION_LOGIC_LESS:
+	case PUNCTUATION_LOGIC_GREATER:
+	case PUNCTUATION_LOGIC_LEQ:
+	case PUNCTUATION_LOGIC_GEQ:			return 8;
+	case PUNCTUATION_LSHIFT:
+	case PUNCTUATION_RSHIFT:			return 9;
+	case PUNCTUATION_ADD:
+	case PUNCTUATION_SUB:				return 10;
+	case PUNCTUATION_MUL:
+	case PUNCTUATION_DIV:
+	case PUNCTUATION_MOD:				return 11;
+	}
+
+	return 0;
+}
+
+ULONG EvaluateExpression(LPPREPROCESSOR preprocessor,LPTOKENARRAY tokens,ULONG precedence,LONGLONG* value)
+{
+	LPTOKEN token;
+	ULONG error;
+
+	if(error = EvaluatePrimary(preprocessor,tokens,value))
+		return error;
+
+	// Precedence climbing, operators binding tighter than the caller are applied here
+	while((token = PeekTokenEntry(tokens,0)) && GetOperatorPrecedence(token) >= precedence)
+	{
+		ULONG current = GetOperatorPrecedence(token);
+		ULONG operator;
+		LONGLONG right;
+
+		if(token->Type == TOKEN_NUMBER)
+		{
+			// Split the sign off, the number stays for the right operand
+			operator = token->Value[0] == '-' ? PUNCTUATION_SUB : PUNCTUATION_ADD;
+
+			token->TypeEx &= ~NUMBER_SIGN_MASK;
+			++token->Value;
+			--token->Length;
+		}
+		else
+		{
+			operator = token->TypeEx;
+			NextTokenEntry(tokens);
+		}
+
+		if(operator == PUNCTUATION_QUESTIONMARK)
+		{
+			LONGLONG middle;
+
+			if(error = EvaluateExpression(preprocessor,tokens,1,&middle))
+				return error;
+
+			if(!(token = NextTokenEntry(tokens)) || !IsPunctuation(token,PUNCTUATION_COLON))
+			{
+				PreprocessorError(preprocessor,token,"expected ':' in conditional expression");
+				return ERROR_REPORTED;
+			}
+
+			// Right associative
+			if(error = EvaluateExpression(preprocessor,tokens,1,&right))
+				return error;
+
+			*value = *value ? middle : right;
+			continue;
+		}
+
+		if(error = EvaluateExpression(preprocessor,tokens,current + 1,&right))
+			return error;
+
+		switch(operator)
+		{
+		case PUNCTUATION_LOGIC_OR:		*value = *value || right; break;
+		case PUNCTUATION_LOGIC_AND:		*value = *value && right; break;
+		case PUNCTUATION_BIN_OR:		*value |= right; break;
+		case PUNCTUATION_BIN_XOR:		*value ^= right; break;
+		case PUNCTUATION_BIN_AND:		*value &= right; break;
+		case PUNCTUATION_LOGIC_EQ:		*value = *value == right; break;
+		case PUNCTUATION_LOGIC_UNEQ:	*value = *value != right; break;
+		case PUNCTUATION_LOGIC_LESS:	*value = *value < right; break;
+		case PUNCTUATION_LOGIC_GREATER:	*value = *value > right; break;
+		case PUNCTUATION_LOGIC_LEQ:		*value = *value <= right; break;
+		case PUNCTUATION_LOGIC_GEQ:		*value = *value >= right; break;
+		case PUNCTUATION_LSHIFT:		*value <<= right & 63; break;
+		case PUNCTUATION_RSHIFT:		*value >>= right & 63; break;
+		case PUNCTUATION_ADD:			*value += right; break;
+		case PUNCTUATION_SUB:			*value -= right; break;
+		case PUNCTUATION_MUL:			*value *= right; break;
+
+		case PUNCTUATION_DIV:
+		case PUNCTUATION_MOD:
+			if(!right)
+			{
+				PreprocessorError(preprocessor,token,"division by zero in #if");
+				return ERROR_REPORTED;
+			}
+
+			*value = operator == PUNCTUATION_DIV ? *value / right : *value % right;
+			break;
+		}
+	}
+
+	return ERROR_NONE;
+}
+
+ULONG EvaluatePrimary(LPPREPROCESSOR preprocessor,LPTOKENARRAY tokens,LONGLONG* value)
+{
+	LPTOKEN token = NextTokenEntry(tokens);
+	LPTOKEN suffix;
+	ULONG error;
+
+	if(!token)
+	{
+		PreprocessorError(preprocessor,NULL,"#if with no expression");
+		return ERROR_REPORTED;
+	}
+
+	switch(token->Type)
+	{
+	case TOKEN_NUMBER:
+		if((token->TypeEx & NUMBER_TYPE_MASK) == NUMBER_FLOAT)
+		{
+			PreprocessorError(preprocessor,token,"floating constant in preprocessor expression");
+			return ERROR_REPORTED;
+		}
+
+		*value = (token->TypeEx & NUMBER_SIGN_MASK) ? -(LONGLONG)token->Integer : (LONGLONG)token->Integer;
+
+		// Integer suffixes are read as an identifier right after the number
+		if((suffix = PeekTokenEntry(tokens,0)) && suffix->Type == TOKEN_IDENTIFIER && suffix->Location == token->Location + token->Length)
+			NextTokenEntry(tokens);
+
+		return ERROR_NONE;
+
+	case TOKEN_LITERAL:
+		*value = token->Length ? (LONGLONG)token->Value[0] : 0;
+		return ERROR_NONE;
+
+	case TOKEN_IDENTIFIER:
+		// Identifiers left after expanding are zero
+		*value = token->TypeEx == KEYWORD_TRUE;
+		return ERROR_NONE;
+
+	case TOKEN_PUNCTUATION:
+		switch(token->TypeEx)
+		{
+		case PUNCTUATION_PARENTHESESOPEN:
+			if(error = EvaluateExpression(preprocessor,tokens,1,value))
+				return error;
+
+			if(!(token = NextTokenEntry(tokens)) || !IsPunctuation(token,PUNCTUATION_PARENTHESESCLOSE))
+			{
+				PreprocessorError(preprocessor,token,"missing ')' in expression");
+				return ERROR_REPORTED;
+			}
+
+			return ERROR_NONE;
+
+		case PUNCTUATION_SUB:
+		case PUNCTUATION_ADD:
+		case PUNCTUATION_LOGIC_NOT:
+		case PUNCTUATION_BIN_NOT:
+			if(error = EvaluatePrimary(preprocessor,tokens,value))
+				return error;
+
+			if(token->TypeEx == PUNCTUATION_SUB)
+				*value = -*value;
+			else if(token->TypeEx == PUNCTUATION_LOGIC_NOT)
+				*value = !*value;
+			else if(token->TypeEx == PUNCTUATION_BIN_NOT)
+				*value = ~*value;
+
+			return ERROR_NONE;
+		}
+		break;
+	}
+
+	PreprocessorError(preprocessor,token,"token \"%.*s\" is not valid in preprocessor expressions",token->Length,token->Value);
+
+	return ERROR_REPORTED;
+}
+
+VOID PreprocessorWarning(LPPREPROCESSOR preprocessor,LPTOKEN token,LPCSTR format,...)
+{
+	CHAR buffer[2048];
+	LPCSTR name;
+	ULONG line;
+	ULONG column;
+
+    va_list args;
+    va_start(args,format);
+	_vsnprintf(buffer,sizeof(buffer),format,args);
+    va_end(args);
+
+	if(token && GetPreprocessorLine(preprocessor,token->Location,&name,&line,&column))
+		printf("%s(%u,%u): warning: %s.\n",name,line,column,buffer);
+	else
+		printf("warning: %s.\n",buffer);
+}
+
+VOID PreprocessorError(LPPREPROCESSOR preprocessor,LPTOKEN token,LPCSTR format,...)
+{
+	CHAR buffer[2048];
+	LPCSTR name;
+	ULONG line;
+	ULONG column;
+
+    va_list args;
+    va_start(args,format);
+	_vsnprintf(buffer,sizeof(buffer),format,args);
+    va_end(args);
+
+	++preprocessor->Errors;
+
+	if(token && GetPreprocessorLine(preprocessor,token->Location,&name,&line,&column))
+		printf("%s(%u,%u): error: %s.\n",name,line,column,buffer);
+	else
+		printf("error: %s.\n",buffer);
+}
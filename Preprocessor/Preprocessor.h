@@ -1,6 +1,448 @@
+/*
+ *	Preprocessor - C Preprocessor on the Lexer token stream
+ *	Copyright (C) 2007 Marko Mihovilic
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
 #pragma once
 
-#define DIRECTIVE_INCLUDE 1
-#define DIRECTIVE_DEFINE 2
-#define DIRECTIVE_UNDEFINE 3
+#include "..\Lexer\Lexer.h"
+
+// Errors, besides the ones of the lexer
+#define ERROR_REPORTED	3	// Reported and skipped over, preprocessing goes on
+
+// Directives, kept in the atom data of their names
+#define DIRECTIVE_NONE		0
+#define DIRECTIVE_INCLUDE	1
+#define DIRECTIVE_DEFINE	2
+#define DIRECTIVE_UNDEFINE	3
+#define DIRECTIVE_IF		4
+#define DIRECTIVE_IFDEF		5
+#define DIRECTIVE_IFNDEF	6
+#define DIRECTIVE_ELIF		7
+#define DIRECTIVE_ELSE		8
+#define DIRECTIVE_ENDIF		9
+#define DIRECTIVE_PRAGMA	10
+#define DIRECTIVE_ERROR		11
+#define DIRECTIVE_WARNING	12
+#define DIRECTIVE_LINE		13
+#define DIRECTIVE_DEFINED	14	// Operator of conditional expressions
+#define DIRECTIVE_VA_ARGS	15	// Variadic parameter of macros
+#define DIRECTIVE_ONCE		16	// Pragma including a file only once
+
+// Names given their directive in the atom data, indexed by directive
+static LPCSTR DIRECTIVENAMES[] =
+{
+	NULL,
+	"include",
+	"define",
+	"undef",
+	"if",
+	"ifdef",
+	"ifndef",
+	"elif",
+	"else",
+	"endif",
+	"pragma",
+	"error",
+	"warning",
+	"line",
+	"defined",
+	"__VA_ARGS__",
+	"once",
+};
+
+// Token types only found in macro definitions
+#define TOKEN_PARAMETER		TOKEN_TYPES		// TypeEx is the parameter index
+
+#define TOKEN_NOEXPAND		0x40000000	// Set in the TypeEx of identifiers that named a macro being expanded
+
+// Macro flags
+#define MACRO_FUNCTION		1	// Takes arguments
+#define MACRO_VARIADIC		2	// The last parameter takes the remaining arguments
+#define MACRO_LINE			4	// __LINE__, replaced by the line it is used on
+#define MACRO_FILE			8	// __FILE__, replaced by the name of the file it is used in
+
+// This structure represents a macro definition
+typedef struct
+{
+	ULONG Name;			// Atom of the name
+	ULONG Flags;
+	ULONG Parameters;	// Number of parameters, the variadic one included
+	ULONG Location;		// Where the macro was defined
+	LPTOKEN Tokens;		// Replacement list, references to parameters are TOKEN_PARAMETER tokens
+	ULONG Count;
+	ULONG Disabled;		// Number of expansions of the macro being read, it is not expanded again inside them
+} MACRO, *LPMACRO;
+
+#define MACROTABLE_BLOCK 1024	// Initial number of hash slots in a macro table
+
+// This structure represents a slot of the macro table, the name is kept in the slot so probing never touches the macros
+typedef struct
+{
+	ULONG Name;			// Atom of the macro name, zero if empty
+	LPMACRO Macro;
+} MACROSLOT, *LPMACROSLOT;
+
+// This structure represents the defined macros, members should not be accessed directly
+typedef struct
+{
+	LPMACROSLOT Slots;	// Open addressed with linear probing, at most half full
+	ULONG SlotCount;	// Always a power of two
+	ULONG Count;
+	LPMACRO* Retired;	// Undefined while being expanded, freed with the table
+	ULONG RetiredCount;
+	ULONG RetiredCapacity;
+} MACROTABLE, *LPMACROTABLE;
+
+// Conditional states
+#define CONDITIONAL_ACTIVE		0	// Reading the taken branch
+#define CONDITIONAL_SEEKING		1	// No branch taken yet
+#define CONDITIONAL_DONE		2	// A branch was taken, skipping the rest
+
+// This structure represents an open conditional directive
+typedef struct
+{
+	ULONG Location;
+	ULONG State;
+	BOOL Else;			// The #else was seen
+} CONDITIONAL, *LPCONDITIONAL;
+
+#define INCLUDE_DEPTH_MAXIMUM 200
+
+#define INCLUDECACHE_BLOCK 256	// Initial number of hash slots in an include cache
+
+#define SEGMENT_BLOCK 64	// Initial number of segments of an include cache entry
+
+// This structure represents a directive line of a file or the text between two of them
+typedef struct
+{
+	ULONG Offset;			// First character, the number sign of directive lines
+	ULONG End;				// Where the next segment starts, past the line break of directive lines
+	BOOL Directive;			// A directive line
+	ULONG Conditional;		// DIRECTIVE_IF to DIRECTIVE_ENDIF for conditional directives, DIRECTIVE_NONE otherwise
+	volatile LONG Lexed;	// Set once the tokens are in place, segments are lexed when first read
+	LPTOKEN Tokens;			// Tokens starting in the segment, locations are offsets into the file
+	ULONG Count;
+	ULONG Error;			// Why lexing stopped before the end of the segment, ERROR_NONE if it did not
+	ULONG ErrorOffset;		// Where it stopped
+} INCLUDESEGMENT, *LPINCLUDESEGMENT;
+
+// This structure represents a file in the include cache, it only changes by lexing its segments once it is in the cache
+typedef struct
+{
+	ULONG Index;			// Order the entry was added in, preprocessors index what they keep of it by this
+	DWORD Volume;			// Identity of the file, another path to the same file shares the entry
+	ULONGLONG FileIndex;
+	FILETIME LastWrite;
+	ULONGLONG Size;
+	LEXER Lexer;			// Holds the input, the decoded strings and the line table
+	ATOMTABLE Atoms;		// Identifiers of the file, every preprocessor maps them to its own atoms
+	CRITICAL_SECTION Lock;	// Held while a segment is lexed, the lexer and the atoms are only used with it
+	LPINCLUDESEGMENT Segments;	// The file split at its directive lines without lexing it
+	ULONG SegmentCount;
+	TOKENARRAY Scratch;		// Reused while lexing a segment
+	LPCSTR Guard;			// Macro whose #ifndef spans the whole file, NULL if none
+	ULONG GuardLength;
+} INCLUDEENTRY, *LPINCLUDEENTRY;
+
+// This structure represents a slot of the include cache
+typedef struct
+{
+	LPSTR Path;				// Full path, NULL if the slot is empty
+	ULONG Hash;
+	LPINCLUDEENTRY Entry;	// Latest version of the file at the path
+} INCLUDESLOT, *LPINCLUDESLOT;
+
+// This structure represents the files loaded by any number of preprocessors, members should not be accessed directly
+typedef struct
+{
+	CRITICAL_SECTION Lock;		// Held while the cache is searched or changed, entries are read without it
+	LPINCLUDESLOT Slots;		// Open addressed with linear probing, at most half full
+	ULONG SlotCount;			// Always a power of two
+	ULONG Count;
+	LPINCLUDEENTRY* Entries;	// Every entry ever added indexed by entry index, replaced ones included
+	ULONG EntryCount;
+	ULONG EntryCapacity;
+} INCLUDECACHE, *LPINCLUDECACHE;
+
+// This structure represents what a preprocessor keeps of a cache entry it used
+typedef struct
+{
+	LPINCLUDEENTRY Entry;	// NULL if the entry was not used yet
+	PULONG Atoms;			// Atoms of the preprocessor indexed by atoms of the entry, zero until met
+	ULONG AtomCount;		// Grows with the atoms of the segments lexed since
+	BOOL Once;				// The file ran #pragma once
+} INCLUDEREFERENCE, *LPINCLUDEREFERENCE;
+
+#define INCLUDENAME_BLOCK 256	// Initial number of hash slots for resolved include names
+
+// This structure represents an include name resolved by a preprocessor
+typedef struct
+{
+	LPSTR Key;				// Directory searched first, the kind of name and the name, NULL if the slot is empty
+	ULONG Hash;
+	LPSTR Path;				// Path the file was found at
+	LPINCLUDEENTRY Entry;
+} INCLUDENAME, *LPINCLUDENAME;
+
+#define LINEMARK_BLOCK 16	// Initial number of #line directives kept for a source file
+
+// This structure represents a #line directive, the lines after it are numbered and named by it
+typedef struct
+{
+	ULONG Offset;		// Start of the line after the directive
+	ULONG Line;			// Line of the file starting there
+	ULONG Number;		// Line number given to it
+	LPCSTR Name;		// File name given to it, NULL to keep the name of the file
+} LINEMARK, *LPLINEMARK;
+
+// This structure represents an entered source file, kept until the preprocessor is uninitialized since locations refer to it
+typedef struct _SOURCEFILE
+{
+	struct _SOURCEFILE* Parent;	// File that included it, while it is being read
+	LPINCLUDEENTRY Entry;		// Input and tokens, shared through the include cache
+	LPSTR Name;					// Path the file was found at
+	ULONG FileBase;				// Location of the first character, every entering gets its own range
+	ULONG Segment;				// Segment being read, the segment count at the end of the file
+	ULONG Position;				// Index of the next token of the segment
+	ULONG Conditionals;			// Open conditionals when the file was entered
+	BOOL Failed;				// A lexing error was reported
+	LPLINEMARK Marks;			// #line directives read so far, in offset order
+	ULONG MarkCount;
+	ULONG MarkCapacity;
+} SOURCEFILE, *LPSOURCEFILE;
+
+// Argument states of a macro call
+#define ARGUMENT_UNUSED		0	// Not needed expanded yet
+#define ARGUMENT_RAW		1	// Nothing in it expands, it is read as it was given
+#define ARGUMENT_EXPANDED	2	// Read from its expanded copy
+
+// Argument flags, of the tokens a parameter is read from
+#define ARGUMENT_PLAIN		1	// No name of a macro, expanding them gives them back
+#define ARGUMENT_FLAT		2	// No parenthesis or comma, an argument read from them takes the rest of them
+
+// This structure represents an argument of a macro call as given
+typedef struct
+{
+	LPTOKEN Tokens;				// In the copies of the call, or in the tokens of the holder when read in place
+	ULONG Count;
+	ULONG Offset;				// Where a copied argument starts in the copies
+	struct _MACROCALL* Holder;	// Call holding the tokens of an argument read in place, NULL if copied
+	ULONG State;
+	ULONG Flags;				// Argument flags, of what the parameter is read from
+} MACROARGUMENT, *LPMACROARGUMENT;
+
+// This structure represents the arguments of a function-like macro call, kept in one block while the expansion is read
+typedef struct _MACROCALL
+{
+	TOKENARRAY Copies;			// Arguments that could not be read in place, one after the other
+	LPMACROARGUMENT Arguments;
+	LPTOKENARRAY Expanded;		// Arguments macro expanded the first time a parameter needs them
+	ULONG Parameters;
+	ULONG References;			// The expansion and the calls holding arguments read in place from it
+} MACROCALL, *LPMACROCALL;
+
+// This structure represents a token list being read, the definition of a macro being expanded or any other list
+typedef struct
+{
+	LPMACRO Macro;		// Disabled while the list is read, NULL if none
+	LPTOKEN Tokens;		// The definition of the macro, an argument or a list made for the expansion
+	ULONG Count;
+	ULONG Position;
+	BOOL Barrier;		// Reading past the end is the end of the input instead of going on below
+	BOOL Owned;			// The tokens are freed with the expansion
+	BOOL Definition;	// Parameters and operators in the tokens are replaced while they are read
+	ULONG Location;		// Where the macro was used, given to the tokens of its definition
+	LPMACROCALL Call;	// Freed with the expansion, NULL if the macro takes no arguments
+	LPMACROCALL Holder;	// Call holding the tokens of an argument being read, calls read their arguments from them in place
+	ULONG Flags;		// Argument flags of the tokens of an argument
+	BOOL Leading;		// The first token is still to be read, it takes the space flag of what the list replaces
+	ULONG Space;		// TOKEN_SPACE if whitespace came before what the list replaces
+} EXPANSION, *LPEXPANSION;
+
+// This structure holds the counters of a preprocessor
+typedef struct
+{
+	ULONGLONG Files;		// Files entered, the main file included
+	ULONGLONG Directives;	// Directives run, not the ones in skipped regions
+	ULONGLONG Macros;		// Macros defined
+	ULONGLONG Expansions;	// Macros expanded
+	ULONGLONG Lookups;		// Macro table lookups
+	ULONGLONG Probes;		// Slots compared by those lookups
+	ULONGLONG SkippedBytes;	// Characters of skipped regions, they are not lexed
+	ULONGLONG IncludeHits;		// Files found in the include cache
+	ULONGLONG IncludeLoads;		// Files loaded into the include cache
+	ULONGLONG IncludeSkips;		// Includes skipped for a defined guard or #pragma once
+} PREPROCESSORSTATISTICS, *LPPREPROCESSORSTATISTICS;
+
+#define FILE_BASE_GAP 1		// Locations left unused between files so every file can be told from the next
+
+// This structure represents a preprocessor object, members should not be accessed directly
+typedef struct
+{
+	ATOMTABLE Atoms;		// Shared by all the files so macro names are compared as atoms
+	MACROTABLE Macros;
+
+	LPINCLUDECACHE Cache;	// Given at initialization or the private one
+	INCLUDECACHE PrivateCache;
+	LPINCLUDEREFERENCE References;	// Indexed by entry index
+	ULONG ReferenceCount;
+	LPINCLUDENAME Names;	// Open addressed with linear probing, at most half full
+	ULONG NameSlotCount;	// Always a power of two
+	ULONG NameCount;
+
+	LPSOURCEFILE Source;	// File being read, the include stack goes up from it
+	ULONG Depth;			// Number of files on the include stack
+	LPSOURCEFILE* Files;	// Every file loaded so far in location order
+	ULONG FileCount;
+	ULONG FileCapacity;
+	ULONG FileBase;			// Location given to the next file
+
+	LPEXPANSION Expansions;	// Stack of token lists read before the source file
+	ULONG ExpansionCount;
+	ULONG ExpansionCapacity;
+	ULONG Space;			// TOKEN_SPACE left by something replaced with nothing, given to the next token
+
+	LPCONDITIONAL Conditionals;
+	ULONG ConditionalCount;
+	ULONG ConditionalCapacity;
+
+	LPSTR* Directories;		// Searched for included files in order
+	ULONG DirectoryCount;
+
+	LPSTRINGBLOCK Strings;	// Values of tokens made by the preprocessor
+	STRING Scratch;			// Reused while spelling tokens
+	LEXER Paste;			// Lexes the results of pasting tokens
+
+	ULONG Errors;
+	PREPROCESSORSTATISTICS Statistics;
+} PREPROCESSOR, *LPPREPROCESSOR;
+
+// Public functions
+BOOL InitializePreprocessor(LPPREPROCESSOR preprocessor,LPINCLUDECACHE cache);
+VOID UninitializePreprocessor(LPPREPROCESSOR preprocessor);
+BOOL AddIncludeDirectory(LPPREPROCESSOR preprocessor,LPCSTR directory);
+BOOL DefineMacro(LPPREPROCESSOR preprocessor,LPCSTR name,LPCSTR value);
+ULONG PreprocessFile(LPPREPROCESSOR preprocessor,LPCSTR path,LPTOKENARRAY tokens);
+BOOL GetPreprocessorLine(LPPREPROCESSOR preprocessor,ULONG location,LPCSTR* name,PULONG line,PULONG column);
+VOID PrintPreprocessorStatistics(LPPREPROCESSOR preprocessor,FILE* stream);
+
+// Macro table functions
+BOOL InitializeMacroTable(LPMACROTABLE macros);
+VOID UninitializeMacroTable(LPMACROTABLE macros);
+LPMACRO FindMacro(LPPREPROCESSOR preprocessor,ULONG name);
+BOOL AddMacro(LPPREPROCESSOR preprocessor,LPMACRO macro);
+BOOL RemoveMacro(LPPREPROCESSOR preprocessor,ULONG name);
+
+// Internal macro table functions
+ULONG HashMacro(ULONG name,ULONG mask);
+BOOL GrowMacroTable(LPMACROTABLE macros);
+BOOL RetireMacro(LPMACROTABLE macros,LPMACRO macro);
+VOID FreeMacro(LPMACRO macro);
+VOID SetMacroTokens(LPMACRO macro,LPTOKENARRAY tokens);
+BOOL EqualMacro(LPMACRO macro1,LPMACRO macro2);
+BOOL DefineBuiltinMacros(LPPREPROCESSOR preprocessor);
+BOOL DefineBuiltinMacro(LPPREPROCESSOR preprocessor,LPCSTR name,ULONG flags);
+
+// Include cache functions
+BOOL InitializeIncludeCache(LPINCLUDECACHE cache);
+VOID UninitializeIncludeCache(LPINCLUDECACHE cache);
+
+// Internal include cache functions
+ULONG HashIncludePath(LPCSTR path);
+LPINCLUDESLOT FindIncludeSlot(LPINCLUDECACHE cache,LPCSTR path,ULONG hash);
+BOOL GrowIncludeCache(LPINCLUDECACHE cache);
+BOOL AddIncludeEntry(LPINCLUDECACHE cache,LPCSTR path,LPINCLUDEENTRY entry);
+LPINCLUDEENTRY FindIncludeEntry(LPINCLUDECACHE cache,LPCSTR path);
+LPINCLUDEENTRY FindIncludeIdentity(LPINCLUDECACHE cache,LPINCLUDEENTRY entry);
+LPINCLUDEENTRY LoadIncludeEntry(LPINCLUDECACHE cache,LPCSTR path);
+BOOL IsIncludeEntryCurrent(LPINCLUDEENTRY entry,LPWIN32_FILE_ATTRIBUTE_DATA attributes);
+BOOL SplitIncludeEntry(LPINCLUDEENTRY entry);
+BOOL AddIncludeSegment(LPINCLUDEENTRY entry,ULONG offset,ULONG end,BOOL directive,PULONG capacity);
+ULONG FindSegmentConditional(LPINCLUDEENTRY entry,LPINCLUDESEGMENT segment);
+ULONG LexIncludeSegment(LPINCLUDEENTRY entry,LPINCLUDESEGMENT segment);
+VOID FindIncludeGuard(LPINCLUDEENTRY entry);
+BOOL IsSegmentBlank(LPINCLUDEENTRY entry,LPINCLUDESEGMENT segment);
+VOID FreeIncludeEntry(LPINCLUDEENTRY entry);
+
+// Internal source file functions
+LPINCLUDEENTRY OpenSourceFile(LPPREPROCESSOR preprocessor,LPCSTR path);
+BOOL ReferenceIncludeEntry(LPPREPROCESSOR preprocessor,LPINCLUDEENTRY entry);
+BOOL EnterSourceFile(LPPREPROCESSOR preprocessor,LPCSTR path,LPINCLUDEENTRY entry);
+VOID LeaveSourceFile(LPPREPROCESSOR preprocessor);
+LPSOURCEFILE FindSourceFile(LPPREPROCESSOR preprocessor,ULONG location);
+LPINCLUDEENTRY ResolveInclude(LPPREPROCESSOR preprocessor,LPCSTR name,ULONG length,BOOL quoted,LPSTR path);
+LPINCLUDEENTRY SearchInclude(LPPREPROCESSOR preprocessor,LPCSTR name,ULONG length,BOOL quoted,LPSTR path);
+LPINCLUDENAME FindIncludeName(LPPREPROCESSOR preprocessor,LPCSTR key,ULONG hash);
+BOOL AddIncludeName(LPPREPROCESSOR preprocessor,LPCSTR key,LPCSTR path,LPINCLUDEENTRY entry);
+BOOL IsIncludeSkipped(LPPREPROCESSOR preprocessor,LPINCLUDEENTRY entry);
+BOOL IsLineStart(LPSOURCEFILE source,LPTOKEN token);
+BOOL IsLineContinuation(LPSOURCEFILE source,LPTOKEN token);
+
+// Internal token reading functions
+ULONG EnterSegment(LPSOURCEFILE source,ULONG segment);
+ULONG ReadSegmentToken(LPPREPROCESSOR preprocessor,LPSOURCEFILE source,LPTOKEN token);
+ULONG ReadEntryToken(LPPREPROCESSOR preprocessor,LPSOURCEFILE source,LPTOKEN token);
+ULONG ReadFileToken(LPPREPROCESSOR preprocessor,LPTOKEN token);
+ULONG ReadDirectiveToken(LPPREPROCESSOR preprocessor,LPTOKEN token);
+ULONG ReadSourceToken(LPPREPROCESSOR preprocessor,LPTOKEN token);
+ULONG ReadExpandedToken(LPPREPROCESSOR preprocessor,LPTOKEN token);
+VOID SkipDirectiveLine(LPPREPROCESSOR preprocessor);
+
+// Internal expansion functions
+LPEXPANSION PushExpansion(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN tokens,ULONG count,BOOL barrier);
+VOID PopExpansion(LPPREPROCESSOR preprocessor);
+BOOL PeekParenthesis(LPPREPROCESSOR preprocessor);
+ULONG ExpandMacro(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN name);
+ULONG ExpandBuiltinMacro(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN name);
+ULONG ReadArguments(LPPREPROCESSOR preprocessor,LPMACRO macro,LPTOKEN name,LPMACROCALL call);
+BOOL CopyArgument(LPMACROCALL call,LPMACROARGUMENT argument);
+ULONG ExpandTokens(LPPREPROCESSOR preprocessor,LPTOKEN tokens,ULONG count,LPTOKENARRAY expanded);
+LPMACROCALL CreateMacroCall(LPMACRO macro);
+VOID FreeMacroCall(LPMACROCALL call);
+BOOL IsSubstitution(LPEXPANSION expansion);
+ULONG FindOperatorRun(LPMACRO macro,ULONG position);
+ULONG SubstituteExpansion(LPPREPROCESSOR preprocessor);
+ULONG SubstituteRun(LPPREPROCESSOR preprocessor,LPMACRO macro,LPMACROCALL call,ULONG location,ULONG begin,ULONG end,LPTOKENARRAY result);
+ULONG GetArgument(LPPREPROCESSOR preprocessor,LPMACRO macro,LPMACROCALL call,ULONG parameter,LPTOKEN* tokens,PULONG count);
+ULONG GetArgumentFlags(LPPREPROCESSOR preprocessor,LPTOKEN tokens,ULONG count);
+BOOL StringizeTokens(LPPREPROCESSOR preprocessor,LPTOKEN tokens,ULONG count,LPTOKEN token);
+BOOL PasteTokens(LPPREPROCESSOR preprocessor,LPTOKEN left,LPTOKEN right);
+BOOL SpellToken(LPSTRING string,LPTOKEN token);
+BOOL LoadScratch(LPPREPROCESSOR preprocessor,LPCSTR name);
+
+// Internal directive functions
+ULONG ReadDirective(LPPREPROCESSOR preprocessor,LPTOKEN hash);
+ULONG ReadDefine(LPPREPROCESSOR preprocessor);
+ULONG ReadParameters(LPPREPROCESSOR preprocessor,LPMACRO macro,PULONG* parameters);
+ULONG ReadUndefine(LPPREPROCESSOR preprocessor);
+ULONG ReadInclude(LPPREPROCESSOR preprocessor,LPTOKEN directive);
+ULONG ReadConditional(LPPREPROCESSOR preprocessor,ULONG directive,LPTOKEN token);
+ULONG ReadMessage(LPPREPROCESSOR preprocessor,ULONG directive,LPTOKEN token);
+ULONG ReadPragma(LPPREPROCESSOR preprocessor,LPTOKEN hash,LPTOKEN directive);
+ULONG ReadLine(LPPREPROCESSOR preprocessor,LPTOKEN directive);
+ULONG SkipConditional(LPPREPROCESSOR preprocessor);
+BOOL PushConditional(LPPREPROCESSOR preprocessor,ULONG location,ULONG state);
+
+// Internal expression functions
+ULONG EvaluateCondition(LPPREPROCESSOR preprocessor,LPTOKEN directive,PBOOL value);
+ULONG EvaluateExpression(LPPREPROCESSOR preprocessor,LPTOKENARRAY tokens,ULONG precedence,LONGLONG* value);
+ULONG EvaluatePrimary(LPPREPROCESSOR preprocessor,LPTOKENARRAY tokens,LONGLONG* value);
+ULONG GetOperatorPrecedence(LPTOKEN token);
 
+// Internal error reporting functions
+VOID PreprocessorWarning(LPPREPROCESSOR preprocessor,LPTOKEN token,LPCSTR format,...);
+VOID PreprocessorError(LPPREPROCESSOR preprocessor,LPTOKEN token,LPCSTR format,...);